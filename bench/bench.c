@@ -0,0 +1,105 @@
+#include "bench.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Enough total items per measurement to drown out timer resolution.
+#define MIN_WORK  1000000
+
+static bool   json_output;
+static bool   first_row = true;
+static size_t range_min, range_max;
+
+static volatile long sink;
+
+static size_t parse_size(const char* prog, const char* arg)
+{
+    char* end;
+    unsigned long long result = strtoull(arg, &end, 10);
+    if (*end || !result) {
+        fprintf(stderr, "%s: bad size: %s\n", prog, arg);
+        exit(1);
+    }
+    return result;
+}
+
+void bench_init(int argc, char* argv[], size_t min_n, size_t max_n)
+{
+    range_min = min_n;
+    range_max = max_n;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--json")) {
+            json_output = true;
+        } else if (!strncmp(argv[i], "--min=", 6)) {
+            range_min = parse_size(argv[0], argv[i] + 6);
+        } else if (!strncmp(argv[i], "--max=", 6)) {
+            range_max = parse_size(argv[0], argv[i] + 6);
+        } else {
+            fprintf(stderr, "Usage: %s [--json] [--min=N] [--max=N]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+
+    if (json_output) printf("[");
+    else printf("benchmark,n,items,total_ns,ns_per_item\n");
+}
+
+size_t bench_min_n(void)
+{
+    return range_min;
+}
+
+size_t bench_max_n(void)
+{
+    return range_max;
+}
+
+size_t bench_next_n(size_t n)
+{
+    return n <= range_max / 10 ? n * 10 : 0;
+}
+
+size_t bench_reps(size_t n)
+{
+    return n >= MIN_WORK ? 1 : MIN_WORK / n;
+}
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void bench_report(const char* name, size_t n, size_t items, uint64_t ns)
+{
+    double per_item = items ? (double) ns / items : 0;
+
+    if (json_output) {
+        printf("%s\n  {\"benchmark\": \"%s\", \"n\": %zu, \"items\": %zu, "
+               "\"total_ns\": %llu, \"ns_per_item\": %.3f}",
+               first_row ? "" : ",", name, n, items,
+               (unsigned long long) ns, per_item);
+    } else {
+        printf("%s,%zu,%zu,%llu,%.3f\n",
+               name, n, items, (unsigned long long) ns, per_item);
+    }
+
+    first_row = false;
+    fflush(stdout);
+}
+
+void bench_finish(void)
+{
+    if (json_output) printf("\n]\n");
+}
+
+void bench_sink(long value)
+{
+    sink += value;
+}
@@ -0,0 +1,48 @@
+// A tiny harness for the micro-benchmarks in this directory.
+//
+// Each benchmark program times some operation at a range of sizes and
+// reports one row per measurement, either as CSV (the default) or as a
+// JSON array (`--json`), so results can be saved and compared between
+// releases. Every program accepts:
+//
+//   --json          report JSON instead of CSV
+//   --min=N         smallest size to try (default depends on program)
+//   --max=N         largest size to try (default depends on program)
+//
+// Build in release mode (`-DCMAKE_BUILD_TYPE=Release`) for numbers
+// worth tracking.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Parses the common command-line options above and prints the report
+// header. `min_n` and `max_n` are the program's default size range.
+// Exits with a usage message on unrecognized arguments.
+void bench_init(int argc, char* argv[], size_t min_n, size_t max_n);
+
+// The size range to try, after command-line options.
+size_t bench_min_n(void), bench_max_n(void);
+
+// Returns the next size to try after `n` (sizes grow by 10x), or 0 once
+// past `bench_max_n()`.
+size_t bench_next_n(size_t n);
+
+// How many times to repeat an O(n) measurement of size `n` so that the
+// total amount of work is large enough to time reliably.
+size_t bench_reps(size_t n);
+
+// A monotonic clock in nanoseconds.
+uint64_t bench_now_ns(void);
+
+// Reports that benchmark `name` processed `items` items (of size `n`)
+// in `ns` nanoseconds.
+void bench_report(const char* name, size_t n, size_t items, uint64_t ns);
+
+// Finishes the report (closing the JSON array, if any).
+void bench_finish(void);
+
+// Consumes a value so the compiler can't optimize away the work that
+// produced it.
+void bench_sink(long);
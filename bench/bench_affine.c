@@ -0,0 +1,82 @@
+// Throughput of the batched affine-transform kernels (affine.h) against
+// transforming one heap-allocated `posn_t` at a time. Sizes are numbers
+// of points.
+
+#include "bench.h"
+#include "../src/affine.h"
+#include "../src/heap_posn.h"
+#include "../src/parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void* xmalloc(size_t size)
+{
+    void* result = malloc(size);
+    if (!result) { perror("bench_affine"); exit(1); }
+    return result;
+}
+
+// The per-object baseline: each point is its own `posn_t`.
+static void apply_posns(const struct affine* m, posn_t* ps, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        double x = posn_x(ps[i]), y = posn_y(ps[i]);
+        posn_set(ps[i], (m->a * x + m->b * y) + m->tx,
+                        (m->c * x + m->d * y) + m->ty);
+    }
+}
+
+static void bench_size(const struct affine* m, size_t n, int threads)
+{
+    size_t reps = bench_reps(n);
+    double* xs = xmalloc(n * sizeof xs[0]);
+    double* ys = xmalloc(n * sizeof ys[0]);
+    posn_t* ps = xmalloc(n * sizeof ps[0]);
+
+    for (size_t i = 0; i < n; ++i) {
+        xs[i] = i;
+        ys[i] = -(double) i;
+        ps[i] = posn_create(xs[i], ys[i]);
+        if (!ps[i]) { perror("bench_affine"); exit(1); }
+    }
+
+    uint64_t start = bench_now_ns();
+    for (size_t r = 0; r < reps; ++r) apply_posns(m, ps, n);
+    bench_report("per_posn", n, n * reps, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (size_t r = 0; r < reps; ++r) affine_apply_scalar(m, xs, ys, n);
+    bench_report("batch_scalar", n, n * reps, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (size_t r = 0; r < reps; ++r) affine_apply(m, xs, ys, n);
+    bench_report("batch_simd", n, n * reps, bench_now_ns() - start);
+
+    start = bench_now_ns();
+    for (size_t r = 0; r < reps; ++r)
+        affine_apply_parallel(m, xs, ys, n, threads);
+    bench_report("batch_parallel", n, n * reps, bench_now_ns() - start);
+
+    bench_sink((long) (xs[n - 1] + posn_x(ps[n - 1])));
+
+    for (size_t i = 0; i < n; ++i) posn_destroy(ps[i]);
+    free(ps);
+    free(ys);
+    free(xs);
+}
+
+int main(int argc, char* argv[])
+{
+    bench_init(argc, argv, 1000, 10000000);
+
+    // A rotation composed with a translation: every coefficient in use.
+    struct affine m = affine_compose(affine_rotate(30),
+                                     affine_translate(1, 2));
+    int threads = parallel_default_threads();
+
+    for (size_t n = bench_min_n(); n; n = bench_next_n(n))
+        bench_size(&m, n, threads);
+
+    bench_finish();
+}
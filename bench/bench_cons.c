@@ -0,0 +1,346 @@
+// Micro-benchmarks for the linked-list API in src/cons.h: cons/uncons
+// throughput, per-element cost of `map`, `for_each` and `foldr` (as a
+// sum and to rebuild the list, which is what `map` does), and `for_each`
+// over a list scattered across the heap, with prefetching, and after
+// `list_compact`; and summing a sorted list of IDs as a `list_t` vs. as
+// a packed list (src/packed_list.h); and looking up keys by scanning a
+// list vs. in a hash set (src/int_hash.h); and a workload of short
+// lists as `list_t`s vs. as small lists (src/small_list.h).
+//
+// Built as bench_cons_arena, cons cells come from huge pages (see
+// src/arena.h).
+
+#include "bench.h"
+#include "../src/cons.h"
+#include "../src/int_hash.h"
+#include "../src/packed_list.h"
+#include "../src/small_list.h"
+
+#ifdef HUGE_ARENAS
+#   include "../src/arena.h"
+#endif
+
+#include <stdlib.h>
+
+// Builds the list 0, 1, ..., (length - 1).
+static list_t iota(size_t length)
+{
+    list_t result = empty;
+    while (length) result = cons(--length, result);
+    return result;
+}
+
+// Builds the list 0, 1, ..., (length - 1) with its cells in a random
+// order in memory, as a list built up over a long time would be. (This
+// frees a batch of cells in a shuffled order so that the allocator hands
+// them back that way. Freeing `cells` any earlier would let malloc
+// consolidate the freed cells, undoing the shuffle.)
+static list_t scattered_iota(size_t length)
+{
+    list_t* cells = malloc(length * sizeof *cells);
+    if (!cells) abort();
+
+    for (size_t i = 0; i < length; ++i) cells[i] = cons(0, empty);
+
+    srand(1);
+    for (size_t i = length; i > 1; --i) {
+        size_t j = ((size_t) rand() * RAND_MAX + rand()) % i;
+        list_t t = cells[i - 1];
+        cells[i - 1] = cells[j];
+        cells[j] = t;
+    }
+
+    for (size_t i = 0; i < length; ++i) uncons_one(cells[i]);
+    list_t result = iota(length);
+    free(cells);
+
+    return result;
+}
+
+// Builds a sorted list of `length` IDs, neighbors 1 to 64 apart.
+static list_t sorted_ids(size_t length)
+{
+    list_t result = empty;
+    int id = (int) (64 * length);
+
+    srand(2);
+    while (length--) result = cons(id -= 1 + rand() % 64, result);
+    return result;
+}
+
+// Doubling in unsigned arithmetic, which wraps around instead of
+// overflowing, since `for_each(dblp, ...)` is repeated on one list.
+static int  dbl(int z) { return (int) ((unsigned) z << 1); }
+static void dblp(int* pz) { *pz = dbl(*pz); }
+
+static long sum_so_far;
+static void add_to_sum(int* pz) { sum_so_far += *pz; }
+
+static void* fold_sum(int z, void* sum) { *(long*) sum += z; return sum; }
+static void* fold_cons_dbl(int z, void* acc) { return cons(dbl(z), acc); }
+
+static void bench_cons_uncons(size_t n)
+{
+    size_t reps = bench_reps(n);
+    uint64_t cons_ns = 0, uncons_ns = 0;
+
+    for (size_t r = 0; r < reps; ++r) {
+        uint64_t start = bench_now_ns();
+        list_t lst = iota(n);
+        uint64_t middle = bench_now_ns();
+        uncons_all(lst);
+        uint64_t end = bench_now_ns();
+
+        cons_ns   += middle - start;
+        uncons_ns += end - middle;
+    }
+
+    bench_report("cons", n, n * reps, cons_ns);
+    bench_report("uncons_all", n, n * reps, uncons_ns);
+}
+
+static void bench_map_for_each(size_t n)
+{
+    size_t reps = bench_reps(n);
+    list_t lst = iota(n);
+    uint64_t map_ns = 0, for_each_ns = 0;
+
+    for (size_t r = 0; r < reps; ++r) {
+        uint64_t start = bench_now_ns();
+        list_t mapped = map(dbl, lst);
+        uint64_t end = bench_now_ns();
+
+        bench_sink(first(mapped));
+        uncons_all(mapped);
+        map_ns += end - start;
+    }
+
+    for (size_t r = 0; r < reps; ++r) {
+        uint64_t start = bench_now_ns();
+        for_each(dblp, lst);
+        for_each_ns += bench_now_ns() - start;
+    }
+
+    bench_sink(first(lst));
+    uncons_all(lst);
+
+    bench_report("map", n, n * reps, map_ns);
+    bench_report("for_each", n, n * reps, for_each_ns);
+}
+
+static void bench_foldr(size_t n)
+{
+    size_t reps = bench_reps(n);
+    list_t lst = iota(n);
+    uint64_t sum_ns = 0, cons_ns = 0;
+
+    for (size_t r = 0; r < reps; ++r) {
+        long sum = 0;
+        uint64_t start = bench_now_ns();
+        foldr(fold_sum, &sum, lst);
+        sum_ns += bench_now_ns() - start;
+        bench_sink(sum);
+    }
+
+    for (size_t r = 0; r < reps; ++r) {
+        uint64_t start = bench_now_ns();
+        list_t mapped = foldr(fold_cons_dbl, empty, lst);
+        uint64_t end = bench_now_ns();
+
+        bench_sink(first(mapped));
+        uncons_all(mapped);
+        cons_ns += end - start;
+    }
+
+    uncons_all(lst);
+
+    bench_report("foldr_sum", n, n * reps, sum_ns);
+    bench_report("foldr_cons", n, n * reps, cons_ns);
+}
+
+static void bench_scattered(size_t n)
+{
+    size_t reps = bench_reps(n);
+    list_t lst = scattered_iota(n);
+    uint64_t plain_ns = 0, prefetch_ns = 0, compacted_ns = 0;
+
+    for (size_t r = 0; r < reps; ++r) {
+        uint64_t start = bench_now_ns();
+        for_each(dblp, lst);
+        plain_ns += bench_now_ns() - start;
+    }
+
+    for (size_t r = 0; r < reps; ++r) {
+        uint64_t start = bench_now_ns();
+        for_each_prefetch(dblp, lst);
+        prefetch_ns += bench_now_ns() - start;
+    }
+
+    uint64_t start = bench_now_ns();
+    lst = list_compact(lst);
+    uint64_t compact_ns = bench_now_ns() - start;
+
+    for (size_t r = 0; r < reps; ++r) {
+        start = bench_now_ns();
+        for_each(dblp, lst);
+        compacted_ns += bench_now_ns() - start;
+    }
+
+    bench_sink(first(lst));
+    uncons_all(lst);
+
+    bench_report("for_each_scattered", n, n * reps, plain_ns);
+    bench_report("for_each_prefetch_scattered", n, n * reps, prefetch_ns);
+    bench_report("list_compact", n, n, compact_ns);
+    bench_report("for_each_compacted", n, n * reps, compacted_ns);
+}
+
+static void bench_packed(size_t n)
+{
+    size_t reps = bench_reps(n);
+    list_t lst = sorted_ids(n);
+    uint64_t list_ns = 0, packed_ns = 0;
+
+    uint64_t start = bench_now_ns();
+    packed_list_t pl = pl_from_list(lst);
+    uint64_t pack_ns = bench_now_ns() - start;
+    if (!pl) abort();
+
+    for (size_t r = 0; r < reps; ++r) {
+        start = bench_now_ns();
+        sum_so_far = 0;
+        for_each(add_to_sum, lst);
+        list_ns += bench_now_ns() - start;
+        bench_sink(sum_so_far);
+    }
+
+    for (size_t r = 0; r < reps; ++r) {
+        start = bench_now_ns();
+        bench_sink(pl_sum(pl));
+        packed_ns += bench_now_ns() - start;
+    }
+
+    start = bench_now_ns();
+    list_t unpacked = pl_to_list(pl);
+    uint64_t unpack_ns = bench_now_ns() - start;
+
+    uncons_all(unpacked);
+    uncons_all(lst);
+    pl_destroy(pl);
+
+    bench_report("sum_list", n, n * reps, list_ns);
+    bench_report("sum_packed", n, n * reps, packed_ns);
+    bench_report("pl_from_list", n, n, pack_ns);
+    bench_report("pl_to_list", n, n, unpack_ns);
+}
+
+// Is `key` an element of `lst`?
+static bool list_contains(list_t lst, int key)
+{
+    for (; is_cons(lst); lst = rest(lst))
+        if (first(lst) == key) return true;
+    return false;
+}
+
+// The `i`th key to look up among 0, 1, ..., (n - 1): about half are
+// present (but not the first, so that one lookup alone is no shortcut).
+static int lookup_key(size_t i, size_t n)
+{
+    return (int) ((i * 7919 + n) % (2 * n));
+}
+
+static void bench_lookup(size_t n)
+{
+    // Each list lookup scans O(n), so do as many as one O(n) pass.
+    size_t list_lookups = bench_reps(n);
+    size_t set_lookups  = n * bench_reps(n);
+    list_t lst = iota(n);
+    long found = 0;
+
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < list_lookups; ++i)
+        found += list_contains(lst, lookup_key(i, n));
+    uint64_t list_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    int_set_t set = iset_from_list(lst);
+    uint64_t build_ns = bench_now_ns() - start;
+    if (!set) abort();
+
+    start = bench_now_ns();
+    for (size_t i = 0; i < set_lookups; ++i)
+        found += iset_contains(set, lookup_key(i, n));
+    uint64_t set_ns = bench_now_ns() - start;
+
+    bench_sink(found);
+    iset_destroy(set);
+    uncons_all(lst);
+
+    bench_report("lookup_list", n, list_lookups, list_ns);
+    bench_report("iset_from_list", n, n, build_ns);
+    bench_report("lookup_iset", n, set_lookups, set_ns);
+}
+
+// The length of the `i`th short list: 1 to SMALL_LIST_INLINE.
+static size_t short_length(size_t i)
+{
+    return 1 + i % SMALL_LIST_INLINE;
+}
+
+static void bench_short_lists(size_t n)
+{
+    uint64_t cons_ns = 0, small_ns = 0;
+    size_t elements = 0;
+    long sum = 0;
+
+    // Build, map, modify in place, sum, and free each of n short lists.
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        list_t lst = iota(short_length(i));
+        list_t doubled = map(dbl, lst);
+        for_each(dblp, doubled);
+        for (list_t p = doubled; is_cons(p); p = rest(p)) sum += first(p);
+        uncons_all(doubled);
+        uncons_all(lst);
+    }
+    cons_ns = bench_now_ns() - start;
+
+    start = bench_now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        small_list_t sl = sl_empty;
+        for (size_t k = short_length(i); k; ) sl = sl_cons((int) --k, sl);
+        small_list_t doubled = sl_map(dbl, sl);
+        sl_for_each(dblp, &doubled);
+        for (small_list_t p = doubled; sl_is_cons(p); p = sl_rest(p))
+            sum += sl_first(p);
+        sl_free(doubled);
+        sl_free(sl);
+        elements += short_length(i);
+    }
+    small_ns = bench_now_ns() - start;
+
+    bench_sink(sum);
+    bench_report("short_lists_cons", n, elements, cons_ns);
+    bench_report("short_lists_small", n, elements, small_ns);
+}
+
+int main(int argc, char* argv[])
+{
+    bench_init(argc, argv, 1000, 10000000);
+
+    for (size_t n = bench_min_n(); n; n = bench_next_n(n)) {
+        bench_cons_uncons(n);
+        bench_map_for_each(n);
+        bench_foldr(n);
+        bench_scattered(n);
+        bench_packed(n);
+        bench_lookup(n);
+        bench_short_lists(n);
+    }
+
+    bench_finish();
+
+#ifdef HUGE_ARENAS
+    arena_report();
+#endif
+}
@@ -0,0 +1,280 @@
+// Micro-benchmarks for the geometry library: `posn_create`/`posn_clone`,
+// owning vs. borrowing triangle creation, visiting triangles in random
+// order, and the parse/format rates of geo_client's triangle format
+// (geo_io.h) on generated inputs.
+//
+// Built as bench_geo_arena, posns and triangles come from huge pages
+// (see src/arena.h); the random-order visits are where that shows, e.g.
+// under `perf stat -e dTLB-load-misses`.
+//
+// Sizes are numbers of objects (or triangles, for parse/format). The
+// generated input is written to a temporary file, so very large sizes
+// (e.g. `--max=100000000`) need a correspondingly large temp directory.
+
+#include "bench.h"
+#include "../src/borrow_tri.h"
+#include "../src/geo_io.h"
+#include "../src/owning_tri.h"
+
+#ifdef HUGE_ARENAS
+#   include "../src/arena.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static void bench_posns(size_t n)
+{
+    size_t reps = bench_reps(n);
+    posn_t* posns = malloc(n * sizeof posns[0]);
+    if (!posns) { perror("bench_geo"); exit(1); }
+
+    uint64_t create_ns = 0, clone_ns = 0;
+
+    for (size_t r = 0; r < reps; ++r) {
+        uint64_t start = bench_now_ns();
+        for (size_t i = 0; i < n; ++i) posns[i] = posn_create(i, -(double) i);
+        create_ns += bench_now_ns() - start;
+
+        for (size_t i = 0; i < n; ++i) posn_destroy(posns[i]);
+
+        start = bench_now_ns();
+        for (size_t i = 0; i < n; ++i) posns[i] = posn_clone(ORIGIN);
+        clone_ns += bench_now_ns() - start;
+
+        for (size_t i = 0; i < n; ++i) posn_destroy(posns[i]);
+    }
+
+    free(posns);
+
+    bench_report("posn_create", n, n * reps, create_ns);
+    bench_report("posn_clone", n, n * reps, clone_ns);
+}
+
+static void bench_triangles(size_t n)
+{
+    size_t reps = bench_reps(n);
+    void** tris = malloc(n * sizeof tris[0]);
+    if (!tris) { perror("bench_geo"); exit(1); }
+
+    uint64_t ot_ns = 0, bt_ns = 0;
+
+    for (size_t r = 0; r < reps; ++r) {
+        uint64_t start = bench_now_ns();
+        for (size_t i = 0; i < n; ++i) tris[i] = ot_create();
+        ot_ns += bench_now_ns() - start;
+
+        for (size_t i = 0; i < n; ++i) ot_destroy(tris[i]);
+
+        start = bench_now_ns();
+        for (size_t i = 0; i < n; ++i) tris[i] = bt_create();
+        bt_ns += bench_now_ns() - start;
+
+        for (size_t i = 0; i < n; ++i) bt_destroy(tris[i]);
+    }
+
+    free(tris);
+
+    bench_report("ot_create", n, n * reps, ot_ns);
+    bench_report("bt_create", n, n * reps, bt_ns);
+}
+
+static void bench_visit(size_t n)
+{
+    size_t reps = bench_reps(n);
+    owning_tri_t* tris = malloc(n * sizeof tris[0]);
+    size_t* order = malloc(n * sizeof order[0]);
+    if (!tris || !order) { perror("bench_geo"); exit(1); }
+
+    for (size_t i = 0; i < n; ++i) {
+        tris[i] = ot_create();
+        if (!tris[i]) { perror("bench_geo"); exit(1); }
+        order[i] = i;
+    }
+
+    unsigned long state = 54321;
+    for (size_t i = n; i > 1; --i) {
+        state = state * 6364136223846793005UL + 1442695040888963407UL;
+        size_t j = (state >> 17) % i, t = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = t;
+    }
+
+    // Each visit touches the triangle and its three posns.
+    double sum = 0;
+    uint64_t start = bench_now_ns();
+    for (size_t r = 0; r < reps; ++r)
+        for (size_t i = 0; i < n; ++i)
+            for (int v = 0; v < 3; ++v)
+                sum += posn_x(ot_get_borrowed(tris[order[i]], v));
+    uint64_t visit_ns = bench_now_ns() - start;
+
+    bench_sink((long) sum);
+    for (size_t i = 0; i < n; ++i) ot_destroy(tris[i]);
+    free(order);
+    free(tris);
+
+    bench_report("ot_visit_random", n, n * reps, visit_ns);
+}
+
+// Writes `n` pseudo-random triangles to `f` and returns the time taken.
+static uint64_t generate(FILE* f, size_t n)
+{
+    unsigned long state = 12345;
+    uint64_t start = bench_now_ns();
+
+    for (size_t i = 0; i < n; ++i) {
+        geo_write_header(f);
+        for (int v = 0; v < 3; ++v) {
+            state = state * 6364136223846793005UL + 1442695040888963407UL;
+            double x = (double) (state >> 40) / 1024;
+            double y = (double) ((state >> 16) & 0xFFFFFF) / 1024;
+            geo_write_coords(f, x, y);
+        }
+        geo_write_end(f);
+    }
+
+    fflush(f);
+    return bench_now_ns() - start;
+}
+
+// Parses triangles by replacing each vertex of an owning triangle with
+// a freshly allocated posn (geo_client's original owning read path).
+static size_t parse_owning(FILE* f)
+{
+    owning_tri_t t = ot_create();
+    size_t count = 0;
+    double x, y;
+
+    while (geo_read_header(f) != EOF) {
+        for (int v = 0; v < 3; ++v) {
+            if (!geo_read_coords(f, &x, &y)) goto done;
+            ot_put_owned(t, v, posn_create(x, y));
+        }
+        ++count;
+    }
+
+done:
+    ot_destroy(t);
+    return count;
+}
+
+// Parses triangles through a temporary posn per vertex, copied into a
+// borrowing triangle (geo_client's original borrowing read path).
+static size_t parse_borrowing(FILE* f)
+{
+    borrow_tri_t t = bt_create();
+    posn_t owner[3];
+    size_t count = 0;
+    double x, y;
+
+    for (int v = 0; v < 3; ++v) {
+        owner[v] = posn_clone(ORIGIN);
+        bt_put_borrowed(t, v, owner[v]);
+    }
+
+    while (geo_read_header(f) != EOF) {
+        for (int v = 0; v < 3; ++v) {
+            if (!geo_read_coords(f, &x, &y)) goto done;
+            posn_t p = posn_create(x, y);
+            bt_set_borrowed(t, v, p);
+            posn_destroy(p);
+        }
+        ++count;
+    }
+
+done:
+    bt_destroy(t);
+    for (int v = 0; v < 3; ++v) posn_destroy(owner[v]);
+    return count;
+}
+
+// Parses triangles by overwriting the vertices of `t` in place, as
+// geo_client does now; `vertex` borrows a vertex from either backend.
+static size_t
+parse_in_place(void* t, posn_t (*vertex)(void*, int), FILE* f)
+{
+    size_t count = 0;
+    double x, y;
+
+    while (geo_read_header(f) != EOF) {
+        for (int v = 0; v < 3; ++v) {
+            if (!geo_read_coords(f, &x, &y)) return count;
+            posn_set(vertex(t, v), x, y);
+        }
+        ++count;
+    }
+
+    return count;
+}
+
+static posn_t ot_vertex(void* t, int v) { return ot_get_borrowed(t, v); }
+static posn_t bt_vertex(void* t, int v) { return bt_get_borrowed(t, v); }
+
+static void bench_parse_in_place(FILE* f, size_t n)
+{
+    owning_tri_t ot = ot_create();
+
+    rewind(f);
+    uint64_t start = bench_now_ns();
+    size_t count = parse_in_place(ot, ot_vertex, f);
+    bench_report("parse_owning_in_place", n, count, bench_now_ns() - start);
+
+    ot_destroy(ot);
+
+    borrow_tri_t bt = bt_create();
+    posn_t owner[3];
+    for (int v = 0; v < 3; ++v) {
+        owner[v] = posn_clone(ORIGIN);
+        bt_put_borrowed(bt, v, owner[v]);
+    }
+
+    rewind(f);
+    start = bench_now_ns();
+    count = parse_in_place(bt, bt_vertex, f);
+    bench_report("parse_borrowing_in_place", n, count,
+                 bench_now_ns() - start);
+
+    bt_destroy(bt);
+    for (int v = 0; v < 3; ++v) posn_destroy(owner[v]);
+}
+
+static void bench_parse_format(size_t n)
+{
+    FILE* f = tmpfile();
+    if (!f) { perror("bench_geo"); exit(1); }
+
+    bench_report("format", n, n, generate(f, n));
+
+    rewind(f);
+    uint64_t start = bench_now_ns();
+    size_t count = parse_owning(f);
+    bench_report("parse_owning", n, count, bench_now_ns() - start);
+
+    rewind(f);
+    start = bench_now_ns();
+    count = parse_borrowing(f);
+    bench_report("parse_borrowing", n, count, bench_now_ns() - start);
+
+    bench_parse_in_place(f, n);
+
+    fclose(f);
+}
+
+int main(int argc, char* argv[])
+{
+    bench_init(argc, argv, 1000, 1000000);
+
+    for (size_t n = bench_min_n(); n; n = bench_next_n(n)) {
+        bench_posns(n);
+        bench_triangles(n);
+        bench_visit(n);
+        bench_parse_format(n);
+    }
+
+    bench_finish();
+
+#ifdef HUGE_ARENAS
+    arena_report();
+#endif
+}
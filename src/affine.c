@@ -0,0 +1,198 @@
+#include "affine.h"
+#include "parallel.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#   define HAVE_X86_SIMD
+#   include <immintrin.h>
+#endif
+
+// Below this many points per thread, threading costs more than it saves.
+#define MIN_POINTS_PER_THREAD  (1 << 15)
+
+static const double PI = 3.14159265358979323846;
+
+
+struct affine affine_identity(void)
+{
+    return (struct affine) { .a = 1, .d = 1 };
+}
+
+struct affine affine_translate(double dx, double dy)
+{
+    return (struct affine) { .a = 1, .d = 1, .tx = dx, .ty = dy };
+}
+
+struct affine affine_rotate(double degrees)
+{
+    double r = degrees * PI / 180, c = cos(r), s = sin(r);
+    return (struct affine) { .a = c, .b = -s, .c = s, .d = c };
+}
+
+struct affine affine_scale(double sx, double sy)
+{
+    return (struct affine) { .a = sx, .d = sy };
+}
+
+struct affine affine_project(double degrees)
+{
+    double r = degrees * PI / 180, c = cos(r), s = sin(r);
+    return (struct affine) { .a = c * c, .b = c * s, .c = c * s, .d = s * s };
+}
+
+struct affine affine_compose(struct affine f, struct affine t)
+{
+    return (struct affine) {
+        .a  = t.a * f.a + t.b * f.c,
+        .b  = t.a * f.b + t.b * f.d,
+        .tx = t.a * f.tx + t.b * f.ty + t.tx,
+        .c  = t.c * f.a + t.d * f.c,
+        .d  = t.c * f.b + t.d * f.d,
+        .ty = t.c * f.tx + t.d * f.ty + t.ty,
+    };
+}
+
+bool affine_parse(const char* spec, struct affine* out)
+{
+    double u, v;
+    char extra;
+
+    if (sscanf(spec, "translate:%lf,%lf%c", &u, &v, &extra) == 2) {
+        *out = affine_translate(u, v);
+    } else if (sscanf(spec, "rotate:%lf%c", &u, &extra) == 1) {
+        *out = affine_rotate(u);
+    } else if (sscanf(spec, "scale:%lf,%lf%c", &u, &v, &extra) == 2) {
+        *out = affine_scale(u, v);
+    } else if (sscanf(spec, "scale:%lf%c", &u, &extra) == 1) {
+        *out = affine_scale(u, u);
+    } else if (sscanf(spec, "project:%lf%c", &u, &extra) == 1) {
+        *out = affine_project(u);
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+
+//
+// Kernels
+//
+// All versions evaluate (a * x + b * y) + tx in the same order and
+// without fused multiply-adds (CMakeLists.txt builds this file with
+// -ffp-contract=off), so they agree exactly.
+//
+
+void affine_apply_scalar(const struct affine* m,
+                         double* xs, double* ys, size_t n)
+{
+    const double a = m->a, b = m->b, tx = m->tx;
+    const double c = m->c, d = m->d, ty = m->ty;
+
+    for (size_t i = 0; i < n; ++i) {
+        double x = xs[i], y = ys[i];
+        xs[i] = (a * x + b * y) + tx;
+        ys[i] = (c * x + d * y) + ty;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("avx2")))
+static void apply_avx2(const struct affine* m,
+                       double* xs, double* ys, size_t n)
+{
+    const __m256d a  = _mm256_set1_pd(m->a),  b  = _mm256_set1_pd(m->b);
+    const __m256d c  = _mm256_set1_pd(m->c),  d  = _mm256_set1_pd(m->d);
+    const __m256d tx = _mm256_set1_pd(m->tx), ty = _mm256_set1_pd(m->ty);
+
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(xs + i);
+        __m256d y = _mm256_loadu_pd(ys + i);
+
+        __m256d nx = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(a, x),
+                                                 _mm256_mul_pd(b, y)), tx);
+        __m256d ny = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(c, x),
+                                                 _mm256_mul_pd(d, y)), ty);
+
+        _mm256_storeu_pd(xs + i, nx);
+        _mm256_storeu_pd(ys + i, ny);
+    }
+
+    affine_apply_scalar(m, xs + i, ys + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void apply_avx512(const struct affine* m,
+                         double* xs, double* ys, size_t n)
+{
+    const __m512d a  = _mm512_set1_pd(m->a),  b  = _mm512_set1_pd(m->b);
+    const __m512d c  = _mm512_set1_pd(m->c),  d  = _mm512_set1_pd(m->d);
+    const __m512d tx = _mm512_set1_pd(m->tx), ty = _mm512_set1_pd(m->ty);
+
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m512d x = _mm512_loadu_pd(xs + i);
+        __m512d y = _mm512_loadu_pd(ys + i);
+
+        __m512d nx = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(a, x),
+                                                 _mm512_mul_pd(b, y)), tx);
+        __m512d ny = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(c, x),
+                                                 _mm512_mul_pd(d, y)), ty);
+
+        _mm512_storeu_pd(xs + i, nx);
+        _mm512_storeu_pd(ys + i, ny);
+    }
+
+    affine_apply_scalar(m, xs + i, ys + i, n - i);
+}
+
+#endif // HAVE_X86_SIMD
+
+void affine_apply(const struct affine* m, double* xs, double* ys, size_t n)
+{
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx512f")) {
+        apply_avx512(m, xs, ys, n);
+        return;
+    }
+
+    if (__builtin_cpu_supports("avx2")) {
+        apply_avx2(m, xs, ys, n);
+        return;
+    }
+#endif // HAVE_X86_SIMD
+
+    affine_apply_scalar(m, xs, ys, n);
+}
+
+
+//
+// Threading
+//
+
+struct apply_job
+{
+    const struct affine*  m;
+    double*               xs;
+    double*               ys;
+};
+
+static void apply_range(size_t begin, size_t end, void* env)
+{
+    struct apply_job* job = env;
+    affine_apply(job->m, job->xs + begin, job->ys + begin, end - begin);
+}
+
+void affine_apply_parallel(const struct affine* m,
+                           double* xs, double* ys, size_t n, int threads)
+{
+    struct apply_job job = { m, xs, ys };
+    parallel_for(n, threads, MIN_POINTS_PER_THREAD, apply_range, &job);
+}
@@ -0,0 +1,58 @@
+// Affine transformations of the plane, applied in bulk to contiguous
+// coordinate arrays (such as those of a `tri_batch_t`).
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The transformation
+//
+//     x' = a * x + b * y + tx
+//     y' = c * x + d * y + ty
+//
+// This is a plain value type: copy it, compose it, pass it around.
+struct affine
+{
+    double a, b, tx;
+    double c, d, ty;
+};
+
+// Basic transformations. Angles are in degrees, counterclockwise.
+struct affine affine_identity(void);
+struct affine affine_translate(double dx, double dy);
+struct affine affine_rotate(double degrees);
+struct affine affine_scale(double sx, double sy);
+
+// Orthogonal projection onto the line through the origin at the given
+// angle from the x axis.
+struct affine affine_project(double degrees);
+
+// Returns the transformation that applies `first` and then `then`.
+struct affine affine_compose(struct affine first, struct affine then);
+
+// Parses a transformation written as one of
+//
+//     translate:DX,DY    rotate:DEG    scale:S    scale:SX,SY
+//     project:DEG
+//
+// into `*out`. Returns false (leaving `*out` alone) if `spec` is
+// malformed.
+bool affine_parse(const char* spec, struct affine* out);
+
+// Transforms the `n` points (xs[i], ys[i]) in place.
+//
+// Uses AVX-512 or AVX2 when the CPU supports them and falls back to
+// scalar code otherwise; every version computes bit-for-bit the same
+// results.
+void affine_apply(const struct affine*, double* xs, double* ys, size_t n);
+
+// Like `affine_apply`, but always uses the scalar version. (For
+// comparison.)
+void affine_apply_scalar(const struct affine*,
+                         double* xs, double* ys, size_t n);
+
+// Like `affine_apply`, but splits large inputs across up to `threads`
+// threads.
+void affine_apply_parallel(const struct affine*,
+                           double* xs, double* ys, size_t n, int threads);
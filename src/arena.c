@@ -0,0 +1,135 @@
+#include "arena.h"
+
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+// Huge page size, and how much to map at a time (a multiple of it).
+#define HUGE_PAGE     ((size_t) 2 << 20)
+#define REGION_SIZE   (16 * HUGE_PAGE)
+
+// Every arena with a region, for `arena_report`.
+static struct arena* all_arenas;
+
+
+//
+// Forward declarations
+//
+
+// Takes and releases the arena's lock.
+static void lock(struct arena*);
+static void unlock(struct arena*);
+
+// Maps a new region and makes it the one to allocate from. Returns
+// false on allocation error.
+static bool add_region(struct arena*);
+
+
+void* arena_alloc(struct arena* a)
+{
+    void* obj;
+
+    lock(a);
+
+    if (a->free_list) {
+        obj = a->free_list;
+        a->free_list = *(void**) obj;
+    } else if ((size_t) (a->end - a->next) >= a->size || add_region(a)) {
+        obj = a->next;
+        a->next += a->size;
+    } else {
+        obj = NULL;
+    }
+
+    unlock(a);
+    return obj;
+}
+
+void arena_free(struct arena* a, void* obj)
+{
+    if (!obj) return;
+
+    lock(a);
+    *(void**) obj = a->free_list;
+    a->free_list = obj;
+    unlock(a);
+}
+
+void arena_report(void)
+{
+    struct arena* a = __atomic_load_n(&all_arenas, __ATOMIC_ACQUIRE);
+
+    for (; a; a = a->next_arena) {
+        lock(a);
+        fprintf(stderr,
+                "%s arena: %zu regions (%zu hugetlb, %zu thp, %zu plain)\n",
+                a->kind,
+                a->hugetlb_regions + a->thp_regions + a->plain_regions,
+                a->hugetlb_regions, a->thp_regions, a->plain_regions);
+        unlock(a);
+    }
+}
+
+// Critical sections are a few instructions long, so spinning beats
+// sleeping on a mutex; yield in case the holder isn't running.
+static void lock(struct arena* a)
+{
+    while (__atomic_exchange_n(&a->lock, 1, __ATOMIC_ACQUIRE))
+        while (__atomic_load_n(&a->lock, __ATOMIC_RELAXED)) sched_yield();
+}
+
+static void unlock(struct arena* a)
+{
+    __atomic_store_n(&a->lock, 0, __ATOMIC_RELEASE);
+}
+
+static bool add_region(struct arena* a)
+{
+    char* region;
+
+#ifdef MAP_HUGETLB
+    region = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (region != MAP_FAILED) {
+        ++a->hugetlb_regions;
+        goto done;
+    }
+#endif
+
+    // Over-map so that a 2 MiB-aligned region fits, and trim the rest;
+    // transparent huge pages only back aligned 2 MiB ranges.
+    char* raw = mmap(NULL, REGION_SIZE + HUGE_PAGE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) return false;
+
+    region = (char*) (((uintptr_t) raw + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+    if (region > raw) munmap(raw, (size_t) (region - raw));
+    munmap(region + REGION_SIZE, (size_t) (raw + HUGE_PAGE - region));
+
+#ifdef MADV_HUGEPAGE
+    if (!madvise(region, REGION_SIZE, MADV_HUGEPAGE)) {
+        ++a->thp_regions;
+        goto done;
+    }
+#endif
+
+    ++a->plain_regions;
+
+done:
+    if (!a->next) {
+        // First region: register the arena.
+        a->next_arena = __atomic_load_n(&all_arenas, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&all_arenas, &a->next_arena, a,
+                                            true, __ATOMIC_RELEASE,
+                                            __ATOMIC_RELAXED))
+            continue;
+    }
+
+    // The rest of the old region, if any, is too small for an object
+    // and is abandoned.
+    a->next = region;
+    a->end  = region + REGION_SIZE;
+    return true;
+}
@@ -0,0 +1,59 @@
+// Pools of fixed-size objects carved out of huge pages.
+
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * With hundreds of millions of small objects (cons cells, posns,
+ * triangles) each malloc'd separately, walking them misses the TLB
+ * constantly. An arena hands out objects of one size from large
+ * mmap'd regions backed by 2 MiB pages where possible, so one TLB
+ * entry covers tens of thousands of objects instead of a few hundred.
+ *
+ * Each region is mapped with MAP_HUGETLB if the system has huge pages
+ * reserved; otherwise it's mapped normally, aligned to 2 MiB, and
+ * marked MADV_HUGEPAGE so transparent huge pages can back it; failing
+ * that, it's just ordinary memory, which still packs objects densely.
+ *
+ * Freed objects go on a free list for reuse; regions are never
+ * unmapped. An arena is safe to use from multiple threads.
+ *
+ * The geometry and list modules allocate from arenas instead of malloc
+ * when built with `-DHUGE_ARENAS` (see the `*_arena` targets).
+ */
+
+struct arena
+{
+    const char*  kind;       // for error messages, e.g. "posn"
+    size_t       size;       // of each object, a multiple of 8
+    int          lock;       // a spin lock, held to allocate or free
+    void*        free_list;  // each free object points to the next
+    char*        next;       // the unused part of the newest region
+    char*        end;
+
+    // How the regions so far were backed.
+    size_t       hugetlb_regions, thp_regions, plain_regions;
+
+    // The next arena (for `arena_report`), once this one has a region.
+    struct arena* next_arena;
+};
+
+// Static initializer for an arena of objects of `SIZE` bytes.
+#define ARENA_INIT(KIND, SIZE) \
+    { .kind = (KIND), \
+      .size = ((SIZE) < sizeof(void*) ? sizeof(void*) : ((SIZE) + 7) / 8 * 8) }
+
+
+// Returns a new object, aligned to 8 bytes, or NULL on allocation
+// error.
+void* arena_alloc(struct arena*);
+
+// Returns an object from `arena_alloc` to the arena. Allows NULL.
+void arena_free(struct arena*, void* obj);
+
+// Prints to stderr how the regions of every arena that has allocated
+// anything were backed, one line per arena, e.g.
+//
+//     posn arena: 2 regions (0 hugetlb, 2 thp, 0 plain)
+void arena_report(void);
@@ -0,0 +1,480 @@
+#include "async_writer.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#  include <linux/io_uring.h>
+#  define HAVE_IO_URING 1
+#else
+#  define HAVE_IO_URING 0
+#endif
+
+// The io_uring state we need for one write at a time: the two rings
+// mapped from the kernel and pointers to the fields we touch.
+struct ring
+{
+    int        fd;
+    void*      sq_map;
+    size_t     sq_map_len;
+    void*      cq_map;              // may equal `sq_map`
+    size_t     cq_map_len;
+    void*      sqe_map;
+    size_t     sqe_map_len;
+    unsigned*  sq_tail;
+    unsigned*  sq_mask;
+    unsigned*  sq_array;
+    unsigned*  cq_head;
+    unsigned*  cq_tail;
+    unsigned*  cq_mask;
+#if HAVE_IO_URING
+    struct io_uring_sqe*  sqes;
+    struct io_uring_cqe*  cqes;
+#endif
+};
+
+struct async_writer
+{
+    int          fd;
+    size_t       bufsize;
+    char*        bufs[2];
+    int          cur;        // buffer being filled
+    size_t       len;        // bytes in it so far
+    bool         failed;
+    int          error;      // errno value for the failure
+    bool         uring;      // else thread
+
+    // The write in flight, if any: the rest of the other buffer.
+    const char*  out;
+    size_t       out_len;
+
+    struct ring  ring;
+
+    pthread_t        thread;
+    pthread_mutex_t  lock;
+    pthread_cond_t   cond;
+    bool             stopping;
+    bool             thread_failed;
+};
+
+
+//
+// io_uring backend
+//
+
+#if HAVE_IO_URING
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                       unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags, NULL, 0);
+}
+
+static void* ring_offset(void* base, uint32_t off)
+{
+    return (char*) base + off;
+}
+
+static void ring_unmap(struct ring* r)
+{
+    if (r->sqe_map) munmap(r->sqe_map, r->sqe_map_len);
+    if (r->cq_map && r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map) munmap(r->sq_map, r->sq_map_len);
+    if (r->fd >= 0) close(r->fd);
+}
+
+// Sets up a two-entry ring. Returns false if the kernel doesn't
+// support io_uring (or is missing a feature we need), or if it's
+// forbidden to us.
+static bool ring_init(struct ring* r)
+{
+    memset(r, 0, sizeof *r);
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+
+    r->fd = (int) syscall(__NR_io_uring_setup, 2, &p);
+    if (r->fd < 0) return false;
+
+    // Writing at offset -1 means "at the file position", which we need
+    // for pipes and for appending after whatever stdio wrote first.
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) goto fail;
+
+    r->sq_map_len  = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len  = p.cq_off.cqes
+                   + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqe_map_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        if (r->cq_map_len > r->sq_map_len) r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = r->sq_map_len;
+    }
+
+    r->sq_map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_map == MAP_FAILED) {
+        r->sq_map = NULL;
+        goto fail;
+    }
+
+    if (single) {
+        r->cq_map = r->sq_map;
+    } else {
+        r->cq_map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, r->fd,
+                         IORING_OFF_CQ_RING);
+        if (r->cq_map == MAP_FAILED) {
+            r->cq_map = NULL;
+            goto fail;
+        }
+    }
+
+    r->sqe_map = mmap(NULL, r->sqe_map_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqe_map == MAP_FAILED) {
+        r->sqe_map = NULL;
+        goto fail;
+    }
+
+    r->sq_tail  = ring_offset(r->sq_map, p.sq_off.tail);
+    r->sq_mask  = ring_offset(r->sq_map, p.sq_off.ring_mask);
+    r->sq_array = ring_offset(r->sq_map, p.sq_off.array);
+    r->cq_head  = ring_offset(r->cq_map, p.cq_off.head);
+    r->cq_tail  = ring_offset(r->cq_map, p.cq_off.tail);
+    r->cq_mask  = ring_offset(r->cq_map, p.cq_off.ring_mask);
+    r->sqes     = r->sqe_map;
+    r->cqes     = ring_offset(r->cq_map, p.cq_off.cqes);
+    return true;
+
+fail:
+    ring_unmap(r);
+    return false;
+}
+
+// Queues a write of `len` bytes from `buf` to `fd` at the current file
+// position and tells the kernel about it. Returns false on error.
+static bool ring_submit_write(struct ring* r, int fd,
+                              const char* buf, size_t len)
+{
+    // We're the only producer, so our own tail needs no ordering.
+    unsigned tail  = *r->sq_tail;
+    unsigned index = tail & *r->sq_mask;
+
+    struct io_uring_sqe* sqe = &r->sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd     = fd;
+    sqe->addr   = (uint64_t) (uintptr_t) buf;
+    sqe->len    = len > UINT32_MAX ? UINT32_MAX : (uint32_t) len;
+    sqe->off    = (uint64_t) -1;
+
+    r->sq_array[index] = index;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    for (;;) {
+        int rc = uring_enter(r->fd, 1, 0, 0);
+        if (rc == 1) return true;
+        if (rc < 0 && errno != EINTR) return false;
+    }
+}
+
+// Waits for the next completion and returns its result: the number of
+// bytes written, or a negated errno value.
+static int ring_wait(struct ring* r)
+{
+    for (;;) {
+        unsigned head = *r->cq_head;
+        unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+        if (head != tail) {
+            int res = r->cqes[head & *r->cq_mask].res;
+            __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+            return res;
+        }
+
+        if (uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0
+                && errno != EINTR)
+            return -errno;
+    }
+}
+
+#else
+
+static bool ring_init(struct ring* r)
+{
+    (void) r;
+    return false;
+}
+
+static void ring_unmap(struct ring* r)
+{
+    (void) r;
+}
+
+static bool ring_submit_write(struct ring* r, int fd,
+                              const char* buf, size_t len)
+{
+    (void) r, (void) fd, (void) buf, (void) len;
+    return false;
+}
+
+static int ring_wait(struct ring* r)
+{
+    (void) r;
+    return -ENOSYS;
+}
+
+#endif
+
+// Waits until the write in flight is completely done, resubmitting the
+// rest after short writes.
+static void uring_finish(async_writer_t w)
+{
+    while (w->out_len) {
+        int res = ring_wait(&w->ring);
+
+        if (res == -EINTR || res == -EAGAIN) {
+            res = 0;
+        } else if (res < 0 || (res == 0 && w->out_len)) {
+            w->failed  = true;
+            w->error   = res < 0 ? -res : EIO;
+            w->out_len = 0;
+            return;
+        }
+
+        w->out     += res;
+        w->out_len -= (size_t) res;
+
+        if (w->out_len
+                && !ring_submit_write(&w->ring, w->fd, w->out, w->out_len)) {
+            w->failed  = true;
+            w->error   = errno;
+            w->out_len = 0;
+        }
+    }
+}
+
+
+//
+// Thread backend
+//
+
+// Writes all of `buf`, retrying after short writes and signals.
+static bool write_all(int fd, const char* buf, size_t len)
+{
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        len -= (size_t) n;
+    }
+
+    return true;
+}
+
+static void* writer_thread(void* arg)
+{
+    async_writer_t w = arg;
+
+    pthread_mutex_lock(&w->lock);
+
+    for (;;) {
+        while (!w->out_len && !w->stopping)
+            pthread_cond_wait(&w->cond, &w->lock);
+
+        if (!w->out_len) break;
+
+        const char* out = w->out;
+        size_t len      = w->out_len;
+
+        pthread_mutex_unlock(&w->lock);
+        bool ok = write_all(w->fd, out, len);
+        pthread_mutex_lock(&w->lock);
+
+        if (!ok) {
+            w->thread_failed = true;
+            w->error         = errno;
+        }
+        w->out_len = 0;
+        pthread_cond_broadcast(&w->cond);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+static void thread_finish(async_writer_t w)
+{
+    pthread_mutex_lock(&w->lock);
+    while (w->out_len) pthread_cond_wait(&w->cond, &w->lock);
+    if (w->thread_failed) w->failed = true;
+    pthread_mutex_unlock(&w->lock);
+}
+
+
+//
+// Common
+//
+
+// Waits for the write in flight, if any.
+static void finish_write(async_writer_t w)
+{
+    if (w->uring) uring_finish(w);
+    else thread_finish(w);
+}
+
+// Starts writing out the current buffer and switches to the other one.
+static void flush_current(async_writer_t w)
+{
+    finish_write(w);
+
+    if (w->failed || !w->len) {
+        w->len = 0;
+        return;
+    }
+
+    const char* buf = w->bufs[w->cur];
+    size_t len      = w->len;
+
+    w->cur ^= 1;
+    w->len  = 0;
+
+    if (w->uring) {
+        w->out     = buf;
+        w->out_len = len;
+        if (!ring_submit_write(&w->ring, w->fd, buf, len)) {
+            w->failed  = true;
+            w->error   = errno;
+            w->out_len = 0;
+        }
+    } else {
+        pthread_mutex_lock(&w->lock);
+        w->out     = buf;
+        w->out_len = len;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+async_writer_t aw_create(int fd, size_t bufsize, enum aw_mode mode)
+{
+    if (!bufsize) return NULL;
+
+    async_writer_t w = calloc(1, sizeof *w);
+    if (!w) return NULL;
+
+    w->fd      = fd;
+    w->bufsize = bufsize;
+    w->bufs[0] = malloc(bufsize);
+    w->bufs[1] = malloc(bufsize);
+    if (!w->bufs[0] || !w->bufs[1]) goto fail;
+
+    if (mode != AW_THREAD && ring_init(&w->ring)) {
+        w->uring = true;
+        return w;
+    }
+
+    if (mode == AW_URING) goto fail;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    if (pthread_create(&w->thread, NULL, writer_thread, w)) {
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        goto fail;
+    }
+
+    return w;
+
+fail:
+    free(w->bufs[0]);
+    free(w->bufs[1]);
+    free(w);
+    return NULL;
+}
+
+char* aw_reserve(async_writer_t w, size_t len)
+{
+    if (w->len + len > w->bufsize) flush_current(w);
+    if (w->failed) {
+        errno = w->error;
+        return NULL;
+    }
+    if (len > w->bufsize) return NULL;
+    return w->bufs[w->cur] + w->len;
+}
+
+void aw_commit(async_writer_t w, size_t len)
+{
+    w->len += len;
+}
+
+bool aw_write(async_writer_t w, const void* data, size_t len)
+{
+    const char* src = data;
+
+    while (len) {
+        size_t room = w->bufsize - w->len;
+        if (!room) {
+            flush_current(w);
+            if (w->failed) break;
+            room = w->bufsize;
+        }
+
+        size_t n = len < room ? len : room;
+        memcpy(w->bufs[w->cur] + w->len, src, n);
+        w->len += n;
+        src    += n;
+        len    -= n;
+    }
+
+    if (w->failed) errno = w->error;
+    return !w->failed;
+}
+
+bool aw_close(async_writer_t w)
+{
+    if (!w) return true;
+
+    flush_current(w);
+    finish_write(w);
+
+    if (w->uring) {
+        ring_unmap(&w->ring);
+    } else {
+        pthread_mutex_lock(&w->lock);
+        w->stopping = true;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+
+        pthread_join(w->thread, NULL);
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+    }
+
+    bool ok   = !w->failed;
+    int error = w->error;
+    free(w->bufs[0]);
+    free(w->bufs[1]);
+    free(w);
+
+    if (!ok) errno = error;
+    return ok;
+}
+
+const char* aw_mechanism(c_async_writer_t w)
+{
+    return w->uring ? "io_uring" : "thread";
+}
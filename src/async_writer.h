@@ -0,0 +1,56 @@
+// Double-buffered asynchronous output to a file descriptor.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * An async writer collects output in one of two fixed-size buffers.
+ * When that buffer fills, it's handed off to be written while the
+ * caller goes on filling the other one, so producing output overlaps
+ * with the disk (or pipe) absorbing it. At most one write is in flight
+ * at a time, so the bytes arrive in exactly the order they were given.
+ *
+ * Writes are submitted through io_uring where the kernel supports it,
+ * and otherwise by a dedicated writer thread calling write(2).
+ */
+
+typedef        struct async_writer*    async_writer_t;
+typedef  const struct async_writer*  c_async_writer_t;
+
+// How to perform the writes.
+enum aw_mode
+{
+    AW_AUTO,       // io_uring if available, else a thread
+    AW_URING,      // io_uring or nothing
+    AW_THREAD,     // a writer thread
+};
+
+
+// Returns a new writer to `fd` (which it borrows) with two buffers of
+// `bufsize` bytes each. Returns NULL on allocation error, if `bufsize`
+// is 0, or if `mode` is unavailable.
+async_writer_t aw_create(int fd, size_t bufsize, enum aw_mode mode);
+
+// Returns space for at least `len` (<= bufsize) bytes of output at the
+// end of the current buffer, which the caller may fill and then
+// `aw_commit()`. Returns NULL if an earlier write failed (setting
+// `errno`).
+char* aw_reserve(async_writer_t, size_t len);
+
+// Appends the first `len` bytes of the space returned by the last
+// `aw_reserve()` to the output.
+void aw_commit(async_writer_t, size_t len);
+
+// Appends `len` bytes from `data` to the output. Returns false if a
+// write has failed.
+bool aw_write(async_writer_t, const void* data, size_t len);
+
+// Writes out everything buffered and waits for it to finish, then
+// deallocates the writer (but doesn't close its descriptor). Returns
+// false (setting `errno`) if any write failed. Allows NULL.
+bool aw_close(async_writer_t);
+
+// The name of the mechanism in use, "io_uring" or "thread".
+const char* aw_mechanism(c_async_writer_t);
@@ -10,30 +10,76 @@ struct borrow_tri
     posn_t vertices[N];
 };
 
+#ifdef HUGE_ARENAS
+// Allocate from huge pages (see arena.h).
+#   include "arena.h"
+
+static struct arena borrow_tri_arena =
+    ARENA_INIT("borrow_tri", sizeof(struct borrow_tri));
+
+#   define alloc_tri()    arena_alloc(&borrow_tri_arena)
+#   define free_tri(p)    arena_free(&borrow_tri_arena, (p))
+#else
+#   define alloc_tri()    malloc(sizeof(struct borrow_tri))
+#   define free_tri(p)    free(p)
+#endif // HUGE_ARENAS
+
+#ifdef CHECKED_HANDLES
+// In a checked build, clients' `borrow_tri_t`s are handles (see
+// handle_table.h), which `deref` and `cderef` turn into real pointers.
+#   include "handle_table.h"
+
+static struct handle_table borrow_tri_table =
+    HANDLE_TABLE_INIT("borrow_tri");
+
+static struct borrow_tri* deref(borrow_tri_t t, const char* op)
+{
+    return ht_resolve(&borrow_tri_table, (uintptr_t) t, op);
+}
+
+static const struct borrow_tri* cderef(c_borrow_tri_t t, const char* op)
+{
+    return ht_resolve(&borrow_tri_table, (uintptr_t) t, op);
+}
+#else
+#   define deref(t, op)   (t)
+#   define cderef(t, op)  (t)
+#endif // CHECKED_HANDLES
+
 // Returns a new borrowing triangle whose posns are NULL.
 // Returns NULL on allocation error.
 borrow_tri_t bt_create(void)
 {
-    borrow_tri_t result = malloc(sizeof(struct borrow_tri));
+    borrow_tri_t result = alloc_tri();
     if (!result) return NULL;
 
     for (int i = 0; i < N; ++i) {
         result->vertices[i] = NULL;
     }
 
+#ifdef CHECKED_HANDLES
+    uintptr_t h = ht_insert(&borrow_tri_table, result);
+    if (!h) free_tri(result);
+    result = (borrow_tri_t) h;
+#endif
+
     return result;
 }
 
 // Deallocates a borrowing triangle. Allows NULL.
 void bt_destroy(borrow_tri_t t)
 {
-    free(t);
+#ifdef CHECKED_HANDLES
+    t = ht_remove(&borrow_tri_table, (uintptr_t) t, "bt_destroy");
+#endif
+
+    free_tri(t);
 }
 
 // Borrows the vertex `v` (0-2), mutably.
 posn_t bt_get_borrowed(borrow_tri_t t, int v)
 {
-    return t->vertices[v];
+    return deref(t, "bt_get_borrowed")->vertices[v];
 }
 
 /*
@@ -55,7 +101,8 @@ posn_t bt_take_owned(borrow_tri_t t, int v);
 //  - If vertex `v` of `t` is NULL, returns a clone of `ORIGIN`.
 posn_t bt_clone_owned(borrow_tri_t t, int v)
 {
-    return posn_clone(t->vertices[v] ? t->vertices[v] : ORIGIN);
+    posn_t p = deref(t, "bt_clone_owned")->vertices[v];
+    return posn_clone(p ? p : ORIGIN);
 }
 
 /*
@@ -82,19 +129,19 @@ void bt_put_owned(borrow_tri_t t, int v, posn_t p);
 // of `t` is NULL.
 void bt_set_borrowed(borrow_tri_t t, int v, const_posn_t src)
 {
-    posn_assign(t->vertices[v], src);
+    posn_assign(deref(t, "bt_set_borrowed")->vertices[v], src);
 }
 
 // Sets vertex `v` of triangle `t` to be `p`. NULL okay for `posn_t`s
 // but not for `t`.
 void bt_put_borrowed(borrow_tri_t t, int v, posn_t p)
 {
-    t->vertices[v] = p;
+    deref(t, "bt_put_borrowed")->vertices[v] = p;
 }
 
 // Borrows the vertex `v` (0-2) from a const triangle. Result may be
 // NULL, but `t` may not be.
 const_posn_t bt_const_get_borrowed(c_borrow_tri_t t, int v)
 {
-    return t->vertices[v];
+    return cderef(t, "bt_const_get_borrowed")->vertices[v];
 }
@@ -1,24 +1,74 @@
 #include "cons.h"
+#include "trace.h"
 #include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 
+// How many cells ahead `for_each_prefetch` fetches.
+#define PREFETCH_DISTANCE  8
+
+// Elements `foldr` keeps on the native stack, and then in each chunk it
+// allocates (one chunk is 256 KiB).
+#define FOLD_LOCAL_ITEMS   256
+#define FOLD_CHUNK_ITEMS   ((size_t) 1 << 16)
+
+// Most cells in one block made by `list_compact`, so a cell's slot
+// number fits in its `slot` field.
+#define MAX_BLOCK_CELLS    ((size_t) 1 << 30)
+
 // This definition is visible only from within this file.
 // test/test_cons.c cannot see it, but it can see in "cons.h" that this
 // definition exists, and that `list_t` is a synonym for a pointer to
 // this.
 struct cons_pair
 {
-    int    car;
-    list_t cdr;
+    int      car;
+    // 0 for a cell allocated by itself, or 1 + the cell's index in the
+    // block it's part of. (This fits in the padding that would follow
+    // `car` anyway, so cells are no bigger for it.)
+    uint32_t slot;
+    list_t   cdr;
+};
+
+// Cells relocated by `list_compact`, which are freed together once
+// the last of them is freed.
+struct cons_block
+{
+    size_t            live;
+    struct cons_pair  cells[];
+};
+
+// Part of the stack of elements that `foldr` has yet to apply `f` to.
+// Each chunk is full except the newest.
+struct fold_chunk
+{
+    struct fold_chunk*  prev;
+    int                 items[FOLD_CHUNK_ITEMS];
 };
 
+#ifdef HUGE_ARENAS
+// Allocate from huge pages (see arena.h).
+#   include "arena.h"
+
+static struct arena cons_arena = ARENA_INIT("cons", sizeof(struct cons_pair));
+
+#   define alloc_pair()    arena_alloc(&cons_arena)
+#   define free_pair(p)    arena_free(&cons_arena, (p))
+#else
+#   define alloc_pair()    malloc(sizeof(struct cons_pair))
+#   define free_pair(p)    free(p)
+#endif // HUGE_ARENAS
+
 // Defines the empty list as the null pointer.
 list_t const empty = NULL;
 
-list_t cons(int first, list_t rest)
+// `cons` without tracing, for building lists a cell at a time inside
+// operations that are traced as a whole.
+static list_t make_cell(int first, list_t rest)
 {
-    list_t result = malloc(sizeof *result);
+    list_t result = alloc_pair();
     if (result == NULL) {
         // If malloc fails, we'll print an error message and exit.
         perror("cons");
@@ -26,11 +76,33 @@ list_t cons(int first, list_t rest)
     }
 
     // Initialize and return
-    result->car = first;
-    result->cdr = rest;
+    result->car  = first;
+    result->slot = 0;
+    result->cdr  = rest;
+    return result;
+}
+
+list_t cons(int first, list_t rest)
+{
+    TRACE_BEGIN("cons");
+    list_t result = make_cell(first, rest);
+    TRACE_END("cons");
     return result;
 }
 
+// Frees one cell, which may be part of a block.
+static void free_cell(list_t lst)
+{
+    if (!lst->slot) {
+        free_pair(lst);
+        return;
+    }
+
+    struct cons_block* block = (struct cons_block*)
+        ((char*) (lst - (lst->slot - 1)) - offsetof(struct cons_block, cells));
+    if (!--block->live) free(block);
+}
+
 bool is_empty(list_t lst)
 {
     return lst == NULL;
@@ -59,7 +131,7 @@ list_t uncons_one(list_t lst)
     if (!lst) return lst;
 
     list_t next = lst->cdr;
-    free(lst);
+    free_cell(lst);
     return next;
 
     // Why not this?:
@@ -77,29 +149,142 @@ void uncons_all_bsl_style(list_t lst)
 {
     if (lst) {
         uncons_all_bsl_style(lst->cdr);
-        free(lst);
+        free_cell(lst);
     }
 }
 
 list_t map(int (*f)(int), list_t lst)
 {
+    TRACE_BEGIN("map");
+
     list_t result = empty;
     list_t* next = &result;
 
     while (lst) {
-        *next = cons(f(lst->car), empty);
+        *next = make_cell(f(lst->car), empty);
         next = &(*next)->cdr;
         lst = lst->cdr;
     }
 
+    TRACE_END("map");
     return result;
 }
 
+void* foldr(void* (*f)(int, void* acc), void* init, list_t lst)
+{
+    TRACE_BEGIN("foldr");
+
+    // Push the elements: the first few on the native stack, which is
+    // all that short lists need, and the rest in heap chunks. Copying
+    // the elements, not the cells, keeps the stack small and means the
+    // second pass reads memory sequentially instead of chasing `cdr`s.
+    int local[FOLD_LOCAL_ITEMS];
+    size_t n_local = 0;
+
+    while (lst && n_local < FOLD_LOCAL_ITEMS) {
+        local[n_local++] = lst->car;
+        lst = lst->cdr;
+    }
+
+    struct fold_chunk* top = NULL;
+    size_t n_top = FOLD_CHUNK_ITEMS;
+
+    while (lst) {
+        if (n_top == FOLD_CHUNK_ITEMS) {
+            struct fold_chunk* chunk = malloc(sizeof *chunk);
+            if (chunk == NULL) {
+                perror("foldr");
+                exit(1);
+            }
+            chunk->prev = top;
+            top = chunk;
+            n_top = 0;
+        }
+
+        top->items[n_top++] = lst->car;
+        lst = lst->cdr;
+    }
+
+    // Pop them, folding from the right.
+    void* acc = init;
+
+    while (top) {
+        while (n_top) acc = f(top->items[--n_top], acc);
+
+        struct fold_chunk* prev = top->prev;
+        free(top);
+        top = prev;
+        n_top = FOLD_CHUNK_ITEMS;
+    }
+
+    while (n_local) acc = f(local[--n_local], acc);
+
+    TRACE_END("foldr");
+    return acc;
+}
+
 void for_each(void (*f)(int*), list_t lst)
 {
+    TRACE_BEGIN("for_each");
+
+    while (lst) {
+        f(&lst->car);
+        lst = lst->cdr;
+    }
+
+    TRACE_END("for_each");
+}
+
+
+void for_each_prefetch(void (*f)(int*), list_t lst)
+{
+    // A second pointer runs ahead, so that each cell has been on its
+    // way into the cache for a while by the time `f` gets to it. But
+    // the runner can't advance until its own cell arrives, so this only
+    // overlaps the misses with `f`'s work; it doesn't remove them.
+    list_t ahead = lst;
+    for (int i = 0; i < PREFETCH_DISTANCE && ahead; ++i) ahead = ahead->cdr;
+
     while (lst) {
+        if (ahead) {
+            __builtin_prefetch(ahead->cdr);
+            ahead = ahead->cdr;
+        }
+
         f(&lst->car);
         lst = lst->cdr;
     }
 }
 
+list_t list_compact(list_t lst)
+{
+    list_t result = empty;
+    list_t* next = &result;
+
+    while (lst) {
+        size_t n = 0;
+        for (list_t p = lst; p && n < MAX_BLOCK_CELLS; p = p->cdr) ++n;
+
+        struct cons_block* block =
+            malloc(sizeof *block + n * sizeof(struct cons_pair));
+        if (block == NULL) {
+            perror("list_compact");
+            exit(1);
+        }
+
+        block->live = n;
+
+        for (size_t i = 0; i < n; ++i) {
+            list_t cell = &block->cells[i];
+            cell->car  = lst->car;
+            cell->slot = (uint32_t) (i + 1);
+            cell->cdr  = empty;
+
+            *next = cell;
+            next = &cell->cdr;
+            lst = uncons_one(lst);
+        }
+    }
+
+    return result;
+}
@@ -81,7 +81,38 @@ void uncons_all_bsl_style(list_t lst);
 // ownership of the result.
 list_t map(int (*f)(int), list_t lst);
 
+// Folds `f` over the elements of `lst` from the right: returns
+//
+//     f(x0, f(x1, ... f(xn-1, init) ...))
+//
+// like a recursive traversal would, but uses only a few stack frames
+// regardless of length, keeping the pending elements on the heap
+// instead. The accumulator is a pointer so that it can be a `list_t`
+// (to build a new list, front to back) or point to the caller's own
+// state. Borrows `lst`.
+//
+// ERRORS: exits if memory cannot be allocated.
+void* foldr(void* (*f)(int, void* acc), void* init, list_t lst);
+
 // Applies function `f` to the pointer to each element of the list.
 // This is like `map`, but lets you modify the list in-place.
 void for_each(void (*f)(int*), list_t lst);
 
+
+// Like `for_each`, but prefetches cells a few ahead of the one being
+// visited. It finds those cells by following `cdr`s, though, so it
+// waits on the same chain of cache misses that `for_each` does, and
+// for a plain traversal of a scattered list it is no faster (see
+// bench_cons). It can help only when `f` itself does enough work to
+// hide those misses. To make a scattered list fast to walk, use
+// `list_compact` instead.
+void for_each_prefetch(void (*f)(int*), list_t lst);
+
+// Relocates the cells of `lst` into one contiguous block, in order, so
+// that walking the result touches memory sequentially. Takes ownership
+// of `lst` and returns ownership of the result, which has the same
+// elements and is freed the same ways (the block is freed once all its
+// cells have been).
+//
+// ERRORS: exits if memory cannot be allocated.
+list_t list_compact(list_t lst);
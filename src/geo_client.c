@@ -11,36 +11,147 @@
 //
 //     "tri: ( %lf , %lf ) ( %lf , %lf ) ( %lf , %lf )"
 //
-// (Spaces are optional.)
+// (Spaces are optional.) See geo_io.h.
 //
 // Can use either owning triangles (owning_tri.h) or borrowing triangles
-// (borrow_tri.h), as determined by a preprocessor #define. The owning-
-// triangle version is built by default; `make geo_client_bt` will
-// build the borrowing-triangle version as `geo_client_bt`.
-
-#ifdef BORROWING_TRI
-#   include "borrow_tri.h"
-#   define  tri_t                   borrow_tri_t
-#   define  c_tri_t                 c_borrow_tri_t
-#   define  tri_create              bt_create
-#   define  tri_destroy             bt_destroy
-#   define  tri_get_borrowed        bt_get_borrowed
-#   define  tri_const_get_borrowed  bt_const_get_borrowed
-#else // BORROWING_TRI
-#   include "owning_tri.h"
-#   define  tri_t                   owning_tri_t
-#   define  c_tri_t                 c_owning_tri_t
-#   define  tri_create              ot_create
-#   define  tri_destroy             ot_destroy
-#   define  tri_get_borrowed        ot_get_borrowed
-#   define  tri_const_get_borrowed  ot_const_get_borrowed
-#endif // BORROWING_TRI
+// (borrow_tri.h), as chosen at run time by an option:
+//
+//   --backend=owning      use owning triangles
+//   --backend=borrowing   use borrowing triangles
+//   --time                report time spent reading, transforming and
+//                         writing to stderr, to compare the backends
+//
+// Triangles can also be stored in a compact binary form (quant_tri.h),
+// with every coordinate within a given error bound of the original:
+//
+//   --quantize=ERR        write the quantized binary form instead of text
+//   --dequantize          read the quantized binary form instead of text
+//
+// Triangles are processed in batches (tri_batch.h), which can be
+// transformed on the way through (affine.h):
+//
+//   --transform=SPEC      apply an affine transformation, where SPEC is
+//                         translate:DX,DY, rotate:DEG, scale:S,
+//                         scale:SX,SY or project:DEG; repeat to compose
+//                         (in the order given)
+//   --threads=N           use up to N threads for batch stages
+//   --trace=FILE          record when each batch is read, transformed,
+//                         analyzed, sorted and written, on each thread,
+//                         and save the timeline to FILE in Chrome's
+//                         trace format (trace.h), e.g. for Perfetto
+//
+// The output can be sorted by the Z-order of the triangles' centroids
+// (tri_sort.h), even if it doesn't fit in memory:
+//
+//   --sort                sort the output spatially
+//   --sort-mem=MB         keep at most about MB megabytes of triangles
+//                         in memory while sorting (default 256)
+//
+// Text output can be written asynchronously (async_writer.h), so that
+// formatting the next triangles overlaps with writing the last ones:
+//
+//   --async-write         via io_uring if possible, else a writer thread
+//   --async-write=uring   via io_uring only
+//   --async-write=thread  via a writer thread only
+//
+// Many input files (shards) can be copied in one run, several at a
+// time, with their output either merged in the order given or kept
+// separate:
+//
+//   --shards              treat every file argument as an input shard
+//   --manifest=FILE       also take input shards from FILE, one name
+//                         per line (blank lines and # comments ignored)
+//   --shard-dir=DIR       write each shard's output to DIR/NAME, where
+//                         NAME is the shard's base name (so these must
+//                         all differ), instead of merging it all into
+//                         stdout
+//
+// Shards are divided among up to --threads workers. Options such as
+// --sort and --quantize apply to each shard separately, so --quantize
+// needs --shard-dir.
+//
+// The triangles can also be analyzed on the way through; the results
+// go to stderr or to a separate file, in input order:
+//
+//   --topology            report the mesh topology (mesh_topo.h): welded
+//                         vertices, edges, boundary edges, components
+//   --topology-out=FILE   implies --topology; also write one line per
+//                         triangle to FILE: the numbers of the triangles
+//                         across its three edges (-1 for none) and of
+//                         its component
+//   --overlaps            report the number of pairs of triangles whose
+//                         interiors overlap (tri_overlap.h)
+//   --overlaps-out=FILE   implies --overlaps; also write the pairs to
+//                         FILE, one "A B" line each (A < B)
+//   --raster=WxH          render the triangles into a grid of W by H
+//                         cells (tri_raster.h) and report how many are
+//                         covered; each cell counts the triangles that
+//                         contain its center
+//   --raster-area         instead sum the fraction of each cell's area
+//                         that the triangles cover
+//   --raster-window=X0,Y0,X1,Y1
+//                         the region the grid covers (default: the
+//                         bounding box of the triangles)
+//   --raster-out=FILE     also write the grid to FILE: as a PGM image
+//                         if FILE ends in .pgm (counts scaled to the
+//                         greatest, or coverage with 1 as white), else
+//                         as a line "georaster MODE W H X0 Y0 X1 Y1"
+//                         followed by the cells as native 32-bit
+//                         unsigned counts or floats, bottom row first
+//   --hull                report the size of the convex hull of all the
+//                         vertices (tri_hull.h), in bounded memory
+//   --hull-out=FILE       implies --hull; also write the hull's
+//                         vertices to FILE, one "(X,Y)" line each,
+//                         counterclockwise
+//
+// Instead of copying files, geo_client can run as a server, to save
+// clients the cost of starting a process per stream:
+//
+//   --serve=SOCKET        listen on Unix-domain socket SOCKET; each
+//                         connection sends a triangle stream and shuts
+//                         down its sending side, and gets back the
+//                         output followed by a status line (geo_io.h)
+//
+// Up to --threads connections are served at once, each by a worker that
+// keeps its triangle, batch and stdio buffers from one request to the
+// next. The other options apply to every request, except that the
+// quantized formats and shards aren't supported. geo_request is a
+// client for it.
+//
+// Options come before the file arguments. The owning-triangle version
+// is the default; `make geo_client_bt` builds a version, `geo_client_bt`,
+// that defaults to borrowing triangles instead (via #define
+// BORROWING_TRI).
 
+#include "affine.h"
+#include "async_writer.h"
+#include "borrow_tri.h"
+#include "geo_io.h"
+#include "mesh_topo.h"
+#include "owning_tri.h"
+#include "tri_hull.h"
+#include "tri_overlap.h"
+#include "tri_raster.h"
+#include "parallel.h"
+#include "quant_tri.h"
+#include "tri_batch.h"
+#include "tri_sort.h"
+#include "trace.h"
 
+#include <errno.h>
+#include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
 
 //
@@ -53,51 +164,385 @@
 #define ALLOC_ERROR    4
 #define FORMAT_ERROR   5
 #define WRITE_ERROR    6
+#define BAD_OPTION     7
+#define QUANT_ERROR    8
+#define SORT_ERROR     9
+
+
+//
+// Tuning
+//
+
+// Triangles per batch: large enough to amortize per-batch work and
+// feed several threads, small enough to stay cache-friendly.
+#define BATCH_SIZE     65536
+
+// Default memory budget for --sort, in megabytes.
+#define SORT_MEM_MB    256
+
+// Size of each of the async writer's two buffers.
+#define WRITE_BUF_SIZE (1 << 20)
+
+// Buffer for copying a finished shard's output into the merged output.
+#define MERGE_BUF_SIZE (64 * 1024)
+
+// Stdio buffer for each direction of a --serve connection.
+#define CONN_BUF_SIZE  (64 * 1024)
+
+// How many shards, per worker, may be claimed beyond the next one to be
+// merged into the output. Each of those may hold a finished shard's
+// output in a temporary file, so this bounds how many are open.
+#define SHARD_WINDOW   2
+
+// Pending connections allowed on the --serve socket.
+#define LISTEN_BACKLOG 128
+
+// Expands macro `x` into a string literal, for messages.
+#define STR(x)         STR_(x)
+#define STR_(x)        #x
 
 
 //
-// String constants
+// Types
 //
 
-#define READ_POSN_FMT   " ( %lf , %lf ) "
-#define WRITE_POSN_FMT  "(%g,%g)"
-#define TRIANGLE_HDR    "tri:"
+// The two kinds of triangle we can read into.
+enum backend
+{
+    OWNING,
+    BORROWING,
+};
+
+#ifdef BORROWING_TRI
+#   define DEFAULT_BACKEND  BORROWING
+#else
+#   define DEFAULT_BACKEND  OWNING
+#endif
+
+// A triangle using either backend. For the borrowing triangle, we need
+// a place other than the triangle to hold ownership of the posns, so
+// `posn_owner` holds them and `bt` borrows them.
+struct tri
+{
+    enum backend  backend;
+    owning_tri_t  ot;
+    borrow_tri_t  bt;
+    posn_t        posn_owner[3];
+};
+
+// Settings from the command line.
+struct options
+{
+    FILE*          fin;
+    FILE*          fout;
+    enum backend   backend;
+    bool           timing;
+    double         quant_err;   // 0 unless --quantize
+    bool           dequantize;
+    bool           transforming;
+    struct affine  transform;
+    int            threads;
+    bool           sorting;
+    size_t         sort_mem_mb;
+    bool           async_write;
+    enum aw_mode   write_mode;
+    bool           sharded;     // --shards or --manifest
+    char**         shards;      // input names, if sharded
+    size_t         n_shards;
+    size_t         shards_cap;
+    const char*    shard_dir;   // NULL to merge
+    const char*    serve_path;  // NULL unless --serve
+    bool           topology;
+    const char*    topology_out;
+    bool           overlaps;
+    const char*    overlaps_out;
+    size_t         raster_width;   // 0 unless --raster
+    size_t         raster_height;
+    enum tr_mode   raster_mode;
+    bool           raster_windowed;
+    double         raster_window[4];
+    const char*    raster_out;
+    bool           hull;
+    const char*    hull_out;
+    const char*    trace_out;   // NULL unless --trace
+};
+
+// Where the time went, for `--time`.
+struct timing
+{
+    double         read_secs;
+    double         transform_secs;
+    double         analysis_secs;
+    double         sort_secs;
+    double         write_secs;
+};
+
+// The state of a copy from input to output. The triangle to read into,
+// the batch to collect triangles in, and the sorter (if any) that
+// batches go through before output last across copies; the rest
+// belongs to the current copy (`opts`): the quantized stores (if any)
+// holding the current block of the input and output files, and the
+// async writer (if any) that text output goes through; and the analyses
+// (if any) that see every batch. Everything a copy allocates is owned
+// here, so that `pipeline_close` frees it even if a --serve request
+// fails partway and `longjmp`s out.
+struct pipeline
+{
+    const struct options*  opts;
+    struct tri             triangle;
+    tri_batch_t            batch;
+    quant_tris_t           qin;
+    struct qt_cursor       cur;
+    quant_tris_t           qout;
+    size_t                 qout_bytes;  // written so far
+    tri_sorter_t           sorter;
+    async_writer_t         writer;
+    mesh_topo_t            topo;
+    tri_overlap_t          overlap;
+    tri_raster_t           raster;
+    tri_hull_t             hull;
+    struct timing          timing;
+};
+
+// One input shard in a sharded run. Unless shards are written to
+// their own files or straight to the output, `out` is a temporary file
+// holding the shard's output until it's this shard's turn to be merged.
+struct shard
+{
+    const char*    name;
+    FILE*          out;
+    size_t         count;
+    bool           done;
+};
+
+// The state of a sharded run, shared by the workers. `next` is the next
+// shard to claim; `next_merge` is the next to be copied to the output,
+// by whichever worker finds it done while no one else is `merging`.
+// When merging, shards are claimed no further than `window` past
+// `next_merge`; `merged` is signaled as that advances.
+struct shard_run
+{
+    const struct options*  opts;
+    struct shard*          shards;
+    int                    inner_threads;
+    pthread_mutex_t        lock;
+    pthread_cond_t         merged;
+    size_t                 window;
+    size_t                 next;
+    size_t                 next_merge;
+    bool                   merging;
+    size_t                 count;
+    struct timing          timing;
+};
+
+// A --serve worker's storage, reused from one request to the next.
+struct server_worker
+{
+    const struct options*  opts;
+    int                    listen_fd;
+    struct pipeline        pipeline;
+    char                   in_buf[CONN_BUF_SIZE];
+    char                   out_buf[CONN_BUF_SIZE];
+};
+
+// Where `bail()` and friends go instead of exiting, while a --serve
+// worker is handling a request.
+struct request_error
+{
+    jmp_buf  escape;
+    int      exit_code;
+    char     msg[256];
+};
 
 
 //
 // Forward declarations
 //
 
-// Reads triangles from `fin` and writes them to `fout`; returns
-// the number of triangles copied.
+// Reads triangles from `opts->fin` and writes them to `opts->fout`;
+// returns the number of triangles copied. Accumulates into `*timing`.
 static size_t
-copy_triangles(FILE* fin, FILE* fout);
+copy_triangles(const struct options*, struct timing*);
 
-// Attempts to reads a triangle from a stream. Returns positive for
-// success, or `EOF` for end-of-file. Bails out on badly formatted
-// input.
-//
-// PRECONDITION [for borrowing-triangle version only]:
-//  - The vertices are non-NULL. (UB if violated.)
+// Copies every shard in `opts->shards`, in parallel, and returns the
+// total number of triangles copied. Accumulates into `*timing`.
+static size_t
+copy_shards(const struct options*, struct timing*);
+
+// Claims and copies shards until none are left. (A `parallel_for`
+// body; the range is ignored.)
+static void
+shard_worker(size_t begin, size_t end, void* env);
+
+// Records that shard `i` is done, and merges as many finished shards
+// into the output as the order allows. If `direct`, shard `i` was
+// written straight to the output, by a worker that has been `merging`
+// since it claimed it.
+static void
+finish_shard(struct shard_run* run, size_t i, bool direct);
+
+// Copies all of `src`, from the start, to `dst`. Bails out on error.
+static void
+append_file(FILE* dst, FILE* src);
+
+// Opens the output file for shard `name` under `dir`.
+static FILE*
+open_shard_output(const char* dir, const char* name);
+
+// The part of `path` after the last slash.
+static const char*
+base_name(const char* path);
+
+// Compares the base names of two shards (`char*`s). (A qsort comparator.)
+static int
+compare_base_names(const void* a, const void* b);
+
+// Bails out if two shards have the same base name, so that their
+// outputs under --shard-dir would collide.
+static void
+check_shard_names(const struct options* opts, const char* prog);
+
+// Adds a copy of `name` to the list of input shards.
+static void
+add_shard(struct options* opts, const char* name);
+
+// Adds every shard named in manifest file `path`.
+static void
+read_manifest(struct options* opts, const char* path);
+
+// Sets up the lasting parts of `*p`, bailing out on error; and
+// releases everything it owns.
+static void
+pipeline_init(struct pipeline* p, enum backend);
+static void
+pipeline_fini(struct pipeline* p);
+
+// Sets up `*p` for one copy according to `opts`, bailing out on error;
+// and releases everything belonging to the copy (even if it was cut
+// short), leaving `*p` ready for the next.
+static void
+pipeline_open(struct pipeline* p, const struct options* opts);
+static void
+pipeline_close(struct pipeline* p);
+
+// Copies everything from `opts->fin` to `opts->fout` using `*p`, and
+// returns the number of triangles copied.
+static size_t
+run_pipeline(struct pipeline* p, const struct options* opts);
+
+// Serves requests on `opts->serve_path` until killed. Returns only
+// if the socket can't be set up.
+static void
+serve(const struct options*);
+
+// Accepts and handles connections forever. (A `parallel_for` body; the
+// range is ignored.)
+static void
+serve_worker(size_t begin, size_t end, void* env);
+
+// Handles the request on connection `fd`, replying with the output and
+// a status line, and closes it.
+static void
+serve_request(struct server_worker*, int fd);
+
+// While a request is being served, makes it fail with the given exit
+// code and message instead of exiting; otherwise returns.
+static void
+fail_request(int exit_code, const char* msg, bool with_errno);
+
+// Fills `p->batch` with as many triangles as fit or remain, returning
+// false once the input is exhausted and the batch is empty.
+static bool
+fill_batch(struct pipeline* p);
+
+// Applies the batch stages (the transformation) to `p->batch`.
+static void
+transform_batch(struct pipeline* p);
+
+// Writes out and then empties `p->batch`.
+static void
+emit_batch(struct pipeline* p);
+
+// Writes out and then empties `p->qout`.
+static void
+write_quant_block(struct pipeline* p);
+
+// Feeds `p->batch` to the analyses.
+static void
+analyze_batch(struct pipeline* p);
+
+// Finishes the analyses and reports their results.
+static void
+report_analyses(struct pipeline* p);
+
+// Writes each triangle's neighbors and component to `path`.
+static void
+write_topology(c_mesh_topo_t, const char* path);
+
+// Writes each overlapping pair to `path`.
+static void
+write_overlaps(c_tri_overlap_t, const char* path);
+
+// Writes the grid to `path`, as PGM if it ends in ".pgm".
+static void
+write_raster(c_tri_raster_t, const char* path);
+
+// Writes the hull's vertices to `path`.
+static void
+write_hull(c_tri_hull_t, const char* path);
+
+// Hands `p->batch` to the sorter and then empties it.
+static void
+sort_batch(struct pipeline* p);
+
+// Writes out all the sorted triangles, through `p->batch`.
+static void
+emit_sorted(struct pipeline* p);
+
+// Adds one triangle to `((struct pipeline*) env)->batch`, writing the
+// batch out if it's full. (A `tri_sink_fn`.)
+static void
+emit_sorted_tri(const double xs[3], const double ys[3], void* env);
+
+// Reads the next triangle into `p->triangle` from either the input
+// file or the quantized input store. Returns positive for success or
+// `EOF` at the end of the input.
 static int
-read_tri(tri_t, FILE*);
+next_tri(struct pipeline* p);
 
-// Writes a triangle to a file in the same format as `read_tri()`.
+// Initializes `*t` to a triangle using the given backend, with all
+// three vertices present. Bails out on allocation failure.
 static void
-write_tri(c_tri_t, FILE*);
+tri_init(struct tri* t, enum backend);
 
-// Reads a posn from a stream.
+// Deallocates everything owned by `*t`.
+static void
+tri_fini(struct tri* t);
+
+// Borrows vertex `v` (0-2) of `*t`, mutably or not.
 static posn_t
-read_posn(FILE*);
+tri_vertex(struct tri* t, int v);
+static const_posn_t
+tri_const_vertex(const struct tri* t, int v);
+
+// Attempts to reads a triangle from a stream into the existing
+// vertices of `t`, without allocating. Returns positive for success,
+// or `EOF` for end-of-file. Bails out on badly formatted input.
+static int
+read_tri(struct tri* t, FILE*);
 
-// Writes a posn to a stream in the same format as `read_posn()`.
+// Writes a triangle with vertices (xs[i], ys[i]) to a file in the same
+// format as `read_tri()`.
 static void
-write_posn(const_posn_t, FILE*);
+write_tri(const double xs[3], const double ys[3], FILE*);
 
-// Sets `*inp` and `*outp` to where to read from and write to, based on
-// the command-line arguments.
+// Fills in `*opts` based on the command-line arguments.
 static void
-process_args(FILE** inp, FILE** outp, int argc, char* argv[]);
+process_args(struct options* opts, int argc, char* argv[]);
+
+// Returns the current time in seconds, for `--time`.
+static double
+now(void);
 
 // Prints an error message and exits.
 static void
@@ -107,142 +552,1182 @@ bail(int exit_code, const char* optional_msg);
 static void
 bail_format(void);
 
+// Prints an error message about quantization and exits.
+static void
+bail_quant(const char* msg);
+
+// Prints an error message about command-line option `opt` and exits.
+static void
+bail_option(const char* msg, const char* opt, const char* prog);
+
 
 //
 // Function definitions
 //
 
+// Set while this thread is serving a request.
+static _Thread_local struct request_error* request_error = NULL;
+
+
 int main(int argc, char* argv[])
 {
-    FILE *fin, *fout;
-    process_args(&fin, &fout, argc, argv);
+    struct options opts;
+    process_args(&opts, argc, argv);
 
-    size_t count = copy_triangles(fin, fout);
-    fprintf(stderr, "%zu %s copied\n", count,
+    if (opts.trace_out) trace_enable();
+
+    if (opts.serve_path) {
+        serve(&opts);
+        bail(BAD_OUTFILE, opts.serve_path);
+    }
+
+    struct timing timing = {0, 0, 0, 0, 0};
+
+    size_t count = opts.sharded ? copy_shards(&opts, &timing)
+                                : copy_triangles(&opts, &timing);
+    fprintf(stderr, "%zu %s copied", count,
             count == 1 ? "triangle" : "triangles");
+    if (opts.sharded)
+        fprintf(stderr, " from %zu %s", opts.n_shards,
+                opts.n_shards == 1 ? "shard" : "shards");
+    fprintf(stderr, "\n");
+
+    if (opts.timing) {
+        double total = timing.read_secs + timing.transform_secs +
+                       timing.analysis_secs + timing.sort_secs +
+                       timing.write_secs;
+        fprintf(stderr, "backend %s: read %.6f s, transform %.6f s, "
+                        "analyze %.6f s, sort %.6f s, write %.6f s, "
+                        "%.0f triangles/s\n",
+                opts.backend == OWNING ? "owning" : "borrowing",
+                timing.read_secs, timing.transform_secs,
+                timing.analysis_secs, timing.sort_secs,
+                timing.write_secs, total > 0 ? count / total : 0.0);
+    }
+
+    if (opts.fin != stdin) fclose(opts.fin);
+    if (opts.fout != stdout) fclose(opts.fout);
+
+    if (opts.trace_out && !trace_write(opts.trace_out)) exit(BAD_OUTFILE);
 
-    if (fin != stdin) fclose(fin);
-    if (fout != stdout) fclose(fout);
+    for (size_t i = 0; i < opts.n_shards; ++i) free(opts.shards[i]);
+    free(opts.shards);
 }
 
 
-static size_t copy_triangles(FILE* fin, FILE* fout)
+static size_t
+copy_triangles(const struct options* opts, struct timing* timing)
 {
-    // We're going to create one `tri_t` object to read each input
-    // triangle into:
-    tri_t triangle = tri_create();
-    if (!triangle) bail(ALLOC_ERROR, NULL);
+    struct pipeline p;
+    pipeline_init(&p, opts->backend);
 
-#ifdef BORROWING_TRI
-    // For the borrowing triangle, we need a place other than the
-    // triangle to hold ownership of the posns. We allocate a separate
-    // array and fill it with fresh, owned `posn_t`s here; then we store
-    // a borrowed pointer to each owned `posn_t` as a vertex of the
-    // triangle.
-    posn_t posn_owner[3];
+    size_t count = run_pipeline(&p, opts);
 
-    for (int i = 0; i < 3; ++i) {
-        posn_owner[i] = posn_clone(ORIGIN);
-        if (!posn_owner[i]) bail(ALLOC_ERROR, NULL);
+    *timing = p.timing;
+    pipeline_fini(&p);
 
-        bt_put_borrowed(triangle, i, posn_owner[i]);
-    }
-#endif // BORROWING_TRI
+    return count;
+}
+
+
+static size_t run_pipeline(struct pipeline* p, const struct options* opts)
+{
+    pipeline_open(p, opts);
 
     size_t count = 0;
 
     // The main event!
-    while (read_tri(triangle, fin) > 0) {
-        write_tri(triangle, fout);
-        ++count;
+    while (fill_batch(p)) {
+        count += tb_count(p->batch);
+        transform_batch(p);
+        analyze_batch(p);
+
+        if (opts->sorting) sort_batch(p);
+        else emit_batch(p);
     }
 
-    tri_destroy(triangle);
+    if (opts->sorting) emit_sorted(p);
+    report_analyses(p);
 
-#ifdef BORROWING_TRI
-    // For the borrowing-triangle version, we need to destroy our owned
-    // posns (which it borrowed) when we're finished.
-    for (int i = 0; i < 3; ++i) {
-        posn_destroy(posn_owner[i]);
+    if (p->writer) {
+        double start = now();
+        if (opts->timing)
+            fprintf(stderr, "wrote asynchronously via %s\n",
+                    aw_mechanism(p->writer));
+        bool ok = aw_close(p->writer);
+        p->writer = NULL;
+        if (!ok) bail(WRITE_ERROR, NULL);
+        p->timing.write_secs += now() - start;
     }
-#endif // BORROWING_TRI
 
+    if (p->qout) {
+        double start = now();
+        if (qt_count(p->qout)) write_quant_block(p);
+        p->timing.write_secs += now() - start;
+
+        fprintf(stderr, "quantized to %zu bytes (%.2f bytes/triangle)\n",
+                p->qout_bytes,
+                count ? (double) p->qout_bytes / count : 0.0);
+    }
+
+    pipeline_close(p);
     return count;
 }
 
 
-static int read_tri(tri_t t, FILE* fin)
+static size_t
+copy_shards(const struct options* opts, struct timing* timing)
 {
-    int res = fscanf(fin, TRIANGLE_HDR);
-    if (res != 0) return EOF;
+    size_t n = opts->n_shards;
 
-    for (int i = 0; i < 3; ++i) {
-        posn_t p = read_posn(fin);
-        if (!p) bail_format();
+    struct shard_run run = {
+        .opts   = opts,
+        .shards = calloc(n, sizeof(struct shard)),
+        .timing = {0, 0, 0, 0, 0},
+    };
+    if (!run.shards) bail(ALLOC_ERROR, NULL);
 
-#if BORROWING_TRI
-        bt_set_borrowed(t, i, p);
-        posn_destroy(p);
-#else
-        ot_put_owned(t, i, p);
-#endif
+    for (size_t i = 0; i < n; ++i) run.shards[i].name = opts->shards[i];
+
+    // Parallelism goes to the shards first; any threads left over go to
+    // each shard's batch stages.
+    int workers = opts->threads < (long) n ? opts->threads : (int) n;
+    run.inner_threads = opts->threads / workers;
+    run.window = SHARD_WINDOW * (size_t) workers;
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.merged, NULL);
+
+    parallel_for((size_t) workers, workers, 1, shard_worker, &run);
+
+    pthread_cond_destroy(&run.merged);
+    pthread_mutex_destroy(&run.lock);
+    free(run.shards);
+
+    *timing = run.timing;
+    return run.count;
+}
+
+
+static void shard_worker(size_t begin, size_t end, void* env)
+{
+    (void) begin, (void) end;
+    struct shard_run* run = env;
+
+    bool merging = !run->opts->shard_dir;
+
+    for (;;) {
+        pthread_mutex_lock(&run->lock);
+
+        while (merging && run->next < run->opts->n_shards &&
+                run->next >= run->next_merge + run->window)
+            pthread_cond_wait(&run->merged, &run->lock);
+
+        size_t i = run->next++;
+
+        // If every shard before this one is already in the output, and
+        // no one else is writing to it, write this one there directly.
+        bool direct = merging && i == run->next_merge && !run->merging;
+        if (direct) run->merging = true;
+
+        pthread_mutex_unlock(&run->lock);
+
+        if (i >= run->opts->n_shards) return;
+
+        struct shard* sh = &run->shards[i];
+
+        struct options opts = *run->opts;
+        opts.threads = run->inner_threads;
+
+        if ( !(opts.fin = fopen(sh->name, "r")) )
+            bail(BAD_INFILE, sh->name);
+
+        opts.fout = opts.shard_dir ? open_shard_output(opts.shard_dir,
+                                                       sh->name)
+                  : direct         ? run->opts->fout
+                                   : tmpfile();
+        if (!opts.fout) bail(BAD_OUTFILE, sh->name);
+
+        struct timing timing = {0, 0, 0, 0, 0};
+        sh->count = copy_triangles(&opts, &timing);
+        fclose(opts.fin);
+
+        if (opts.shard_dir) {
+            if (fclose(opts.fout) == EOF) bail(WRITE_ERROR, sh->name);
+        } else if (!direct) {
+            sh->out = opts.fout;
+        }
+
+        pthread_mutex_lock(&run->lock);
+        run->count                 += sh->count;
+        run->timing.read_secs      += timing.read_secs;
+        run->timing.transform_secs += timing.transform_secs;
+        run->timing.analysis_secs  += timing.analysis_secs;
+        run->timing.sort_secs      += timing.sort_secs;
+        run->timing.write_secs     += timing.write_secs;
+        pthread_mutex_unlock(&run->lock);
+
+        finish_shard(run, i, direct);
     }
+}
 
-    return 1;
+
+static void finish_shard(struct shard_run* run, size_t i, bool direct)
+{
+    pthread_mutex_lock(&run->lock);
+    run->shards[i].done = true;
+
+    if (direct) {
+        run->next_merge = i + 1;
+        pthread_cond_broadcast(&run->merged);
+    }
+
+    // Only one worker merges at a time, and it keeps going while the
+    // next shard in order is done; a worker that finishes a shard in the
+    // meantime leaves it for the merging one to find.
+    if ((direct || !run->merging) && !run->opts->shard_dir) {
+        run->merging = true;
+
+        while (run->next_merge < run->opts->n_shards
+                && run->shards[run->next_merge].done) {
+            struct shard* sh = &run->shards[run->next_merge++];
+            pthread_mutex_unlock(&run->lock);
+
+            append_file(run->opts->fout, sh->out);
+            fclose(sh->out);
+            sh->out = NULL;
+
+            pthread_mutex_lock(&run->lock);
+            pthread_cond_broadcast(&run->merged);
+        }
+
+        run->merging = false;
+    }
+
+    pthread_mutex_unlock(&run->lock);
+}
+
+
+static void append_file(FILE* dst, FILE* src)
+{
+    char buf[MERGE_BUF_SIZE];
+    size_t n;
+
+    if (fflush(src) == EOF) bail(WRITE_ERROR, NULL);
+    rewind(src);
+
+    while ((n = fread(buf, 1, sizeof buf, src)))
+        if (fwrite(buf, 1, n, dst) != n) bail(WRITE_ERROR, NULL);
+
+    if (ferror(src)) bail(WRITE_ERROR, NULL);
+}
+
+
+static FILE* open_shard_output(const char* dir, const char* name)
+{
+    const char* base = base_name(name);
+
+    size_t len = strlen(dir) + strlen(base) + 2;
+    char* path = malloc(len);
+    if (!path) bail(ALLOC_ERROR, NULL);
+    snprintf(path, len, "%s/%s", dir, base);
+
+    FILE* result = fopen(path, "w");
+    if (!result) bail(BAD_OUTFILE, path);
+
+    free(path);
+    return result;
+}
+
+
+static const char* base_name(const char* path)
+{
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+
+static int compare_base_names(const void* a, const void* b)
+{
+    return strcmp(base_name(*(char* const*) a), base_name(*(char* const*) b));
+}
+
+
+static void check_shard_names(const struct options* opts, const char* prog)
+{
+    size_t n = opts->n_shards;
+
+    char** sorted = malloc(n * sizeof *sorted);
+    if (!sorted) bail(ALLOC_ERROR, NULL);
+    memcpy(sorted, opts->shards, n * sizeof *sorted);
+    qsort(sorted, n, sizeof *sorted, compare_base_names);
+
+    for (size_t i = 1; i < n; ++i)
+        if (!compare_base_names(&sorted[i - 1], &sorted[i]))
+            bail_option("two shards would be written to the same file",
+                        base_name(sorted[i]), prog);
+
+    free(sorted);
+}
+
+
+static void pipeline_init(struct pipeline* p, enum backend backend)
+{
+    p->opts = NULL;
+    p->qin  = NULL;
+    p->qout = NULL;
+    p->sorter = NULL;
+    p->writer = NULL;
+    p->topo   = NULL;
+    p->overlap = NULL;
+    p->raster  = NULL;
+    p->hull    = NULL;
+    p->timing = (struct timing) {0, 0, 0, 0, 0};
+
+    // We're going to use one triangle object to read each input
+    // triangle into, and then copy it into the batch:
+    tri_init(&p->triangle, backend);
+
+    p->batch = tb_create(BATCH_SIZE);
+    if (!p->batch) bail(ALLOC_ERROR, NULL);
+}
+
+
+static void pipeline_fini(struct pipeline* p)
+{
+    pipeline_close(p);
+    ts_destroy(p->sorter);
+    tb_destroy(p->batch);
+    tri_fini(&p->triangle);
+}
+
+
+static void pipeline_open(struct pipeline* p, const struct options* opts)
+{
+    p->opts   = opts;
+    p->timing = (struct timing) {0, 0, 0, 0, 0};
+
+    // Quantized input and output go a block (QT_BLOCK_SIZE) at a time
+    // through these stores. (Each block read in brings its own error
+    // bound, so `qin`'s doesn't matter.)
+    if (opts->dequantize) {
+        p->qin = qt_create(1);
+        if (!p->qin) bail(ALLOC_ERROR, NULL);
+        qt_begin(p->qin, &p->cur);
+    }
+
+    if (opts->quant_err) {
+        p->qout = qt_create(opts->quant_err);
+        if (!p->qout) bail(ALLOC_ERROR, NULL);
+        p->qout_bytes = 0;
+    }
+
+    // The sorter's run buffer is the largest thing here, so it's made
+    // once, by the first copy that sorts, and reset after each.
+    if (opts->sorting && !p->sorter) {
+        p->sorter = ts_create(opts->sort_mem_mb << 20, opts->threads);
+        if (!p->sorter) bail(ALLOC_ERROR, NULL);
+    }
+
+    if (opts->topology) {
+        p->topo = mt_create();
+        if (!p->topo) bail(ALLOC_ERROR, NULL);
+    }
+
+    if (opts->overlaps) {
+        p->overlap = to_create();
+        if (!p->overlap) bail(ALLOC_ERROR, NULL);
+    }
+
+    if (opts->raster_width) {
+        p->raster = tr_create(opts->raster_width, opts->raster_height,
+                              opts->raster_mode);
+        if (!p->raster) bail(ALLOC_ERROR, NULL);
+
+        const double* w = opts->raster_window;
+        if (opts->raster_windowed) tr_set_window(p->raster, w[0], w[1],
+                                                 w[2], w[3]);
+    }
+
+    if (opts->hull) {
+        p->hull = th_create(opts->threads);
+        if (!p->hull) bail(ALLOC_ERROR, NULL);
+    }
+
+    // The writer takes over the output file's descriptor, so anything
+    // already buffered by stdio has to go out first.
+    if (opts->async_write && !opts->quant_err) {
+        if (fflush(opts->fout) == EOF) bail(WRITE_ERROR, NULL);
+        p->writer = aw_create(fileno(opts->fout), WRITE_BUF_SIZE,
+                              opts->write_mode);
+        if (!p->writer) bail(WRITE_ERROR, "cannot start async writer");
+    }
+}
+
+
+static void pipeline_close(struct pipeline* p)
+{
+    aw_close(p->writer);
+    if (p->sorter) ts_reset(p->sorter);
+    qt_destroy(p->qin);
+    qt_destroy(p->qout);
+    mt_destroy(p->topo);
+    to_destroy(p->overlap);
+    tr_destroy(p->raster);
+    th_destroy(p->hull);
+
+    p->topo    = NULL;
+    p->overlap = NULL;
+    p->raster  = NULL;
+    p->hull    = NULL;
+    p->writer = NULL;
+    p->qin    = NULL;
+    p->qout   = NULL;
+
+    tb_clear(p->batch);
+}
+
+
+static void serve(const struct options* opts)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(opts->serve_path) >= sizeof addr.sun_path) {
+        errno = ENAMETOOLONG;
+        return;
+    }
+    strcpy(addr.sun_path, opts->serve_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return;
+
+    // A stale socket from an earlier run would make bind() fail.
+    unlink(opts->serve_path);
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof addr) ||
+            listen(fd, LISTEN_BACKLOG)) {
+        close(fd);
+        return;
+    }
+
+    // A client that hangs up early should cost only its own request.
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "serving on %s with %d %s\n", opts->serve_path,
+            opts->threads, opts->threads == 1 ? "worker" : "workers");
+
+    struct server_worker* workers =
+        calloc((size_t) opts->threads, sizeof *workers);
+    if (!workers) bail(ALLOC_ERROR, NULL);
+
+    for (int i = 0; i < opts->threads; ++i) {
+        workers[i].opts      = opts;
+        workers[i].listen_fd = fd;
+        pipeline_init(&workers[i].pipeline, opts->backend);
+    }
+
+    parallel_for((size_t) opts->threads, opts->threads, 1,
+                 serve_worker, workers);
+}
+
+
+static void serve_worker(size_t begin, size_t end, void* env)
+{
+    struct server_worker* w = (struct server_worker*) env + begin;
+    (void) end;
+
+    for (;;) {
+        int fd = accept(w->listen_fd, NULL, NULL);
+
+        if (fd >= 0) {
+            serve_request(w, fd);
+        } else if (errno != EINTR && errno != ECONNABORTED) {
+            bail(BAD_OUTFILE, "accept");
+        }
+    }
+}
+
+
+static void serve_request(struct server_worker* w, int fd)
+{
+    struct options opts = *w->opts;
+    opts.threads = 1;
+
+    // Two streams on the one socket, each with the worker's own buffer.
+    opts.fin  = fdopen(fd, "r");
+    opts.fout = NULL;
+
+    int out_fd = dup(fd);
+    if (out_fd >= 0 && !(opts.fout = fdopen(out_fd, "w"))) close(out_fd);
+
+    if (!opts.fin || !opts.fout) {
+        if (opts.fin) fclose(opts.fin);
+        else close(fd);
+        return;
+    }
+
+    setvbuf(opts.fin, w->in_buf, _IOFBF, sizeof w->in_buf);
+    setvbuf(opts.fout, w->out_buf, _IOFBF, sizeof w->out_buf);
+
+    struct request_error error;
+    request_error = &error;
+
+    // A failed request leaves whatever it allocated in the pipeline,
+    // for `pipeline_close` to free.
+    if (!setjmp(error.escape)) {
+        size_t count = run_pipeline(&w->pipeline, &opts);
+        fprintf(opts.fout, GEO_REPLY_OK_FMT, count);
+    } else {
+        pipeline_close(&w->pipeline);
+        fprintf(opts.fout, GEO_REPLY_ERROR_FMT, error.exit_code, error.msg);
+    }
+
+    request_error = NULL;
+
+    fclose(opts.fout);
+    fclose(opts.fin);
+}
+
+
+
+static bool fill_batch(struct pipeline* p)
+{
+    double start = now();
+    TRACE_BEGIN("read_tri");
+
+    while (!tb_is_full(p->batch) && next_tri(p) > 0) {
+        double xs[3], ys[3];
+        for (int i = 0; i < 3; ++i) {
+            const_posn_t v = tri_const_vertex(&p->triangle, i);
+            xs[i] = posn_x(v);
+            ys[i] = posn_y(v);
+        }
+
+        tb_push(p->batch, xs, ys);
+    }
+
+    TRACE_END("read_tri");
+    p->timing.read_secs += now() - start;
+    return !tb_is_empty(p->batch);
+}
+
+
+static void transform_batch(struct pipeline* p)
+{
+    if (!p->opts->transforming) return;
+
+    double start = now();
+    TRACE_BEGIN("transform");
+
+    affine_apply_parallel(&p->opts->transform,
+                          tb_xs(p->batch), tb_ys(p->batch),
+                          3 * tb_count(p->batch), p->opts->threads);
+
+    TRACE_END("transform");
+    p->timing.transform_secs += now() - start;
 }
 
 
-static void write_tri(c_tri_t t, FILE* fout)
+static void emit_batch(struct pipeline* p)
 {
-    int res;
+    double start = now();
+    TRACE_BEGIN("write_tri");
+
+    for (size_t i = 0; i < tb_count(p->batch); ++i) {
+        double xs[3], ys[3];
+        tb_get(p->batch, i, xs, ys);
+
+        if (p->writer) {
+            char* buf = aw_reserve(p->writer, GEO_MAX_TRI_LEN);
+            if (!buf) bail(WRITE_ERROR, NULL);
+            aw_commit(p->writer, geo_format_tri(buf, xs, ys));
+        } else if (!p->qout) {
+            write_tri(xs, ys, p->opts->fout);
+        } else if (!qt_push(p->qout, xs, ys)) {
+            bail_quant("coordinate out of range for --quantize error bound");
+        } else if (qt_size(p->qout) >= QT_BLOCK_SIZE) {
+            write_quant_block(p);
+        }
+    }
+
+    tb_clear(p->batch);
+    TRACE_END("write_tri");
+    p->timing.write_secs += now() - start;
+}
+
+
+static void write_quant_block(struct pipeline* p)
+{
+    if (!qt_write(p->qout, p->opts->fout)) bail(WRITE_ERROR, NULL);
+    p->qout_bytes += qt_size(p->qout);
+    qt_clear(p->qout);
+}
+
+
+static void analyze_batch(struct pipeline* p)
+{
+    double start = now();
+    TRACE_BEGIN("analyze");
+
+    if (p->topo && !mt_add_batch(p->topo, p->batch))
+        bail(ALLOC_ERROR, NULL);
+    if (p->overlap && !to_add_batch(p->overlap, p->batch))
+        bail(ALLOC_ERROR, NULL);
+    if (p->raster && !tr_add_batch(p->raster, p->batch))
+        bail(ALLOC_ERROR, NULL);
+    if (p->hull && !th_add_batch(p->hull, p->batch))
+        bail(ALLOC_ERROR, NULL);
+
+    TRACE_END("analyze");
+    p->timing.analysis_secs += now() - start;
+}
+
+
+static void report_analyses(struct pipeline* p)
+{
+    double start = now();
+
+    if (p->topo) {
+        if (!mt_build(p->topo, p->opts->threads)) bail(ALLOC_ERROR, NULL);
+
+        fprintf(stderr, "topology: %zu vertices, %zu edges (%zu boundary, "
+                        "%zu non-manifold), %zu %s\n",
+                mt_vertex_count(p->topo), mt_edge_count(p->topo),
+                mt_boundary_edge_count(p->topo),
+                mt_nonmanifold_edge_count(p->topo),
+                mt_component_count(p->topo),
+                mt_component_count(p->topo) == 1 ? "component"
+                                                 : "components");
+
+        if (p->opts->topology_out)
+            write_topology(p->topo, p->opts->topology_out);
+    }
+
+    if (p->overlap) {
+        if (!to_find(p->overlap, p->opts->threads,
+                     p->opts->overlaps_out != NULL))
+            bail(ALLOC_ERROR, NULL);
+
+        fprintf(stderr, "overlaps: %zu overlapping %s\n",
+                to_pair_count(p->overlap),
+                to_pair_count(p->overlap) == 1 ? "pair" : "pairs");
+
+        if (p->opts->overlaps_out)
+            write_overlaps(p->overlap, p->opts->overlaps_out);
+    }
+
+    if (p->raster) {
+        if (!tr_render(p->raster, p->opts->threads)) bail(ALLOC_ERROR, NULL);
+
+        size_t cells = tr_width(p->raster) * tr_height(p->raster);
+        size_t covered = 0;
+
+        if (tr_get_mode(p->raster) == TR_COUNT) {
+            const uint32_t* counts = tr_counts(p->raster);
+            uint32_t most = 0;
+
+            for (size_t i = 0; i < cells; ++i) {
+                covered += counts[i] != 0;
+                if (counts[i] > most) most = counts[i];
+            }
+
+            fprintf(stderr, "raster: %zu of %zu cells covered, by at most "
+                            "%" PRIu32 " %s\n", covered, cells, most,
+                    most == 1 ? "triangle" : "triangles");
+        } else {
+            const float* coverage = tr_coverage(p->raster);
+            double total = 0;
+
+            for (size_t i = 0; i < cells; ++i) {
+                covered += coverage[i] != 0;
+                total += coverage[i];
+            }
+
+            fprintf(stderr, "raster: %zu of %zu cells covered, %.6g cells' "
+                            "worth of area\n", covered, cells, total);
+        }
+
+        if (p->opts->raster_out)
+            write_raster(p->raster, p->opts->raster_out);
+    }
+
+    if (p->hull) {
+        if (!th_finish(p->hull)) bail(ALLOC_ERROR, NULL);
+
+        fprintf(stderr, "hull: %zu of %zu vertices\n",
+                th_size(p->hull), th_vertex_count(p->hull));
+
+        if (p->opts->hull_out)
+            write_hull(p->hull, p->opts->hull_out);
+    }
+
+    p->timing.analysis_secs += now() - start;
+}
+
+
+static void write_topology(c_mesh_topo_t topo, const char* path)
+{
+    FILE* fout = fopen(path, "w");
+    if (!fout) bail(BAD_OUTFILE, path);
+
+    for (size_t t = 0; t < mt_triangle_count(topo); ++t) {
+        for (int e = 0; e < 3; ++e) {
+            uint32_t n = mt_neighbor(topo, t, e);
+            if (n == MT_NONE) fputs("-1 ", fout);
+            else fprintf(fout, "%" PRIu32 " ", n);
+        }
+
+        if (fprintf(fout, "%" PRIu32 "\n", mt_component(topo, t)) < 0)
+            bail(WRITE_ERROR, path);
+    }
+
+    if (fclose(fout) == EOF) bail(WRITE_ERROR, path);
+}
+
+
+static void write_overlaps(c_tri_overlap_t overlap, const char* path)
+{
+    FILE* fout = fopen(path, "w");
+    if (!fout) bail(BAD_OUTFILE, path);
+
+    for (size_t i = 0; i < to_pair_count(overlap); ++i) {
+        uint32_t a, b;
+        to_pair(overlap, i, &a, &b);
+
+        if (fprintf(fout, "%" PRIu32 " %" PRIu32 "\n", a, b) < 0)
+            bail(WRITE_ERROR, path);
+    }
+
+    if (fclose(fout) == EOF) bail(WRITE_ERROR, path);
+}
+
+
+static void write_raster(c_tri_raster_t raster, const char* path)
+{
+    FILE* fout = fopen(path, "wb");
+    if (!fout) bail(BAD_OUTFILE, path);
+
+    size_t width = tr_width(raster), height = tr_height(raster);
+    size_t cells = width * height;
+    const uint32_t* counts = tr_counts(raster);
+    const float* coverage = tr_coverage(raster);
+
+    size_t len = strlen(path);
+    bool pgm = len >= 4 && !strcmp(path + len - 4, ".pgm");
 
-    res = fputs(TRIANGLE_HDR, fout);
-    if (res == EOF) bail(WRITE_ERROR, NULL);
+    if (!pgm) {
+        double x0, y0, x1, y1;
+        tr_window(raster, &x0, &y0, &x1, &y1);
+
+        fprintf(fout, "georaster %s %zu %zu %.17g %.17g %.17g %.17g\n",
+                counts ? "count" : "area", width, height, x0, y0, x1, y1);
+
+        size_t n = counts ? fwrite(counts, sizeof *counts, cells, fout)
+                          : fwrite(coverage, sizeof *coverage, cells, fout);
+        if (n != cells) bail(WRITE_ERROR, path);
+    } else {
+        // Counts are scaled so the greatest is white; coverage of 1 or
+        // more is white.
+        unsigned maxval = 65535;
+        if (counts) {
+            uint32_t most = 1;
+            for (size_t i = 0; i < cells; ++i)
+                if (counts[i] > most) most = counts[i];
+            if (most < maxval) maxval = most;
+        }
+
+        fprintf(fout, "P5\n%zu %zu\n%u\n", width, height, maxval);
+
+        // PGM starts at the top row; samples over 255 take two bytes,
+        // most significant first.
+        for (size_t row = height; row-- > 0; ) {
+            for (size_t col = 0; col < width; ++col) {
+                size_t i = row * width + col;
+                double v = counts ? counts[i] : coverage[i] * maxval + 0.5;
+                unsigned sample = v >= maxval ? maxval
+                                : v > 0       ? (unsigned) v : 0;
+
+                if (maxval > 255) putc(sample >> 8, fout);
+                putc(sample & 0xFF, fout);
+            }
+        }
+    }
+
+    if (fclose(fout) == EOF) bail(WRITE_ERROR, path);
+}
+
+
+static void write_hull(c_tri_hull_t hull, const char* path)
+{
+    FILE* fout = fopen(path, "w");
+    if (!fout) bail(BAD_OUTFILE, path);
+
+    for (size_t i = 0; i < th_size(hull); ++i) {
+        double x, y;
+        th_get(hull, i, &x, &y);
+
+        if (!geo_write_coords(fout, x, y) || putc('\n', fout) == EOF)
+            bail(WRITE_ERROR, path);
+    }
+
+    if (fclose(fout) == EOF) bail(WRITE_ERROR, path);
+}
+
+
+static void sort_batch(struct pipeline* p)
+{
+    double start = now();
+    TRACE_BEGIN("sort");
+
+    if (!ts_add_batch(p->sorter, p->batch))
+        bail(SORT_ERROR, "cannot spill sorted run");
+    tb_clear(p->batch);
+
+    TRACE_END("sort");
+    p->timing.sort_secs += now() - start;
+}
+
+
+static void emit_sorted(struct pipeline* p)
+{
+    // The sorter's merge and our output are interleaved here, so the
+    // time for both is counted as sorting.
+    double start = now();
+    double write_before = p->timing.write_secs;
+    TRACE_BEGIN("merge");
+
+    if (!ts_finish(p->sorter, emit_sorted_tri, p))
+        bail(SORT_ERROR, "cannot merge sorted runs");
+    emit_batch(p);
+
+    TRACE_END("merge");
+
+    if (p->opts->timing)
+        fprintf(stderr, "sorted with %zu spilled %s\n",
+                ts_spilled_runs(p->sorter),
+                ts_spilled_runs(p->sorter) == 1 ? "run" : "runs");
+
+    double writing = p->timing.write_secs - write_before;
+    p->timing.sort_secs += now() - start - writing;
+}
+
+
+static void emit_sorted_tri(const double xs[3], const double ys[3],
+                            void* env)
+{
+    struct pipeline* p = env;
+
+    if (tb_is_full(p->batch)) emit_batch(p);
+    tb_push(p->batch, xs, ys);
+}
+
+
+static int next_tri(struct pipeline* p)
+{
+    if (!p->qin) return read_tri(&p->triangle, p->opts->fin);
+
+    double xs[3], ys[3];
+    while (!qt_next(p->qin, &p->cur, xs, ys)) {
+        int status = qt_read(p->opts->fin, p->qin);
+        if (status == 0) return EOF;
+        if (status < 0) bail_quant("cannot read quantized input");
+        qt_begin(p->qin, &p->cur);
+    }
 
     for (int i = 0; i < 3; ++i)
-        write_posn(tri_const_get_borrowed(t, i), fout);
+        posn_set(tri_vertex(&p->triangle, i), xs[i], ys[i]);
 
-    res = fputs("\n", fout);
-    if (res == EOF) bail(WRITE_ERROR, NULL);
+    return 1;
 }
 
 
-static posn_t read_posn(FILE* stream)
+static void tri_init(struct tri* t, enum backend backend)
 {
-    double x, y;
+    t->backend = backend;
+    t->ot = NULL;
+    t->bt = NULL;
+
+    for (int i = 0; i < 3; ++i) t->posn_owner[i] = NULL;
+
+    if (backend == OWNING) {
+        // Owning triangles start out with three posns of their own.
+        t->ot = ot_create();
+        if (!t->ot) bail(ALLOC_ERROR, NULL);
 
-    if (2 != fscanf(stream, READ_POSN_FMT, &x, &y)) {
-        return NULL;
+        for (int i = 0; i < 3; ++i)
+            if (!ot_get_borrowed(t->ot, i)) bail(ALLOC_ERROR, NULL);
+    } else {
+        // We allocate fresh, owned `posn_t`s here; then we store a
+        // borrowed pointer to each owned `posn_t` as a vertex of the
+        // triangle.
+        t->bt = bt_create();
+        if (!t->bt) bail(ALLOC_ERROR, NULL);
+
+        for (int i = 0; i < 3; ++i) {
+            t->posn_owner[i] = posn_clone(ORIGIN);
+            if (!t->posn_owner[i]) bail(ALLOC_ERROR, NULL);
+
+            bt_put_borrowed(t->bt, i, t->posn_owner[i]);
+        }
     }
+}
 
-    posn_t result = posn_create(x, y);
-    if (!result) bail(ALLOC_ERROR, NULL);
 
-    return result;
+static void tri_fini(struct tri* t)
+{
+    ot_destroy(t->ot);
+    bt_destroy(t->bt);
+
+    // For the borrowing triangle, we need to destroy our owned posns
+    // (which it borrowed) when we're finished.
+    for (int i = 0; i < 3; ++i) {
+        posn_destroy(t->posn_owner[i]);
+    }
+}
+
+
+static posn_t tri_vertex(struct tri* t, int v)
+{
+    return t->backend == OWNING
+           ? ot_get_borrowed(t->ot, v)
+           : bt_get_borrowed(t->bt, v);
 }
 
 
-static void write_posn(const_posn_t p, FILE* stream)
+static const_posn_t tri_const_vertex(const struct tri* t, int v)
 {
-    int res = fprintf(stream, "(%g,%g)", posn_x(p), posn_y(p));
-    if (res < 0) bail(WRITE_ERROR, NULL);
+    return t->backend == OWNING
+           ? ot_const_get_borrowed(t->ot, v)
+           : bt_const_get_borrowed(t->bt, v);
+}
+
+
+static int read_tri(struct tri* t, FILE* fin)
+{
+    if (geo_read_header(fin) == EOF) return EOF;
+
+    for (int i = 0; i < 3; ++i) {
+        double x, y;
+        if (!geo_read_coords(fin, &x, &y)) bail_format();
+
+        // Both backends keep their vertices for the life of the
+        // triangle, so we overwrite them instead of replacing them.
+        posn_set(tri_vertex(t, i), x, y);
+    }
+
+    return 1;
+}
+
+
+static void write_tri(const double xs[3], const double ys[3], FILE* fout)
+{
+    if (!geo_write_header(fout)) bail(WRITE_ERROR, NULL);
+
+    for (int i = 0; i < 3; ++i)
+        if (!geo_write_coords(fout, xs[i], ys[i])) bail(WRITE_ERROR, NULL);
+
+    if (!geo_write_end(fout)) bail(WRITE_ERROR, NULL);
 }
 
 
 static void
-process_args(FILE** inp, FILE** outp, int argc, char* argv[])
+process_args(struct options* opts, int argc, char* argv[])
 {
-    *inp  = stdin;
-    *outp = stdout;
+    opts->fin          = stdin;
+    opts->fout         = stdout;
+    opts->backend      = DEFAULT_BACKEND;
+    opts->timing       = false;
+    opts->quant_err    = 0;
+    opts->dequantize   = false;
+    opts->transforming = false;
+    opts->transform    = affine_identity();
+    opts->threads      = parallel_default_threads();
+    opts->sorting      = false;
+    opts->sort_mem_mb  = SORT_MEM_MB;
+    opts->async_write  = false;
+    opts->write_mode   = AW_AUTO;
+    opts->sharded      = false;
+    opts->shards       = NULL;
+    opts->n_shards     = 0;
+    opts->shards_cap   = 0;
+    opts->shard_dir    = NULL;
+    opts->serve_path   = NULL;
+    opts->topology     = false;
+    opts->topology_out = NULL;
+    opts->overlaps     = false;
+    opts->overlaps_out = NULL;
+    opts->raster_width    = 0;
+    opts->raster_height   = 0;
+    opts->raster_mode     = TR_COUNT;
+    opts->raster_windowed = false;
+    opts->raster_out      = NULL;
+    opts->hull            = false;
+    opts->hull_out        = NULL;
+    opts->trace_out       = NULL;
+
+    const char* prog = argv[0];
+
+    // Options come first; stop at the first argument that isn't one.
+    while (argc > 1 && !strncmp(argv[1], "--", 2)) {
+        const char* opt = argv[1];
+
+        if (!strcmp(opt, "--backend=owning")) {
+            opts->backend = OWNING;
+        } else if (!strcmp(opt, "--backend=borrowing")) {
+            opts->backend = BORROWING;
+        } else if (!strcmp(opt, "--time")) {
+            opts->timing = true;
+        } else if (!strncmp(opt, "--quantize=", 11)) {
+            char* end;
+            opts->quant_err = strtod(opt + 11, &end);
+            if (*end || !(opts->quant_err > 0) || !isfinite(opts->quant_err))
+                bail_option("error bound must be positive", opt, prog);
+        } else if (!strcmp(opt, "--dequantize")) {
+            opts->dequantize = true;
+        } else if (!strncmp(opt, "--transform=", 12)) {
+            struct affine next;
+            if (!affine_parse(opt + 12, &next))
+                bail_option("bad transformation", opt, prog);
+            opts->transform = affine_compose(opts->transform, next);
+            opts->transforming = true;
+        } else if (!strncmp(opt, "--threads=", 10)) {
+            char* end;
+            long n = strtol(opt + 10, &end, 10);
+            if (*end || n < 1 || n > PARALLEL_MAX_THREADS)
+                bail_option("thread count must be 1 to "
+                            STR(PARALLEL_MAX_THREADS), opt, prog);
+            opts->threads = (int) n;
+        } else if (!strcmp(opt, "--sort")) {
+            opts->sorting = true;
+        } else if (!strncmp(opt, "--sort-mem=", 11)) {
+            char* end;
+            long n = strtol(opt + 11, &end, 10);
+            if (*end || n < 1 || n > (1L << 20))
+                bail_option("memory budget must be 1 to 1048576 MB",
+                            opt, prog);
+            opts->sort_mem_mb = n;
+        } else if (!strcmp(opt, "--async-write")) {
+            opts->async_write = true;
+            opts->write_mode  = AW_AUTO;
+        } else if (!strcmp(opt, "--async-write=uring")) {
+            opts->async_write = true;
+            opts->write_mode  = AW_URING;
+        } else if (!strcmp(opt, "--async-write=thread")) {
+            opts->async_write = true;
+            opts->write_mode  = AW_THREAD;
+        } else if (!strcmp(opt, "--shards")) {
+            opts->sharded = true;
+        } else if (!strncmp(opt, "--manifest=", 11)) {
+            read_manifest(opts, opt + 11);
+            opts->sharded = true;
+        } else if (!strcmp(opt, "--topology")) {
+            opts->topology = true;
+        } else if (!strncmp(opt, "--topology-out=", 15)) {
+            if (!opt[15]) bail_option("file name is empty", opt, prog);
+            opts->topology     = true;
+            opts->topology_out = opt + 15;
+        } else if (!strcmp(opt, "--overlaps")) {
+            opts->overlaps = true;
+        } else if (!strncmp(opt, "--overlaps-out=", 15)) {
+            if (!opt[15]) bail_option("file name is empty", opt, prog);
+            opts->overlaps     = true;
+            opts->overlaps_out = opt + 15;
+        } else if (!strncmp(opt, "--raster=", 9)) {
+            char* end;
+            unsigned long w = strtoul(opt + 9, &end, 10), h = 0;
+            if (*end == 'x') h = strtoul(end + 1, &end, 10);
+            if (*end || !w || !h || w > (1UL << 20) || h > (1UL << 20)
+                    || w * h > UINT32_MAX)
+                bail_option("grid must be WxH, at most 2^32 cells",
+                            opt, prog);
+            opts->raster_width  = w;
+            opts->raster_height = h;
+        } else if (!strcmp(opt, "--raster-area")) {
+            opts->raster_mode = TR_AREA;
+        } else if (!strncmp(opt, "--raster-window=", 16)) {
+            double* w = opts->raster_window;
+            int used = 0;
+            if (sscanf(opt + 16, "%lf,%lf,%lf,%lf%n",
+                       &w[0], &w[1], &w[2], &w[3], &used) != 4
+                    || opt[16 + used] || !(w[0] < w[2]) || !(w[1] < w[3])
+                    || !isfinite(w[2] - w[0]) || !isfinite(w[3] - w[1]))
+                bail_option("window must be X0,Y0,X1,Y1 with X0 < X1 "
+                            "and Y0 < Y1", opt, prog);
+            opts->raster_windowed = true;
+        } else if (!strncmp(opt, "--raster-out=", 13)) {
+            if (!opt[13]) bail_option("file name is empty", opt, prog);
+            opts->raster_out = opt + 13;
+        } else if (!strcmp(opt, "--hull")) {
+            opts->hull = true;
+        } else if (!strncmp(opt, "--hull-out=", 11)) {
+            if (!opt[11]) bail_option("file name is empty", opt, prog);
+            opts->hull     = true;
+            opts->hull_out = opt + 11;
+        } else if (!strncmp(opt, "--trace=", 8)) {
+            if (!opt[8]) bail_option("file name is empty", opt, prog);
+            opts->trace_out = opt + 8;
+        } else if (!strncmp(opt, "--serve=", 8)) {
+            if (!opt[8]) bail_option("socket name is empty", opt, prog);
+            opts->serve_path = opt + 8;
+        } else if (!strncmp(opt, "--shard-dir=", 12)) {
+            if (!opt[12]) bail_option("directory name is empty", opt, prog);
+            opts->shard_dir = opt + 12;
+        } else {
+            bail_option("unknown option", opt, prog);
+        }
+
+        ++argv;
+        --argc;
+    }
+
+    if (!opts->raster_width && (opts->raster_mode == TR_AREA ||
+                                opts->raster_windowed || opts->raster_out))
+        bail_option("needs --raster", opts->raster_out ? "--raster-out" :
+                    opts->raster_windowed ? "--raster-window"
+                                          : "--raster-area", prog);
+
+    if (opts->serve_path) {
+        if (argc > 1)
+            bail_option("takes no file arguments", "--serve", prog);
+        if (opts->sharded || opts->quant_err || opts->dequantize ||
+                opts->topology || opts->overlaps || opts->raster_width ||
+                opts->hull)
+            bail_option("not supported with shards, quantized formats "
+                        "or analyses", "--serve", prog);
+        if (opts->trace_out)
+            bail_option("not supported, as the server never finishes",
+                        "--trace", prog);
+        return;
+    }
+
+    if (opts->shard_dir && !opts->sharded)
+        bail_option("needs --shards or --manifest", "--shard-dir", prog);
+
+    if (opts->sharded) {
+        for (int i = 1; i < argc; ++i) add_shard(opts, argv[i]);
+
+        if (!opts->n_shards)
+            bail_option("no input shards given", "--shards", prog);
+        if (opts->topology_out || opts->overlaps_out || opts->raster_out ||
+                opts->hull_out)
+            bail_option("every shard would overwrite the file",
+                        opts->topology_out ? "--topology-out" :
+                        opts->overlaps_out ? "--overlaps-out" :
+                        opts->raster_out   ? "--raster-out"
+                                           : "--hull-out", prog);
+        if (opts->quant_err && !opts->shard_dir)
+            bail_option("merged output can't be quantized; use --shard-dir",
+                        "--quantize", prog);
+        if (opts->shard_dir) check_shard_names(opts, prog);
+        return;
+    }
 
     switch (argc) {
     case 3:
-        if ( !(*outp = fopen(argv[2], "w")) )
+        if ( !(opts->fout = fopen(argv[2], "w")) )
             bail(BAD_OUTFILE, argv[2]);
         // FALL THROUGH //
     case 2:
         if ( strcmp(argv[1], "-") &&
-                 !(*inp = fopen(argv[1], "r")) )
+                 !(opts->fin = fopen(argv[1], "r")) )
             bail(BAD_INFILE, argv[1]);
         // FALL THROUGH //
     case 1:
@@ -250,21 +1735,105 @@ process_args(FILE** inp, FILE** outp, int argc, char* argv[])
 
     default:
         fprintf(stderr, "Error: too many arguments\n");
-        fprintf(stderr, "Usage: %s [INFILE [OUTFILE]]\n", argv[0]);
+        fprintf(stderr, "Usage: %s [OPTION...] [INFILE [OUTFILE]]\n", prog);
         exit(TOO_MANY_ARGS);
     }
 }
 
 
+static void add_shard(struct options* opts, const char* name)
+{
+    if (opts->n_shards == opts->shards_cap) {
+        size_t cap = opts->shards_cap ? 2 * opts->shards_cap : 16;
+        char** bigger = realloc(opts->shards, cap * sizeof *bigger);
+        if (!bigger) bail(ALLOC_ERROR, NULL);
+
+        opts->shards     = bigger;
+        opts->shards_cap = cap;
+    }
+
+    opts->shards[opts->n_shards] = strdup(name);
+    if (!opts->shards[opts->n_shards]) bail(ALLOC_ERROR, NULL);
+    ++opts->n_shards;
+}
+
+
+static void read_manifest(struct options* opts, const char* path)
+{
+    FILE* manifest = fopen(path, "r");
+    if (!manifest) bail(BAD_INFILE, path);
+
+    char*  line = NULL;
+    size_t cap  = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &cap, manifest)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+
+        if (len && line[0] != '#') add_shard(opts, line);
+    }
+
+    if (ferror(manifest)) bail(BAD_INFILE, path);
+
+    free(line);
+    fclose(manifest);
+}
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
 static void bail_format(void)
 {
+    fail_request(FORMAT_ERROR, "bad input format", false);
     fprintf(stderr, "error: bad input format\n");
     exit(FORMAT_ERROR);
 }
 
 
+static void bail_quant(const char* msg)
+{
+    fail_request(QUANT_ERROR, msg, false);
+    fprintf(stderr, "error: %s\n", msg);
+    exit(QUANT_ERROR);
+}
+
+
+static void bail_option(const char* msg, const char* opt, const char* prog)
+{
+    fprintf(stderr, "Error: %s: %s\n", msg, opt);
+    fprintf(stderr, "Usage: %s [OPTION...] [INFILE [OUTFILE]]\n", prog);
+    exit(BAD_OPTION);
+}
+
+
 static void bail(int exit_code, const char* optional_msg)
 {
+    fail_request(exit_code, optional_msg, true);
     perror(optional_msg);
     exit(exit_code);
 }
+
+
+static void fail_request(int exit_code, const char* msg, bool with_errno)
+{
+    struct request_error* e = request_error;
+    if (!e) return;
+
+    e->exit_code = exit_code;
+
+    if (with_errno && msg) {
+        snprintf(e->msg, sizeof e->msg, "%s: %s", msg, strerror(errno));
+    } else {
+        snprintf(e->msg, sizeof e->msg, "%s",
+                 with_errno ? strerror(errno) : msg);
+    }
+
+    longjmp(e->escape, 1);
+}
@@ -0,0 +1,35 @@
+#include "geo_io.h"
+
+int geo_read_header(FILE* fin)
+{
+    return fscanf(fin, GEO_TRIANGLE_HDR) == 0 ? 0 : EOF;
+}
+
+bool geo_read_coords(FILE* fin, double* x, double* y)
+{
+    return fscanf(fin, GEO_READ_POSN_FMT, x, y) == 2;
+}
+
+bool geo_write_header(FILE* fout)
+{
+    return fputs(GEO_TRIANGLE_HDR, fout) != EOF;
+}
+
+bool geo_write_coords(FILE* fout, double x, double y)
+{
+    return fprintf(fout, GEO_WRITE_POSN_FMT, x, y) >= 0;
+}
+
+bool geo_write_end(FILE* fout)
+{
+    return fputs("\n", fout) != EOF;
+}
+
+size_t geo_format_tri(char* buf, const double xs[3], const double ys[3])
+{
+    int len = snprintf(buf, GEO_MAX_TRI_LEN,
+                       GEO_TRIANGLE_HDR GEO_WRITE_POSN_FMT GEO_WRITE_POSN_FMT
+                       GEO_WRITE_POSN_FMT "\n",
+                       xs[0], ys[0], xs[1], ys[1], xs[2], ys[2]);
+    return len < 0 ? 0 : (size_t) len;
+}
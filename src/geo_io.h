@@ -0,0 +1,53 @@
+// Text format for triangle streams, shared by geo_client and the
+// benchmarks.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * The format for each triangle is:
+ *
+ *     "tri: ( %lf , %lf ) ( %lf , %lf ) ( %lf , %lf )"
+ *
+ * (Spaces are optional on input; output never contains any.)
+ */
+
+#define GEO_READ_POSN_FMT   " ( %lf , %lf ) "
+#define GEO_WRITE_POSN_FMT  "(%g,%g)"
+#define GEO_TRIANGLE_HDR    "tri:"
+
+// How `geo_client --serve` ends each reply, after the output: the
+// number of triangles copied, or an exit code and message for a
+// request that failed (possibly after some output).
+#define GEO_REPLY_OK_FMT     "ok %zu\n"
+#define GEO_REPLY_ERROR_FMT  "error %d: %s\n"
+
+// Enough room for any triangle formatted by `geo_format_tri()`,
+// including the terminating '\0'.
+#define GEO_MAX_TRI_LEN     128
+
+
+// Attempts to read the header of the next triangle. Returns 0 if the
+// stream may still contain a triangle, or `EOF` at end-of-file.
+//
+// (Like `fscanf`, this does not distinguish a missing header from a
+// present one; reading the coordinates that follow will fail instead.)
+int geo_read_header(FILE*);
+
+// Reads one position into `*x` and `*y`. Returns false if the input is
+// badly formatted (or ends early).
+bool geo_read_coords(FILE*, double* x, double* y);
+
+// Write the pieces of a triangle in the format read above: a header,
+// three positions, and an end-of-line. Each returns false on write
+// error.
+bool geo_write_header(FILE*);
+bool geo_write_coords(FILE*, double x, double y);
+bool geo_write_end(FILE*);
+
+// Formats a whole triangle, exactly as the three functions above would
+// write it, into `buf` (which must have room for GEO_MAX_TRI_LEN
+// bytes). Returns the length of the result, not counting the '\0'.
+size_t geo_format_tri(char* buf, const double xs[3], const double ys[3]);
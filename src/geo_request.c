@@ -0,0 +1,431 @@
+// Client for `geo_client --serve`. Sends a triangle stream from the
+// specified file or stdin to the server listening on SOCKET, and writes
+// the reply to the specified file or stdout:
+//
+//   % ./geo_request SOCKET [INFILE [OUTFILE]]
+//
+// To measure the server, the same request can be sent many times, from
+// several connections at once:
+//
+//   --repeat=N            send the request N times in all (default 1)
+//   --clients=C           keep up to C requests in flight (default 1)
+//
+// Only the first reply is written out. With --repeat, the latency
+// percentiles of all the requests are reported to stderr.
+
+#include "geo_io.h"
+#include "parallel.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+
+//
+// Exit codes
+//
+
+#define BAD_INFILE     1
+#define BAD_OUTFILE    2
+#define TOO_MANY_ARGS  3
+#define ALLOC_ERROR    4
+#define CONNECT_ERROR  5
+#define REQUEST_ERROR  6
+#define BAD_OPTION     7
+
+
+//
+// Types
+//
+
+// A growable byte buffer.
+struct buffer
+{
+    char*   data;
+    size_t  len, cap;
+};
+
+// Settings from the command line.
+struct options
+{
+    const char*  socket_path;
+    FILE*        fin;
+    FILE*        fout;
+    size_t       repeat;
+    int          clients;
+};
+
+// The state shared by the client threads: the request to send, the
+// first reply, and everyone's latencies.
+struct run
+{
+    const struct options*  opts;
+    struct buffer          request;
+    pthread_mutex_t        lock;
+    size_t                 next;         // next request to send
+    struct buffer          first;        // first reply, once there
+    double*                latencies;    // seconds, one per request
+};
+
+
+//
+// Forward declarations
+//
+
+// Sends requests until `run->opts->repeat` have been sent. (A
+// `parallel_for` body; the range is ignored.)
+static void
+client_worker(size_t begin, size_t end, void* env);
+
+// Sends `request` on a fresh connection and collects the whole reply
+// in `*reply`. Bails out on error.
+static void
+send_request(const char* socket_path, const struct buffer* request,
+             struct buffer* reply);
+
+// Splits the status line off the end of `*reply`, bailing out if the
+// request failed. Returns the triangle count.
+static size_t
+check_reply(struct buffer* reply);
+
+// Reports the latency percentiles in `run` to stderr.
+static void
+report_latencies(struct run* run);
+
+// Reads all of `fin` into `*buf`. Bails out on error.
+static void
+read_all(FILE* fin, struct buffer* buf);
+
+// Ensures `*buf` has room for `extra` more bytes. Bails out on
+// allocation error.
+static void
+reserve(struct buffer* buf, size_t extra);
+
+// Fills in `*opts` based on the command-line arguments.
+static void
+process_args(struct options* opts, int argc, char* argv[]);
+
+// Returns the current time in seconds.
+static double
+now(void);
+
+// Prints an error message and exits.
+static void
+bail(int exit_code, const char* optional_msg);
+
+// Prints an error message about command-line option `opt` and exits.
+static void
+bail_option(const char* msg, const char* opt, const char* prog);
+
+
+//
+// Function definitions
+//
+
+int main(int argc, char* argv[])
+{
+    struct options opts;
+    process_args(&opts, argc, argv);
+
+    struct run run = {
+        .opts      = &opts,
+        .request   = {NULL, 0, 0},
+        .first     = {NULL, 0, 0},
+        .latencies = calloc(opts.repeat, sizeof(double)),
+    };
+    if (!run.latencies) bail(ALLOC_ERROR, NULL);
+
+    read_all(opts.fin, &run.request);
+    pthread_mutex_init(&run.lock, NULL);
+
+    double start = now();
+    parallel_for((size_t) opts.clients, opts.clients, 1, client_worker, &run);
+    double elapsed = now() - start;
+
+    size_t count = check_reply(&run.first);
+    if (fwrite(run.first.data, 1, run.first.len, opts.fout) != run.first.len
+            || fflush(opts.fout) == EOF)
+        bail(BAD_OUTFILE, NULL);
+
+    fprintf(stderr, "%zu %s copied\n", count,
+            count == 1 ? "triangle" : "triangles");
+
+    if (opts.repeat > 1) {
+        fprintf(stderr, "%zu requests in %.3f s (%.0f requests/s)\n",
+                opts.repeat, elapsed, opts.repeat / elapsed);
+        report_latencies(&run);
+    }
+
+    pthread_mutex_destroy(&run.lock);
+    free(run.latencies);
+    free(run.request.data);
+    free(run.first.data);
+
+    if (opts.fin != stdin) fclose(opts.fin);
+    if (opts.fout != stdout) fclose(opts.fout);
+}
+
+
+static void client_worker(size_t begin, size_t end, void* env)
+{
+    (void) begin, (void) end;
+    struct run* run = env;
+
+    struct buffer reply = {NULL, 0, 0};
+
+    for (;;) {
+        pthread_mutex_lock(&run->lock);
+        size_t i = run->next++;
+        pthread_mutex_unlock(&run->lock);
+
+        if (i >= run->opts->repeat) break;
+
+        double start = now();
+        send_request(run->opts->socket_path, &run->request, &reply);
+        run->latencies[i] = now() - start;
+
+        if (i == 0) {
+            // Hand our buffer over rather than copying it.
+            run->first = reply;
+            reply = (struct buffer) {NULL, 0, 0};
+        } else {
+            check_reply(&reply);
+        }
+    }
+
+    free(reply.data);
+}
+
+
+static void send_request(const char* socket_path,
+                         const struct buffer* request, struct buffer* reply)
+{
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, socket_path, sizeof addr.sun_path - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof addr))
+        bail(CONNECT_ERROR, socket_path);
+
+    // The server replies while it's still reading, so we have to send
+    // and receive at the same time or we could both end up blocked.
+    size_t sent = 0;
+    bool   done_sending = false;
+    reply->len = 0;
+
+    if (!request->len) {
+        shutdown(fd, SHUT_WR);
+        done_sending = true;
+    }
+
+    for (;;) {
+        struct pollfd pfd = {
+            .fd     = fd,
+            .events = POLLIN | (done_sending ? 0 : POLLOUT),
+        };
+
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            bail(CONNECT_ERROR, socket_path);
+        }
+
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = send(fd, request->data + sent, request->len - sent,
+                             MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n > 0) sent += (size_t) n;
+
+            // A server that gave up on the request stops reading, but
+            // still sends its status, so keep receiving.
+            if (n < 0 && (errno == EPIPE || errno == ECONNRESET)) {
+                done_sending = true;
+            } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                bail(CONNECT_ERROR, socket_path);
+            } else if (sent == request->len) {
+                shutdown(fd, SHUT_WR);
+                done_sending = true;
+            }
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            reserve(reply, 64 * 1024);
+            ssize_t n = recv(fd, reply->data + reply->len,
+                             reply->cap - reply->len, MSG_DONTWAIT);
+            if (n == 0) break;
+            if (n < 0 && errno != EAGAIN && errno != EINTR)
+                bail(CONNECT_ERROR, socket_path);
+            if (n > 0) reply->len += (size_t) n;
+        }
+    }
+
+    close(fd);
+}
+
+
+static size_t check_reply(struct buffer* reply)
+{
+    // The status line is the last line of the reply.
+    size_t end = reply->len;
+    if (!end || reply->data[end - 1] != '\n') {
+        fprintf(stderr, "error: reply has no status line\n");
+        exit(REQUEST_ERROR);
+    }
+
+    size_t start = end - 1;
+    while (start && reply->data[start - 1] != '\n') --start;
+
+    reply->data[end - 1] = '\0';
+    const char* status = reply->data + start;
+
+    size_t count;
+    if (sscanf(status, GEO_REPLY_OK_FMT, &count) != 1) {
+        fprintf(stderr, "server %s\n", status);
+        exit(REQUEST_ERROR);
+    }
+
+    reply->len = start;
+    return count;
+}
+
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+
+static void report_latencies(struct run* run)
+{
+    size_t n = run->opts->repeat;
+    qsort(run->latencies, n, sizeof(double), compare_doubles);
+
+    static const double percentiles[] = {50, 90, 99, 99.9};
+
+    fprintf(stderr, "latency (ms):");
+    for (size_t i = 0; i < sizeof percentiles / sizeof *percentiles; ++i) {
+        size_t rank = (size_t) (percentiles[i] / 100 * (n - 1) + 0.5);
+        fprintf(stderr, " p%g %.3f,", percentiles[i],
+                1e3 * run->latencies[rank]);
+    }
+    fprintf(stderr, " max %.3f\n", 1e3 * run->latencies[n - 1]);
+}
+
+
+static void read_all(FILE* fin, struct buffer* buf)
+{
+    for (;;) {
+        reserve(buf, 64 * 1024);
+        size_t n = fread(buf->data + buf->len, 1, buf->cap - buf->len, fin);
+        buf->len += n;
+        if (n == 0) break;
+    }
+
+    if (ferror(fin)) bail(BAD_INFILE, NULL);
+}
+
+
+static void reserve(struct buffer* buf, size_t extra)
+{
+    if (buf->cap - buf->len >= extra) return;
+
+    size_t cap = buf->cap ? buf->cap : extra;
+    while (cap - buf->len < extra) cap *= 2;
+
+    char* bigger = realloc(buf->data, cap);
+    if (!bigger) bail(ALLOC_ERROR, NULL);
+
+    buf->data = bigger;
+    buf->cap  = cap;
+}
+
+
+static void
+process_args(struct options* opts, int argc, char* argv[])
+{
+    opts->fin     = stdin;
+    opts->fout    = stdout;
+    opts->repeat  = 1;
+    opts->clients = 1;
+
+    const char* prog = argv[0];
+
+    // Options come first; stop at the first argument that isn't one.
+    while (argc > 1 && !strncmp(argv[1], "--", 2)) {
+        const char* opt = argv[1];
+        char* end;
+
+        if (!strncmp(opt, "--repeat=", 9)) {
+            long n = strtol(opt + 9, &end, 10);
+            if (*end || n < 1)
+                bail_option("request count must be positive", opt, prog);
+            opts->repeat = (size_t) n;
+        } else if (!strncmp(opt, "--clients=", 10)) {
+            long n = strtol(opt + 10, &end, 10);
+            if (*end || n < 1 || n > 256)
+                bail_option("client count must be 1 to 256", opt, prog);
+            opts->clients = (int) n;
+        } else {
+            bail_option("unknown option", opt, prog);
+        }
+
+        ++argv;
+        --argc;
+    }
+
+    if (argc < 2) bail_option("no socket given", "SOCKET", prog);
+    opts->socket_path = argv[1];
+
+    if (strlen(opts->socket_path) >= sizeof ((struct sockaddr_un*) 0)->sun_path)
+        bail_option("socket name is too long", opts->socket_path, prog);
+
+    switch (argc) {
+    case 4:
+        if ( !(opts->fout = fopen(argv[3], "w")) )
+            bail(BAD_OUTFILE, argv[3]);
+        /* fall through */
+    case 3:
+        if ( strcmp(argv[2], "-") &&
+                 !(opts->fin = fopen(argv[2], "r")) )
+            bail(BAD_INFILE, argv[2]);
+        /* fall through */
+    case 2:
+        return;
+
+    default:
+        fprintf(stderr, "Error: too many arguments\n");
+        fprintf(stderr, "Usage: %s [OPTION...] SOCKET [INFILE [OUTFILE]]\n",
+                prog);
+        exit(TOO_MANY_ARGS);
+    }
+}
+
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void bail_option(const char* msg, const char* opt, const char* prog)
+{
+    fprintf(stderr, "Error: %s: %s\n", msg, opt);
+    fprintf(stderr, "Usage: %s [OPTION...] SOCKET [INFILE [OUTFILE]]\n", prog);
+    exit(BAD_OPTION);
+}
+
+
+static void bail(int exit_code, const char* optional_msg)
+{
+    perror(optional_msg);
+    exit(exit_code);
+}
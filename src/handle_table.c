@@ -0,0 +1,107 @@
+#include "handle_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+_Static_assert(sizeof(uintptr_t) >= 8, "handles need 64-bit pointers");
+
+static uintptr_t encode(uint32_t index, uint32_t gen)
+{
+    return (uintptr_t) gen << 32 | (index + 1);
+}
+
+static struct ht_slot* slot_at(struct handle_table* t, uint32_t index)
+{
+    return &t->pages[index >> HT_PAGE_BITS][index & (HT_PAGE_SIZE - 1)];
+}
+
+// Returns the index of a free slot, allocating a new page if needed.
+// Returns -1 if the table is full or on allocation error. Call with
+// the lock held.
+static int64_t take_free_slot(struct handle_table* t)
+{
+    if (t->free_head) {
+        uint32_t index = t->free_head - 1;
+        t->free_head = slot_at(t, index)->next_free;
+        return index;
+    }
+
+    uint32_t index = t->n_slots;
+    uint32_t page  = index >> HT_PAGE_BITS;
+
+    if (page >= HT_MAX_PAGES || index == UINT32_MAX) return -1;
+
+    if (!t->pages[page]) {
+        struct ht_slot* new_page = calloc(HT_PAGE_SIZE, sizeof *new_page);
+        if (!new_page) return -1;
+        __atomic_store_n(&t->pages[page], new_page, __ATOMIC_RELEASE);
+    }
+
+    // Publishing the new count (with release ordering) only after the
+    // page lets `ht_resolve` check the index without locking.
+    __atomic_store_n(&t->n_slots, index + 1, __ATOMIC_RELEASE);
+    return index;
+}
+
+uintptr_t ht_insert(struct handle_table* t, void* obj)
+{
+    pthread_mutex_lock(&t->lock);
+
+    int64_t index = take_free_slot(t);
+    uintptr_t result = 0;
+
+    if (index >= 0) {
+        struct ht_slot* slot = slot_at(t, (uint32_t) index);
+        __atomic_store_n(&slot->obj, obj, __ATOMIC_RELEASE);
+        result = encode((uint32_t) index, slot->gen);
+    }
+
+    pthread_mutex_unlock(&t->lock);
+    return result;
+}
+
+void* ht_remove(struct handle_table* t, uintptr_t h, const char* op)
+{
+    if (!h) return NULL;
+
+    pthread_mutex_lock(&t->lock);
+
+    uint32_t index = (uint32_t) h - 1;
+    uint32_t gen   = (uint32_t) (h >> 32);
+    void* result   = NULL;
+
+    if (index < t->n_slots) {
+        struct ht_slot* slot = slot_at(t, index);
+
+        if (slot->gen == gen && slot->obj) {
+            result          = slot->obj;
+            __atomic_store_n(&slot->obj, NULL, __ATOMIC_RELEASE);
+            __atomic_store_n(&slot->gen, gen + 1, __ATOMIC_RELEASE);
+            slot->next_free = t->free_head;
+            t->free_head    = index + 1;
+        }
+    }
+
+    pthread_mutex_unlock(&t->lock);
+
+    if (!result) ht_fail(t, h, op);
+    return result;
+}
+
+void ht_fail(const struct handle_table* t, uintptr_t h, const char* op)
+{
+    uint32_t index = (uint32_t) h - 1;
+    const char* what;
+
+    if (!h) {
+        what = "NULL";
+    } else if (index < __atomic_load_n(&t->n_slots, __ATOMIC_ACQUIRE)) {
+        what = "dangling (already destroyed)";
+    } else {
+        what = "invalid";
+    }
+
+    fprintf(stderr, "%s: %s %s handle %#llx\n",
+            op, what, t->kind, (unsigned long long) h);
+    abort();
+}
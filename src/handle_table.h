@@ -0,0 +1,96 @@
+// Generation-tagged handles, for catching ownership mistakes cheaply.
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * In a checked build (`-DCHECKED_HANDLES`), the geometry modules hand
+ * out handles instead of raw pointers. Clients can't tell the
+ * difference, because `posn_t` and friends are pointers to incomplete
+ * types anyway: all they can do with one is pass it back.
+ *
+ * A handle encodes a slot index and a generation number. The slot
+ * records the object's real address and its current generation, which
+ * is bumped whenever the object is removed. So looking up a handle
+ * after its object was destroyed (a dangling borrow), or destroying it
+ * twice, finds a mismatched generation and is caught in O(1) instead
+ * of being undefined behavior.
+ *
+ * Handle value 0 is NULL. Handles whose index part is 0 are never
+ * issued, so modules may use them for statically allocated objects
+ * (see `HANDLE_RESERVED`).
+ *
+ * Inserting and removing take the table's lock, but resolving doesn't,
+ * since that happens on every access. Instead, the writers store
+ * `n_slots`, `pages[]` and each slot's `obj` and `gen` with release
+ * ordering, and `ht_resolve` loads them with acquire ordering.
+ */
+
+#define HT_PAGE_BITS  16
+#define HT_PAGE_SIZE  (1u << HT_PAGE_BITS)
+#define HT_MAX_PAGES  (1u << 16)
+
+// The `n`th (> 0) reserved handle value.
+#define HANDLE_RESERVED(n)  ((uintptr_t) (n) << 32)
+
+struct ht_slot
+{
+    void*     obj;         // NULL when free
+    uint32_t  gen;
+    uint32_t  next_free;   // index + 1 of next free slot, or 0
+};
+
+struct handle_table
+{
+    const char*      kind;      // for error messages, e.g. "posn"
+    pthread_mutex_t  lock;      // held to insert or remove
+    uint32_t         n_slots;
+    uint32_t         free_head;
+    struct ht_slot*  pages[HT_MAX_PAGES];
+};
+
+// Static initializer for a `struct handle_table`.
+#define HANDLE_TABLE_INIT(KIND) \
+    { .kind = (KIND), .lock = PTHREAD_MUTEX_INITIALIZER }
+
+
+// Records `obj` (non-NULL) in the table and returns a fresh handle for
+// it. Returns 0 on allocation error.
+uintptr_t ht_insert(struct handle_table*, void* obj);
+
+// Removes the object named by handle `h` from the table and returns
+// it, so the caller can deallocate it. Returns NULL for handle 0.
+//
+// ERRORS: aborts with a message mentioning `op` if `h` is stale
+// (already removed) or was never issued.
+void* ht_remove(struct handle_table*, uintptr_t h, const char* op);
+
+// Reports a bad handle passed to `op` and aborts. (Used by
+// `ht_resolve`.)
+_Noreturn void ht_fail(const struct handle_table*, uintptr_t h,
+                       const char* op);
+
+// Returns the object named by handle `h`.
+//
+// ERRORS: aborts with a message mentioning `op` if `h` is 0, stale, or
+// was never issued.
+static inline void*
+ht_resolve(const struct handle_table* t, uintptr_t h, const char* op)
+{
+    uint32_t index = (uint32_t) h - 1;
+    uint32_t gen   = (uint32_t) (h >> 32);
+
+    if (index < __atomic_load_n(&t->n_slots, __ATOMIC_ACQUIRE)) {
+        const struct ht_slot* page =
+            __atomic_load_n(&t->pages[index >> HT_PAGE_BITS], __ATOMIC_ACQUIRE);
+        const struct ht_slot* slot = &page[index & (HT_PAGE_SIZE - 1)];
+
+        void* obj = __atomic_load_n(&slot->obj, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->gen, __ATOMIC_ACQUIRE) == gen && obj)
+            return obj;
+    }
+
+    ht_fail(t, h, op);
+}
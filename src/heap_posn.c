@@ -13,50 +13,111 @@ struct posn
 };
 
 static const struct posn origin_object = {0, 0};
+
+#ifdef HUGE_ARENAS
+// Allocate from huge pages (see arena.h).
+#   include "arena.h"
+
+static struct arena posn_arena = ARENA_INIT("posn", sizeof(struct posn));
+
+#   define alloc_posn()    arena_alloc(&posn_arena)
+#   define free_posn(p)    arena_free(&posn_arena, (p))
+#else
+#   define alloc_posn()    malloc(sizeof(struct posn))
+#   define free_posn(p)    free(p)
+#endif // HUGE_ARENAS
+
+#ifdef CHECKED_HANDLES
+// In a checked build, clients' `posn_t`s are handles (see
+// handle_table.h), which `deref` and `cderef` turn into real pointers.
+#   include "handle_table.h"
+
+static struct handle_table posn_table = HANDLE_TABLE_INIT("posn");
+
+const const_posn_t ORIGIN = (const_posn_t) HANDLE_RESERVED(1);
+
+static struct posn* deref(posn_t p, const char* op)
+{
+    return ht_resolve(&posn_table, (uintptr_t) p, op);
+}
+
+static const struct posn* cderef(const_posn_t p, const char* op)
+{
+    if (p == ORIGIN) return &origin_object;
+    return ht_resolve(&posn_table, (uintptr_t) p, op);
+}
+#else
 const const_posn_t ORIGIN = &origin_object;
 
+#   define deref(p, op)   (p)
+#   define cderef(p, op)  (p)
+#endif // CHECKED_HANDLES
+
 posn_t posn_create(double x, double y)
 {
-    posn_t result = malloc(sizeof *result);
+    posn_t result = alloc_posn();
     if (result) {
         result->x = x;
         result->y = y;
     }
+
+#ifdef CHECKED_HANDLES
+    if (result) {
+        uintptr_t h = ht_insert(&posn_table, result);
+        if (!h) free_posn(result);
+        result = (posn_t) h;
+    }
+#endif
+
     return result;
 }
 
 void posn_destroy(posn_t p)
 {
-    free(p);
+#ifdef CHECKED_HANDLES
+    p = ht_remove(&posn_table, (uintptr_t) p, "posn_destroy");
+#endif
+
+    free_posn(p);
 }
 
 double posn_x(const_posn_t p)
 {
-    return p->x;
+    return cderef(p, "posn_x")->x;
 }
 
 double posn_y(const_posn_t p)
 {
-    return p->y;
+    return cderef(p, "posn_y")->y;
 }
 
 void posn_set_x(posn_t p, double nx)
 {
-    p->x = nx;
+    deref(p, "posn_set_x")->x = nx;
+}
+
+void posn_set(posn_t p, double nx, double ny)
+{
+    struct posn* q = deref(p, "posn_set");
+    q->x = nx;
+    q->y = ny;
 }
 
 posn_t posn_clone(const_posn_t p)
 {
-    return posn_create(p->x, p->y);
+    const struct posn* q = cderef(p, "posn_clone");
+    return posn_create(q->x, q->y);
 }
 
 void posn_assign(posn_t dst, const_posn_t src)
 {
-    dst->x = src->x;
-    dst->y = src->y;
+    const struct posn* s = cderef(src, "posn_assign");
+    struct posn* d = deref(dst, "posn_assign");
+    d->x = s->x;
+    d->y = s->y;
 }
 
 double* posn_borrow_y(posn_t p)
 {
-    return &p->y;
+    return &deref(p, "posn_borrow_y")->y;
 }
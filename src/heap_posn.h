@@ -66,6 +66,18 @@ double posn_y(const_posn_t);
 //  - posn_x(p) == nx
 void posn_set_x(posn_t p, double nx);
 
+// Sets both coordinates of `*p` in place. Borrows `*p` transiently.
+// Unlike replacing `p` with a fresh `posn_create(nx, ny)`, this never
+// allocates.
+//
+// PRECONDITIONS:
+//  - p != NULL      (UB otherwise)
+//
+// POSTCONDITIONS:
+//  - posn_x(p) == nx
+//  - posn_y(p) == ny
+void posn_set(posn_t p, double nx, double ny);
+
 
 // Clones `p`; that is, returns ownership of a copy of `*p` to the
 // caller. Borrows `*p` transiently
@@ -0,0 +1,482 @@
+#include "int_hash.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#   define HAVE_X86_SIMD
+#   include <immintrin.h>
+#endif
+
+// Slots per group, and the fewest slots in a table.
+#define GROUP_SIZE     16
+#define MIN_CAPACITY   GROUP_SIZE
+
+// Control bytes: a full slot's holds the low 7 bits of its key's hash.
+#define CTRL_EMPTY     ((int8_t) -128)
+#define CTRL_DELETED   ((int8_t) -2)
+
+// What `table_find` returns for a missing key.
+#define NOT_FOUND      SIZE_MAX
+
+// The table behind both sets and maps. `vals` is NULL for a set.
+struct table
+{
+    size_t    capacity;
+    size_t    size;
+    // Empty slots that can still be filled before the table is more
+    // than 7/8 full (counting deleted slots as full).
+    size_t    growth_left;
+    int8_t*   ctrl;
+    int*      keys;
+    int*      vals;
+};
+
+struct int_set
+{
+    struct table  t;
+};
+
+struct int_map
+{
+    struct table  t;
+};
+
+
+//
+// Forward declarations
+//
+
+// Initializes an empty table with `capacity` slots (a power of 2 at
+// least MIN_CAPACITY), with values if `with_vals`. Returns false on
+// allocation error.
+static bool table_init(struct table*, size_t capacity, bool with_vals);
+
+// Frees a table's arrays.
+static void table_free(struct table*);
+
+// The smallest capacity that holds `n` keys without growing.
+static size_t capacity_for(size_t n);
+
+// Returns the slot holding `key`, or NOT_FOUND.
+static size_t table_find(const struct table*, int key);
+
+// Finds the slot holding `key`, or fills a slot with it, storing the
+// slot in `*slot` and whether it's new in `*added`. Returns false on
+// allocation error.
+static bool table_insert(struct table*, int key, size_t* slot, bool* added);
+
+// Removes `key`, returning whether it was there.
+static bool table_remove(struct table*, int key);
+
+// Moves the keys into a table with `capacity` slots. Returns false on
+// allocation error, leaving the table as it was.
+static bool table_rehash(struct table*, size_t capacity);
+
+// Builds a list of the keys, or of the values if `vals`, in slot order.
+static list_t table_to_list(const struct table*, bool vals);
+
+
+//
+// Sets
+//
+
+int_set_t iset_create(void)
+{
+    int_set_t s = malloc(sizeof *s);
+    if (!s) return NULL;
+
+    if (!table_init(&s->t, MIN_CAPACITY, false)) {
+        free(s);
+        return NULL;
+    }
+
+    return s;
+}
+
+int_set_t iset_from_list(list_t lst)
+{
+    size_t n = 0;
+    for (list_t p = lst; is_cons(p); p = rest(p)) ++n;
+
+    int_set_t s = malloc(sizeof *s);
+    if (!s) return NULL;
+
+    if (!table_init(&s->t, capacity_for(n), false)) {
+        free(s);
+        return NULL;
+    }
+
+    for (; is_cons(lst); lst = rest(lst)) {
+        size_t slot;
+        bool added;
+        if (!table_insert(&s->t, first(lst), &slot, &added)) {
+            iset_destroy(s);
+            return NULL;
+        }
+    }
+
+    return s;
+}
+
+void iset_destroy(int_set_t s)
+{
+    if (!s) return;
+
+    table_free(&s->t);
+    free(s);
+}
+
+size_t iset_size(c_int_set_t s)
+{
+    return s->t.size;
+}
+
+bool iset_contains(c_int_set_t s, int key)
+{
+    return table_find(&s->t, key) != NOT_FOUND;
+}
+
+bool iset_add(int_set_t s, int key)
+{
+    size_t slot;
+    bool added;
+    return table_insert(&s->t, key, &slot, &added);
+}
+
+bool iset_remove(int_set_t s, int key)
+{
+    return table_remove(&s->t, key);
+}
+
+void iset_for_each(c_int_set_t s, void (*f)(int, void*), void* env)
+{
+    for (size_t i = 0; i < s->t.capacity; ++i)
+        if (s->t.ctrl[i] >= 0) f(s->t.keys[i], env);
+}
+
+list_t iset_to_list(c_int_set_t s)
+{
+    return table_to_list(&s->t, false);
+}
+
+
+//
+// Maps
+//
+
+int_map_t imap_create(void)
+{
+    int_map_t m = malloc(sizeof *m);
+    if (!m) return NULL;
+
+    if (!table_init(&m->t, MIN_CAPACITY, true)) {
+        free(m);
+        return NULL;
+    }
+
+    return m;
+}
+
+int_map_t imap_from_lists(list_t keys, list_t values)
+{
+    size_t n = 0;
+    for (list_t k = keys, v = values; is_cons(k) && is_cons(v);
+            k = rest(k), v = rest(v))
+        ++n;
+
+    int_map_t m = malloc(sizeof *m);
+    if (!m) return NULL;
+
+    if (!table_init(&m->t, capacity_for(n), true)) {
+        free(m);
+        return NULL;
+    }
+
+    for (; is_cons(keys) && is_cons(values);
+            keys = rest(keys), values = rest(values)) {
+        size_t slot;
+        bool added;
+        if (!table_insert(&m->t, first(keys), &slot, &added)) {
+            imap_destroy(m);
+            return NULL;
+        }
+
+        if (added) m->t.vals[slot] = first(values);
+    }
+
+    return m;
+}
+
+void imap_destroy(int_map_t m)
+{
+    if (!m) return;
+
+    table_free(&m->t);
+    free(m);
+}
+
+size_t imap_size(c_int_map_t m)
+{
+    return m->t.size;
+}
+
+bool imap_get(c_int_map_t m, int key, int* value)
+{
+    size_t slot = table_find(&m->t, key);
+    if (slot == NOT_FOUND) return false;
+
+    if (value) *value = m->t.vals[slot];
+    return true;
+}
+
+bool imap_put(int_map_t m, int key, int value)
+{
+    size_t slot;
+    bool added;
+    if (!table_insert(&m->t, key, &slot, &added)) return false;
+
+    m->t.vals[slot] = value;
+    return true;
+}
+
+bool imap_remove(int_map_t m, int key)
+{
+    return table_remove(&m->t, key);
+}
+
+void imap_for_each(c_int_map_t m, void (*f)(int, int, void*), void* env)
+{
+    for (size_t i = 0; i < m->t.capacity; ++i)
+        if (m->t.ctrl[i] >= 0) f(m->t.keys[i], m->t.vals[i], env);
+}
+
+void imap_to_lists(c_int_map_t m, list_t* keys, list_t* values)
+{
+    *keys   = table_to_list(&m->t, false);
+    *values = table_to_list(&m->t, true);
+}
+
+
+//
+// Groups
+//
+
+// Returns a mask with bit `i` set where `group[i] == byte`.
+static inline unsigned match_byte(const int8_t* group, int8_t byte)
+{
+#ifdef HAVE_X86_SIMD
+    __m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+    return (unsigned) _mm_movemask_epi8(
+            _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < GROUP_SIZE; ++i)
+        mask |= (unsigned) (group[i] == byte) << i;
+    return mask;
+#endif // HAVE_X86_SIMD
+}
+
+// Returns a mask with bit `i` set where `group[i]` is empty or deleted.
+static inline unsigned match_free(const int8_t* group)
+{
+#ifdef HAVE_X86_SIMD
+    // Exactly the free slots have their high bit set.
+    __m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+    return (unsigned) _mm_movemask_epi8(ctrl);
+#else
+    unsigned mask = 0;
+    for (int i = 0; i < GROUP_SIZE; ++i)
+        mask |= (unsigned) (group[i] < 0) << i;
+    return mask;
+#endif // HAVE_X86_SIMD
+}
+
+// Mixes all the bits of `key` into all the bits of the result
+// (MurmurHash3's finalizer).
+static inline uint64_t hash_key(int key)
+{
+    uint64_t h = (uint32_t) key;
+    h ^= h >> 33;
+    h *= UINT64_C(0xff51afd7ed558ccd);
+    h ^= h >> 33;
+    h *= UINT64_C(0xc4ceb9fe1a85ec53);
+    h ^= h >> 33;
+    return h;
+}
+
+// A key's control byte, and the first group it probes.
+static inline int8_t hash_ctrl(uint64_t h)
+{
+    return (int8_t) (h & 0x7F);
+}
+
+static inline size_t hash_group(uint64_t h, size_t groups)
+{
+    return (size_t) (h >> 7) & (groups - 1);
+}
+
+
+//
+// Tables
+//
+
+static bool table_init(struct table* t, size_t capacity, bool with_vals)
+{
+    t->capacity    = capacity;
+    t->size        = 0;
+    t->growth_left = capacity - capacity / 8;
+    t->ctrl        = malloc(capacity);
+    t->keys        = malloc(capacity * sizeof *t->keys);
+    t->vals        = with_vals ? malloc(capacity * sizeof *t->vals) : NULL;
+
+    if (!t->ctrl || !t->keys || (with_vals && !t->vals)) {
+        table_free(t);
+        return false;
+    }
+
+    memset(t->ctrl, CTRL_EMPTY, capacity);
+    return true;
+}
+
+static void table_free(struct table* t)
+{
+    free(t->ctrl);
+    free(t->keys);
+    free(t->vals);
+}
+
+static size_t capacity_for(size_t n)
+{
+    size_t capacity = MIN_CAPACITY;
+    while (capacity - capacity / 8 < n) capacity *= 2;
+    return capacity;
+}
+
+static size_t table_find(const struct table* t, int key)
+{
+    uint64_t h      = hash_key(key);
+    int8_t   ctrl   = hash_ctrl(h);
+    size_t   groups = t->capacity / GROUP_SIZE;
+    size_t   g      = hash_group(h, groups);
+
+    // Probing by 1, 2, 3, ... groups visits every group, and the table
+    // always has an empty slot, so this ends.
+    for (size_t step = 1; ; ++step) {
+        const int8_t* group = t->ctrl + g * GROUP_SIZE;
+
+        for (unsigned m = match_byte(group, ctrl); m; m &= m - 1) {
+            size_t slot = g * GROUP_SIZE + (size_t) __builtin_ctz(m);
+            if (t->keys[slot] == key) return slot;
+        }
+
+        if (match_byte(group, CTRL_EMPTY)) return NOT_FOUND;
+
+        g = (g + step) & (groups - 1);
+    }
+}
+
+static bool table_insert(struct table* t, int key, size_t* slot, bool* added)
+{
+    *slot = table_find(t, key);
+    *added = *slot == NOT_FOUND;
+    if (!*added) return true;
+
+    uint64_t h      = hash_key(key);
+    size_t   groups = t->capacity / GROUP_SIZE;
+    size_t   g      = hash_group(h, groups);
+
+    for (size_t step = 1; ; ++step) {
+        unsigned m = match_free(t->ctrl + g * GROUP_SIZE);
+        if (m) {
+            *slot = g * GROUP_SIZE + (size_t) __builtin_ctz(m);
+            break;
+        }
+
+        g = (g + step) & (groups - 1);
+    }
+
+    if (t->ctrl[*slot] == CTRL_EMPTY) {
+        if (!t->growth_left) {
+            // Grow if the table is mostly live keys; otherwise just
+            // clear out the deleted slots.
+            size_t capacity = t->size >= t->capacity / 2
+                ? 2 * t->capacity
+                : t->capacity;
+            if (!table_rehash(t, capacity)) return false;
+            return table_insert(t, key, slot, added);
+        }
+
+        --t->growth_left;
+    }
+
+    t->ctrl[*slot] = hash_ctrl(h);
+    t->keys[*slot] = key;
+    ++t->size;
+    return true;
+}
+
+static bool table_remove(struct table* t, int key)
+{
+    size_t slot = table_find(t, key);
+    if (slot == NOT_FOUND) return false;
+
+    // If the group has an empty slot then no probe has ever gone past
+    // it, so this slot can be empty again; otherwise a probe for some
+    // other key may need to go on past it.
+    const int8_t* group = t->ctrl + slot / GROUP_SIZE * GROUP_SIZE;
+    if (match_byte(group, CTRL_EMPTY)) {
+        t->ctrl[slot] = CTRL_EMPTY;
+        ++t->growth_left;
+    } else {
+        t->ctrl[slot] = CTRL_DELETED;
+    }
+
+    --t->size;
+    return true;
+}
+
+static bool table_rehash(struct table* t, size_t capacity)
+{
+    struct table new;
+    if (!table_init(&new, capacity, t->vals != NULL)) return false;
+
+    size_t groups = capacity / GROUP_SIZE;
+
+    for (size_t i = 0; i < t->capacity; ++i) {
+        if (t->ctrl[i] < 0) continue;
+
+        // The keys are distinct, so each can go in the first free slot.
+        uint64_t h = hash_key(t->keys[i]);
+        size_t   g = hash_group(h, groups);
+        unsigned m;
+
+        for (size_t step = 1; !(m = match_free(new.ctrl + g * GROUP_SIZE));
+                ++step)
+            g = (g + step) & (groups - 1);
+
+        size_t slot = g * GROUP_SIZE + (size_t) __builtin_ctz(m);
+        new.ctrl[slot] = hash_ctrl(h);
+        new.keys[slot] = t->keys[i];
+        if (new.vals) new.vals[slot] = t->vals[i];
+    }
+
+    new.size = t->size;
+    new.growth_left -= t->size;
+
+    table_free(t);
+    *t = new;
+    return true;
+}
+
+static list_t table_to_list(const struct table* t, bool vals)
+{
+    const int* from = vals ? t->vals : t->keys;
+    list_t result = empty;
+
+    for (size_t i = t->capacity; i-- > 0; )
+        if (t->ctrl[i] >= 0) result = cons(from[i], result);
+
+    return result;
+}
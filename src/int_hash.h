@@ -0,0 +1,106 @@
+// Hash sets of `int`s and hash maps from `int`s to `int`s.
+
+#pragma once
+
+#include "cons.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Where a `list_t` serves as a set (or, with a second list, as an
+ * association list), looking up an element means scanning the list.
+ * These tables look elements up in expected constant time instead.
+ *
+ * Both are open-addressing tables in the style of Swiss tables: slots
+ * come in groups of 16, each slot with a control byte holding 7 bits of
+ * its key's hash (or marking it empty or deleted). A lookup compares
+ * all 16 control bytes of a group against the hash at once (with SSE2
+ * where available) and only checks the keys that match, so it rarely
+ * touches more than one key. Tables grow to stay at most 7/8 full.
+ *
+ * Iteration order is unspecified, and changes as a table grows.
+ */
+
+typedef        struct int_set*    int_set_t;
+typedef  const struct int_set*  c_int_set_t;
+
+typedef        struct int_map*    int_map_t;
+typedef  const struct int_map*  c_int_map_t;
+
+
+//
+// Sets
+//
+
+// Returns a new, empty set, or NULL on allocation error.
+int_set_t iset_create(void);
+
+// Returns a new set of the elements of `lst` (which it borrows), or
+// NULL on allocation error.
+int_set_t iset_from_list(list_t lst);
+
+// Deallocates a set. Allows NULL.
+void iset_destroy(int_set_t);
+
+// The number of elements.
+size_t iset_size(c_int_set_t);
+
+// Is `key` an element?
+bool iset_contains(c_int_set_t, int key);
+
+// Adds `key` if it isn't already an element. Returns false (and does
+// nothing) on allocation error.
+bool iset_add(int_set_t, int key);
+
+// Removes `key`, returning whether it was an element.
+bool iset_remove(int_set_t, int key);
+
+// Calls `f(key, env)` for each element.
+void iset_for_each(c_int_set_t, void (*f)(int, void*), void* env);
+
+// Returns a new list of the elements, which the caller owns.
+//
+// ERRORS: exits if memory cannot be allocated.
+list_t iset_to_list(c_int_set_t);
+
+
+//
+// Maps
+//
+
+// Returns a new, empty map, or NULL on allocation error.
+int_map_t imap_create(void);
+
+// Returns a new map from each element of `keys` to the element of
+// `values` in the same position (ignoring any elements past the end of
+// the shorter list), or NULL on allocation error. Borrows both lists.
+// As with looking up a key by scanning `keys`, the first occurrence of
+// a key is the one that counts.
+int_map_t imap_from_lists(list_t keys, list_t values);
+
+// Deallocates a map. Allows NULL.
+void imap_destroy(int_map_t);
+
+// The number of keys.
+size_t imap_size(c_int_map_t);
+
+// Looks up `key`. If it's there, stores its value in `*value` (unless
+// `value` is NULL) and returns true; otherwise returns false.
+bool imap_get(c_int_map_t, int key, int* value);
+
+// Maps `key` to `value`, replacing any value it had. Returns false
+// (and does nothing) on allocation error.
+bool imap_put(int_map_t, int key, int value);
+
+// Removes `key`, returning whether it was there.
+bool imap_remove(int_map_t, int key);
+
+// Calls `f(key, value, env)` for each key.
+void imap_for_each(c_int_map_t, void (*f)(int, int, void*), void* env);
+
+// Stores new lists of the keys and of their values, in corresponding
+// order, in `*keys` and `*values`. The caller owns both.
+//
+// ERRORS: exits if memory cannot be allocated.
+void imap_to_lists(c_int_map_t, list_t* keys, list_t* values);
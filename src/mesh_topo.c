@@ -0,0 +1,493 @@
+#include "mesh_topo.h"
+#include "parallel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Don't split loops over triangles or edge slots finer than this.
+#define MIN_CHUNK      16384
+// Initial sizes of the growable arrays.
+#define INITIAL_VERTS  1024
+#define INITIAL_TRIS   1024
+// Largest triangle or vertex count, so that MT_NONE is never a number.
+#define MAX_COUNT      ((size_t) UINT32_MAX - 1)
+
+// An edge-table slot: 16 bytes, so four share a cache line and a probe
+// sequence usually stays within one. `key` packs the edge's vertex
+// numbers, smaller first, so it's never 0 for a real edge (0 means the
+// slot is empty). `tris` are the first two triangles found on it;
+// `tris[1]` becomes `NONMANIFOLD` if a third turns up.
+struct edge_slot
+{
+    uint64_t  key;
+    uint32_t  tris[2];
+};
+
+#define NONMANIFOLD  (UINT32_MAX - 1)
+
+struct mesh_topo
+{
+    // Welded vertices, and an open-addressing table of `vertex + 1`
+    // (0 for empty) hashed by coordinates.
+    size_t             n_verts, vert_cap;
+    double*            vxs;
+    double*            vys;
+    uint32_t*          vert_slots;
+    size_t             vert_mask;
+
+    // Three vertex numbers per triangle.
+    size_t             n_tris, tri_cap;
+    uint32_t*          tri_verts;
+
+    // Filled in by `mt_build()`.
+    struct edge_slot*  edges;
+    size_t             edge_mask;
+    uint32_t*          neighbors;     // three per triangle
+    uint32_t*          components;    // union-find parents, then labels
+    size_t             n_edges, n_boundary, n_nonmanifold, n_components;
+};
+
+
+//
+// Hashing
+//
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= UINT64_C(0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x *= UINT64_C(0x94d049bb133111eb);
+    x ^= x >> 31;
+    return x;
+}
+
+// The bits of `d`, with -0.0 treated as 0.0 so the two weld together.
+static uint64_t coord_bits(double d)
+{
+    if (d == 0) d = 0;
+
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof bits);
+    return bits;
+}
+
+static uint64_t hash_coords(double x, double y)
+{
+    return mix64(coord_bits(x) ^ mix64(coord_bits(y)));
+}
+
+static uint64_t edge_key(uint32_t a, uint32_t b)
+{
+    return a < b ? (uint64_t) a << 32 | b : (uint64_t) b << 32 | a;
+}
+
+
+//
+// Building up
+//
+
+mesh_topo_t mt_create(void)
+{
+    mesh_topo_t m = calloc(1, sizeof *m);
+    if (!m) return NULL;
+
+    m->vert_cap   = INITIAL_VERTS;
+    m->vxs        = malloc(m->vert_cap * sizeof(double));
+    m->vys        = malloc(m->vert_cap * sizeof(double));
+    m->vert_slots = calloc(2 * m->vert_cap, sizeof(uint32_t));
+    m->vert_mask  = 2 * m->vert_cap - 1;
+
+    m->tri_cap    = INITIAL_TRIS;
+    m->tri_verts  = malloc(3 * m->tri_cap * sizeof(uint32_t));
+
+    if (!m->vxs || !m->vys || !m->vert_slots || !m->tri_verts) {
+        mt_destroy(m);
+        return NULL;
+    }
+
+    return m;
+}
+
+void mt_destroy(mesh_topo_t m)
+{
+    if (!m) return;
+
+    free(m->vxs);
+    free(m->vys);
+    free(m->vert_slots);
+    free(m->tri_verts);
+    free(m->edges);
+    free(m->neighbors);
+    free(m->components);
+    free(m);
+}
+
+// Doubles the vertex capacity, rehashing the vertex table to keep it
+// at most half full. Returns false on allocation error.
+static bool grow_vertices(mesh_topo_t m)
+{
+    size_t cap = 2 * m->vert_cap;
+
+    double* xs = realloc(m->vxs, cap * sizeof(double));
+    if (!xs) return false;
+    m->vxs = xs;
+
+    double* ys = realloc(m->vys, cap * sizeof(double));
+    if (!ys) return false;
+    m->vys = ys;
+
+    uint32_t* slots = calloc(2 * cap, sizeof(uint32_t));
+    if (!slots) return false;
+
+    size_t mask = 2 * cap - 1;
+    for (size_t v = 0; v < m->n_verts; ++v) {
+        size_t i = hash_coords(m->vxs[v], m->vys[v]) & mask;
+        while (slots[i]) i = (i + 1) & mask;
+        slots[i] = (uint32_t) v + 1;
+    }
+
+    free(m->vert_slots);
+    m->vert_slots = slots;
+    m->vert_mask  = mask;
+    m->vert_cap   = cap;
+    return true;
+}
+
+// Returns the number of the vertex at (x, y), adding it if it's new.
+// Returns MT_NONE on allocation error or if there are too many.
+static uint32_t weld_vertex(mesh_topo_t m, double x, double y)
+{
+    size_t i = hash_coords(x, y) & m->vert_mask;
+
+    for (; m->vert_slots[i]; i = (i + 1) & m->vert_mask) {
+        uint32_t v = m->vert_slots[i] - 1;
+        if (m->vxs[v] == x && m->vys[v] == y) return v;
+    }
+
+    if (m->n_verts == MAX_COUNT) return MT_NONE;
+
+    if (m->n_verts == m->vert_cap) {
+        if (!grow_vertices(m)) return MT_NONE;
+        return weld_vertex(m, x, y);
+    }
+
+    uint32_t v = (uint32_t) m->n_verts++;
+    m->vxs[v] = x;
+    m->vys[v] = y;
+    m->vert_slots[i] = v + 1;
+    return v;
+}
+
+bool mt_add_batch(mesh_topo_t m, c_tri_batch_t batch)
+{
+    size_t n = tb_count(batch);
+    if (n > MAX_COUNT - m->n_tris) return false;
+
+    if (m->n_tris + n > m->tri_cap) {
+        size_t cap = m->tri_cap;
+        while (cap < m->n_tris + n) cap *= 2;
+
+        uint32_t* bigger = realloc(m->tri_verts, 3 * cap * sizeof(uint32_t));
+        if (!bigger) return false;
+
+        m->tri_verts = bigger;
+        m->tri_cap   = cap;
+    }
+
+    const double* xs = tb_const_xs(batch);
+    const double* ys = tb_const_ys(batch);
+    uint32_t* out    = m->tri_verts + 3 * m->n_tris;
+
+    for (size_t i = 0; i < 3 * n; ++i) {
+        // NaN never equals itself, so such vertices never weld; that's
+        // as good an answer as any.
+        out[i] = weld_vertex(m, xs[i], ys[i]);
+        if (out[i] == MT_NONE) return false;
+    }
+
+    m->n_tris += n;
+    return true;
+}
+
+
+//
+// Building the topology
+//
+
+// Finds (or claims) the slot for `key`. Safe to call concurrently.
+static struct edge_slot* find_edge(mesh_topo_t m, uint64_t key)
+{
+    size_t i = mix64(key) & m->edge_mask;
+
+    for (;; i = (i + 1) & m->edge_mask) {
+        struct edge_slot* slot = &m->edges[i];
+        uint64_t cur = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+
+        if (cur == key) return slot;
+
+        if (!cur) {
+            if (__atomic_compare_exchange_n(&slot->key, &cur, key, false,
+                                            __ATOMIC_ACQ_REL,
+                                            __ATOMIC_ACQUIRE)
+                    || cur == key)
+                return slot;
+        }
+    }
+}
+
+// Records that triangle `t` is on the edge in `slot`. A triangle whose
+// vertices weld to (a, b, a) comes here twice for edge {a, b}; the
+// second time changes nothing, so that it isn't its own neighbor. (Only
+// the thread handling `t` adds `t`, so that check can't race.)
+static void add_edge_tri(struct edge_slot* slot, uint32_t t)
+{
+    for (int i = 0; i < 2; ++i) {
+        uint32_t expected = MT_NONE;
+        if (__atomic_compare_exchange_n(&slot->tris[i], &expected, t, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+                || expected == t)
+            return;
+    }
+
+    __atomic_store_n(&slot->tris[1], NONMANIFOLD, __ATOMIC_RELAXED);
+}
+
+static void insert_edges(size_t begin, size_t end, void* env)
+{
+    mesh_topo_t m = env;
+
+    for (size_t t = begin; t < end; ++t) {
+        const uint32_t* v = m->tri_verts + 3 * t;
+
+        for (int e = 0; e < 3; ++e) {
+            uint32_t a = v[e], b = v[(e + 1) % 3];
+            // A degenerate triangle's collapsed edge isn't an edge.
+            if (a != b) add_edge_tri(find_edge(m, edge_key(a, b)),
+                                     (uint32_t) t);
+        }
+    }
+}
+
+static void clear_edges(size_t begin, size_t end, void* env)
+{
+    mesh_topo_t m = env;
+
+    for (size_t i = begin; i < end; ++i) {
+        m->edges[i].key     = 0;
+        m->edges[i].tris[0] = MT_NONE;
+        m->edges[i].tris[1] = MT_NONE;
+    }
+}
+
+// Union-find over triangles, safe to use concurrently: a root is only
+// ever linked below a smaller root, by compare-and-swap, so every
+// component ends up rooted at its first triangle.
+static uint32_t find_root(uint32_t* parent, uint32_t x)
+{
+    for (;;) {
+        uint32_t p = __atomic_load_n(&parent[x], __ATOMIC_RELAXED);
+        if (p == x) return x;
+
+        // Path halving: any ancestor is a fine parent.
+        uint32_t gp = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+        if (gp != p)
+            __atomic_compare_exchange_n(&parent[x], &p, gp, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        x = gp;
+    }
+}
+
+static void unite(uint32_t* parent, uint32_t a, uint32_t b)
+{
+    for (;;) {
+        a = find_root(parent, a);
+        b = find_root(parent, b);
+        if (a == b) return;
+
+        if (a < b) {
+            uint32_t tmp = a;
+            a = b;
+            b = tmp;
+        }
+
+        uint32_t expected = a;
+        if (__atomic_compare_exchange_n(&parent[a], &expected, b, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return;
+    }
+}
+
+static void init_components(size_t begin, size_t end, void* env)
+{
+    mesh_topo_t m = env;
+    for (size_t t = begin; t < end; ++t) m->components[t] = (uint32_t) t;
+}
+
+// Fills in neighbors from the edge table and unites triangles that
+// share edges.
+static void link_neighbors(size_t begin, size_t end, void* env)
+{
+    mesh_topo_t m = env;
+
+    for (size_t t = begin; t < end; ++t) {
+        const uint32_t* v = m->tri_verts + 3 * t;
+
+        for (int e = 0; e < 3; ++e) {
+            uint32_t a = v[e], b = v[(e + 1) % 3];
+            uint32_t neighbor = MT_NONE;
+
+            if (a != b) {
+                const struct edge_slot* slot = find_edge(m, edge_key(a, b));
+                uint32_t t0 = slot->tris[0], t1 = slot->tris[1];
+
+                if (t1 == NONMANIFOLD) {
+                    // Everyone on the edge joins its first triangle.
+                    unite(m->components, (uint32_t) t, t0);
+                } else if (t1 != MT_NONE) {
+                    neighbor = t0 == t ? t1 : t0;
+                    unite(m->components, t0, t1);
+                }
+            }
+
+            m->neighbors[3 * t + e] = neighbor;
+        }
+    }
+}
+
+static void find_roots(size_t begin, size_t end, void* env)
+{
+    mesh_topo_t m = env;
+    for (size_t t = begin; t < end; ++t)
+        m->components[t] = find_root(m->components, (uint32_t) t);
+}
+
+static void count_edges(size_t begin, size_t end, void* env)
+{
+    mesh_topo_t m = env;
+    size_t edges = 0, boundary = 0, nonmanifold = 0;
+
+    for (size_t i = begin; i < end; ++i) {
+        const struct edge_slot* slot = &m->edges[i];
+        if (!slot->key) continue;
+
+        ++edges;
+        if (slot->tris[1] == MT_NONE) ++boundary;
+        else if (slot->tris[1] == NONMANIFOLD) ++nonmanifold;
+    }
+
+    __atomic_add_fetch(&m->n_edges, edges, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m->n_boundary, boundary, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m->n_nonmanifold, nonmanifold, __ATOMIC_RELAXED);
+}
+
+bool mt_build(mesh_topo_t m, int threads)
+{
+    size_t n = m->n_tris;
+
+    // Room for every edge to be distinct at a load factor of 3/4.
+    size_t cap = 16;
+    while (cap < 4 * n) cap *= 2;
+
+    m->edges      = malloc(cap * sizeof(struct edge_slot));
+    m->neighbors  = malloc((3 * n + 1) * sizeof(uint32_t));
+    m->components = malloc((n + 1) * sizeof(uint32_t));
+    if (!m->edges || !m->neighbors || !m->components) return false;
+
+    m->edge_mask = cap - 1;
+
+    parallel_for(cap, threads, MIN_CHUNK, clear_edges, m);
+    parallel_for(n, threads, MIN_CHUNK, insert_edges, m);
+    parallel_for(n, threads, MIN_CHUNK, init_components, m);
+    parallel_for(n, threads, MIN_CHUNK, link_neighbors, m);
+    parallel_for(n, threads, MIN_CHUNK, find_roots, m);
+    parallel_for(cap, threads, MIN_CHUNK, count_edges, m);
+
+    // Number the components in order of their roots, which are their
+    // first triangles; each root comes before the rest of its
+    // component, so its label is ready by the time they need it.
+    m->n_components = 0;
+    for (size_t t = 0; t < n; ++t) {
+        uint32_t root = m->components[t];
+        m->components[t] = root == t ? (uint32_t) m->n_components++
+                                     : m->components[root];
+    }
+
+    return true;
+}
+
+
+//
+// Queries
+//
+
+size_t mt_triangle_count(c_mesh_topo_t m)
+{
+    return m->n_tris;
+}
+
+size_t mt_vertex_count(c_mesh_topo_t m)
+{
+    return m->n_verts;
+}
+
+size_t mt_edge_count(c_mesh_topo_t m)
+{
+    return m->n_edges;
+}
+
+size_t mt_boundary_edge_count(c_mesh_topo_t m)
+{
+    return m->n_boundary;
+}
+
+size_t mt_nonmanifold_edge_count(c_mesh_topo_t m)
+{
+    return m->n_nonmanifold;
+}
+
+size_t mt_component_count(c_mesh_topo_t m)
+{
+    return m->n_components;
+}
+
+uint32_t mt_vertex(c_mesh_topo_t m, size_t t, int v)
+{
+    return m->tri_verts[3 * t + v];
+}
+
+void mt_vertex_coords(c_mesh_topo_t m, uint32_t vertex, double* x, double* y)
+{
+    *x = m->vxs[vertex];
+    *y = m->vys[vertex];
+}
+
+uint32_t mt_neighbor(c_mesh_topo_t m, size_t t, int e)
+{
+    return m->neighbors[3 * t + e];
+}
+
+uint32_t mt_component(c_mesh_topo_t m, size_t t)
+{
+    return m->components[t];
+}
+
+void mt_for_each_boundary_edge(c_mesh_topo_t m, mt_edge_fn* fn, void* env)
+{
+    for (size_t i = 0; i <= m->edge_mask; ++i) {
+        const struct edge_slot* slot = &m->edges[i];
+        if (!slot->key || slot->tris[1] != MT_NONE) continue;
+
+        uint32_t t = slot->tris[0];
+        const uint32_t* v = m->tri_verts + 3 * t;
+
+        // Report the edge in the direction its triangle has it.
+        for (int e = 0; e < 3; ++e) {
+            uint32_t a = v[e], b = v[(e + 1) % 3];
+            if (a != b && edge_key(a, b) == slot->key) {
+                fn(a, b, t, env);
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,94 @@
+// Mesh topology of triangle streams: shared vertices, adjacency,
+// boundaries and connected components.
+
+#pragma once
+
+#include "tri_batch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A topology builder accepts triangles a batch at a time, welding
+ * vertices with identical coordinates into one as it goes, so each
+ * triangle becomes three vertex numbers. Then `mt_build()` finds every
+ * edge (an unordered pair of vertices) and the triangles on it, and
+ * from those each triangle's neighbors and the connected components of
+ * the mesh, where triangles sharing an edge are connected.
+ *
+ * Triangles, vertices and components are numbered from 0 in the order
+ * they first appear. Edge `e` (0-2) of a triangle runs from its vertex
+ * `e` to its vertex `(e + 1) % 3`.
+ *
+ * An edge with one triangle is a boundary edge; one with more than two
+ * is non-manifold, and its triangles have no neighbor across it (but
+ * are still connected).
+ *
+ * A degenerate triangle has no edge where two of its vertices weld
+ * together, and is on each of its other edges once: one whose vertices
+ * weld to (a, b, a) is on edge {a, b} once, though two of its edges
+ * run along it.
+ */
+
+typedef        struct mesh_topo*    mesh_topo_t;
+typedef  const struct mesh_topo*  c_mesh_topo_t;
+
+// "No such triangle," for a neighbor across a boundary or non-manifold
+// edge.
+#define MT_NONE  UINT32_MAX
+
+// Called with each boundary edge, from vertex `v0` to `v1`, and the
+// triangle `t` it belongs to.
+typedef void mt_edge_fn(uint32_t v0, uint32_t v1, uint32_t t, void* env);
+
+
+// Returns a new, empty topology builder. Returns NULL on allocation
+// error.
+mesh_topo_t mt_create(void);
+
+// Deallocates a topology builder. Allows NULL.
+void mt_destroy(mesh_topo_t);
+
+// Adds all the triangles of `batch` (which it borrows). Returns false
+// on allocation error, or once there are 2^32 - 1 triangles or
+// vertices.
+//
+// PRECONDITION: `mt_build()` hasn't been called yet.
+bool mt_add_batch(mesh_topo_t, c_tri_batch_t batch);
+
+// Computes edges, neighbors and components for the triangles added so
+// far, using up to `threads` threads. Call at most once. Returns false
+// on allocation error.
+bool mt_build(mesh_topo_t, int threads);
+
+// Counts of triangles and (welded) vertices added so far.
+size_t mt_triangle_count(c_mesh_topo_t), mt_vertex_count(c_mesh_topo_t);
+
+// After `mt_build()`: counts of edges, boundary edges, non-manifold
+// edges and connected components.
+size_t mt_edge_count(c_mesh_topo_t),
+       mt_boundary_edge_count(c_mesh_topo_t),
+       mt_nonmanifold_edge_count(c_mesh_topo_t),
+       mt_component_count(c_mesh_topo_t);
+
+// Returns the number of vertex `v` (0-2) of triangle `t`.
+//
+// PRECONDITION: t < mt_triangle_count(m)      (UB otherwise)
+uint32_t mt_vertex(c_mesh_topo_t, size_t t, int v);
+
+// Stores the coordinates of vertex number `vertex` in `*x` and `*y`.
+//
+// PRECONDITION: vertex < mt_vertex_count(m)   (UB otherwise)
+void mt_vertex_coords(c_mesh_topo_t, uint32_t vertex, double* x, double* y);
+
+// After `mt_build()`: returns the triangle across edge `e` (0-2) of
+// triangle `t`, or `MT_NONE`; and the component that `t` belongs to.
+//
+// PRECONDITION: t < mt_triangle_count(m)      (UB otherwise)
+uint32_t mt_neighbor(c_mesh_topo_t, size_t t, int e);
+uint32_t mt_component(c_mesh_topo_t, size_t t);
+
+// After `mt_build()`: calls `fn(v0, v1, t, env)` on every boundary
+// edge, in no particular order.
+void mt_for_each_boundary_edge(c_mesh_topo_t, mt_edge_fn* fn, void* env);
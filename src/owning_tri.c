@@ -10,16 +10,61 @@ struct owning_tri
     posn_t vertices[N];
 };
 
+#ifdef HUGE_ARENAS
+// Allocate from huge pages (see arena.h).
+#   include "arena.h"
+
+static struct arena owning_tri_arena =
+    ARENA_INIT("owning_tri", sizeof(struct owning_tri));
+
+#   define alloc_tri()    arena_alloc(&owning_tri_arena)
+#   define free_tri(p)    arena_free(&owning_tri_arena, (p))
+#else
+#   define alloc_tri()    malloc(sizeof(struct owning_tri))
+#   define free_tri(p)    free(p)
+#endif // HUGE_ARENAS
+
+#ifdef CHECKED_HANDLES
+// In a checked build, clients' `owning_tri_t`s are handles (see
+// handle_table.h), which `deref` and `cderef` turn into real pointers.
+#   include "handle_table.h"
+
+static struct handle_table owning_tri_table =
+    HANDLE_TABLE_INIT("owning_tri");
+
+static struct owning_tri* deref(owning_tri_t t, const char* op)
+{
+    return ht_resolve(&owning_tri_table, (uintptr_t) t, op);
+}
+
+static const struct owning_tri* cderef(c_owning_tri_t t, const char* op)
+{
+    return ht_resolve(&owning_tri_table, (uintptr_t) t, op);
+}
+#else
+#   define deref(t, op)   (t)
+#   define cderef(t, op)  (t)
+#endif // CHECKED_HANDLES
+
 // Returns a new triangle whose posns are (0, 0).
 // Returns NULL on allocation error.
 owning_tri_t ot_create(void)
 {
-    owning_tri_t result = malloc(sizeof *result);
+    owning_tri_t result = alloc_tri();
     if (!result) return NULL;
 
     for (int i = 0; i < N; ++i)
         result->vertices[i] = posn_clone(ORIGIN);
 
+#ifdef CHECKED_HANDLES
+    uintptr_t h = ht_insert(&owning_tri_table, result);
+    if (!h) {
+        for (int i = 0; i < N; ++i) posn_destroy(result->vertices[i]);
+        free_tri(result);
+    }
+    result = (owning_tri_t) h;
+#endif
+
     return result;
 }
 
@@ -28,25 +73,30 @@ void ot_destroy(owning_tri_t t)
 {
     if (!t) return;
 
+#ifdef CHECKED_HANDLES
+    t = ht_remove(&owning_tri_table, (uintptr_t) t, "ot_destroy");
+#endif
+
     for (int i = 0; i < N; ++i) {
         posn_destroy(t->vertices[i]);
     }
 
-    free(t);
+    free_tri(t);
 }
 
 // Borrows the vertex `v` (0-2), mutably.
 posn_t ot_get_borrowed(owning_tri_t t, int v)
 {
-    return t->vertices[v];
+    return deref(t, "ot_get_borrowed")->vertices[v];
 }
 
 // Returns ownership of vertex `v`'s (0-2) posn, leaving the vertex in
 // triangle `t`. Allows NULL result but not NULL `t`.
 posn_t ot_take_owned(owning_tri_t t, int v)
 {
-    posn_t result = t->vertices[v];
-    t->vertices[v] = NULL;
+    struct owning_tri* q = deref(t, "ot_take_owned");
+    posn_t result = q->vertices[v];
+    q->vertices[v] = NULL;
     return result;
 }
 
@@ -55,8 +105,9 @@ posn_t ot_take_owned(owning_tri_t t, int v)
 // for `p` but not for `t`.
 void ot_put_owned(owning_tri_t t, int v, posn_t p)
 {
-    posn_destroy(t->vertices[v]);
-    t->vertices[v] = p;
+    struct owning_tri* q = deref(t, "ot_put_owned");
+    posn_destroy(q->vertices[v]);
+    q->vertices[v] = p;
 }
 
 // Sets vertex `v` of triangle `t` to be a copy of position `p`, which
@@ -68,7 +119,7 @@ void ot_put_owned(owning_tri_t t, int v, posn_t p)
 posn_t ot_put_borrowed(owning_tri_t t, int v, const_posn_t p)
 {
     // A pointer to the pointer we want to look at and possibly replace:
-    posn_t* resultp = &t->vertices[v];
+    posn_t* resultp = &deref(t, "ot_put_borrowed")->vertices[v];
 
     if (*resultp) {
         posn_assign(*resultp, p);
@@ -82,5 +133,5 @@ posn_t ot_put_borrowed(owning_tri_t t, int v, const_posn_t p)
 // Borrows the vertex `v` (0-2) from a const triangle.
 const_posn_t ot_const_get_borrowed(c_owning_tri_t t, int v)
 {
-    return t->vertices[v];
+    return cderef(t, "ot_const_get_borrowed")->vertices[v];
 }
@@ -0,0 +1,444 @@
+#include "packed_list.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#   define HAVE_X86_SIMD
+#   include <immintrin.h>
+#endif
+
+// Lanes that a block is packed across, and elements per lane.
+#define LANES          8
+#define LANE_LENGTH    (PL_BLOCK_SIZE / LANES)
+// Rows of zeros after the last block, so that decoding can always read
+// the row after the one it's in.
+#define PADDING_ROWS   2
+
+// Element `i` of a block is in lane `i % LANES`, at bit
+// `(i / LANES) * bits` of that lane, where word `w` of lane `l` is
+// `words[offset + LANES * w + l]`. Each element is stored as its
+// difference from the element before (or from `prev`, for the first),
+// less `min_delta`, all mod 2^32.
+struct block
+{
+    size_t    offset;
+    uint32_t  prev;
+    uint32_t  min_delta;
+    uint32_t  bits;
+};
+
+// Decodes a whole block (past its count, if it isn't full) into `out`.
+typedef void decode_kernel(const struct block* block, const uint32_t* words,
+                           int out[PL_BLOCK_SIZE]);
+
+struct packed_list
+{
+    size_t          length;
+    size_t          nblocks;
+    struct block*   blocks;
+    size_t          nwords;
+    uint32_t*       words;
+    decode_kernel*  decode;
+};
+
+// A packed list under construction, and the block it's filling.
+struct builder
+{
+    packed_list_t   pl;
+    size_t          block_cap;
+    size_t          word_cap;
+    uint32_t        prev;
+    size_t          fill;
+    int             buf[PL_BLOCK_SIZE];
+};
+
+
+//
+// Forward declarations
+//
+
+// Chooses the fastest decoding kernel this CPU supports.
+static decode_kernel* choose_decode(void);
+
+// The decoding kernel for any CPU.
+static void decode_scalar(const struct block*, const uint32_t* words,
+                          int out[PL_BLOCK_SIZE]);
+
+// Starts an empty list. Returns false on allocation error.
+static bool builder_init(struct builder*);
+
+// Appends an element. Returns false (and frees the list) on allocation
+// error.
+static bool builder_push(struct builder*, int value);
+
+// Returns the finished list, or NULL (freeing it) on allocation error.
+static packed_list_t builder_finish(struct builder*);
+
+// Encodes the buffered elements as a new block.
+static bool flush_block(struct builder*);
+
+// Ensures room for `n` more words. Returns false on allocation error.
+static bool reserve_words(struct builder*, size_t n);
+
+// The number of rows a block with elements of `bits` bits takes up.
+static size_t rows_for(uint32_t bits);
+
+// The length of block `i`.
+static size_t block_length(c_packed_list_t, size_t i);
+
+
+packed_list_t pl_from_list(list_t lst)
+{
+    struct builder b;
+    if (!builder_init(&b)) return NULL;
+
+    for (; is_cons(lst); lst = rest(lst))
+        if (!builder_push(&b, first(lst))) return NULL;
+
+    return builder_finish(&b);
+}
+
+packed_list_t pl_from_array(const int* values, size_t n)
+{
+    struct builder b;
+    if (!builder_init(&b)) return NULL;
+
+    for (size_t i = 0; i < n; ++i)
+        if (!builder_push(&b, values[i])) return NULL;
+
+    return builder_finish(&b);
+}
+
+void pl_destroy(packed_list_t pl)
+{
+    if (!pl) return;
+
+    free(pl->blocks);
+    free(pl->words);
+    free(pl);
+}
+
+size_t pl_length(c_packed_list_t pl)
+{
+    return pl->length;
+}
+
+size_t pl_bytes(c_packed_list_t pl)
+{
+    return sizeof *pl
+        + pl->nblocks * sizeof *pl->blocks
+        + pl->nwords * sizeof *pl->words;
+}
+
+list_t pl_to_list(c_packed_list_t pl)
+{
+    int buf[PL_BLOCK_SIZE];
+    list_t result = empty;
+
+    for (size_t i = pl->nblocks; i-- > 0; ) {
+        size_t n = pl_decode_block(pl, i, buf);
+        while (n) result = cons(buf[--n], result);
+    }
+
+    return result;
+}
+
+size_t pl_block_count(c_packed_list_t pl)
+{
+    return pl->nblocks;
+}
+
+size_t pl_decode_block(c_packed_list_t pl, size_t i, int out[PL_BLOCK_SIZE])
+{
+    pl->decode(&pl->blocks[i], pl->words, out);
+    return block_length(pl, i);
+}
+
+size_t pl_decode_block_scalar(c_packed_list_t pl, size_t i,
+                              int out[PL_BLOCK_SIZE])
+{
+    decode_scalar(&pl->blocks[i], pl->words, out);
+    return block_length(pl, i);
+}
+
+void pl_for_each(c_packed_list_t pl, void (*f)(int, void*), void* env)
+{
+    int buf[PL_BLOCK_SIZE];
+
+    for (size_t i = 0; i < pl->nblocks; ++i) {
+        size_t n = pl_decode_block(pl, i, buf);
+        for (size_t j = 0; j < n; ++j) f(buf[j], env);
+    }
+}
+
+packed_list_t pl_map(int (*f)(int), c_packed_list_t pl)
+{
+    int buf[PL_BLOCK_SIZE];
+    struct builder b;
+    if (!builder_init(&b)) return NULL;
+
+    for (size_t i = 0; i < pl->nblocks; ++i) {
+        size_t n = pl_decode_block(pl, i, buf);
+        for (size_t j = 0; j < n; ++j)
+            if (!builder_push(&b, f(buf[j]))) return NULL;
+    }
+
+    return builder_finish(&b);
+}
+
+int64_t pl_fold(int64_t (*f)(int64_t, int), int64_t init, c_packed_list_t pl)
+{
+    int buf[PL_BLOCK_SIZE];
+
+    for (size_t i = 0; i < pl->nblocks; ++i) {
+        size_t n = pl_decode_block(pl, i, buf);
+        for (size_t j = 0; j < n; ++j) init = f(init, buf[j]);
+    }
+
+    return init;
+}
+
+int64_t pl_sum(c_packed_list_t pl)
+{
+    int buf[PL_BLOCK_SIZE];
+    int64_t sum = 0;
+
+    for (size_t i = 0; i < pl->nblocks; ++i) {
+        size_t n = pl_decode_block(pl, i, buf);
+        for (size_t j = 0; j < n; ++j) sum += buf[j];
+    }
+
+    return sum;
+}
+
+
+//
+// Decoding kernels
+//
+
+// All kernels read word `w` of every lane as one row, shifting out
+// element `k` of each lane from rows `(k * bits) / 32` and the one
+// after.
+
+static uint32_t bits_mask(uint32_t bits)
+{
+    return bits == 32 ? UINT32_MAX : ((uint32_t) 1 << bits) - 1;
+}
+
+static void decode_scalar(const struct block* block, const uint32_t* words,
+                          int out[PL_BLOCK_SIZE])
+{
+    const uint32_t* rows = words + block->offset;
+    uint32_t mask = bits_mask(block->bits);
+    uint32_t acc  = block->prev;
+
+    for (size_t k = 0; k < LANE_LENGTH; ++k) {
+        size_t pos   = k * block->bits;
+        size_t row   = pos / 32;
+        unsigned sh  = pos % 32;
+
+        for (size_t l = 0; l < LANES; ++l) {
+            uint64_t pair = (uint64_t) rows[LANES * (row + 1) + l] << 32
+                          | rows[LANES * row + l];
+            acc += block->min_delta + ((uint32_t) (pair >> sh) & mask);
+            out[LANES * k + l] = (int) acc;
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("avx2")))
+static void decode_avx2(const struct block* block, const uint32_t* words,
+                        int out[PL_BLOCK_SIZE])
+{
+    const uint32_t* rows = words + block->offset;
+    __m256i mask  = _mm256_set1_epi32((int) bits_mask(block->bits));
+    __m256i min   = _mm256_set1_epi32((int) block->min_delta);
+    __m256i carry = _mm256_set1_epi32((int) block->prev);
+    __m256i zero  = _mm256_setzero_si256();
+    __m256i lane3 = _mm256_set1_epi32(3);
+    __m256i lane7 = _mm256_set1_epi32(7);
+
+    for (size_t k = 0; k < LANE_LENGTH; ++k) {
+        size_t pos  = k * block->bits;
+        size_t row  = pos / 32;
+        int    sh   = (int) (pos % 32);
+
+        __m256i lo = _mm256_loadu_si256((const __m256i*) (rows + LANES * row));
+        __m256i hi = _mm256_loadu_si256(
+                (const __m256i*) (rows + LANES * (row + 1)));
+        // Shifting by 32 gives 0, so `hi` drops out when sh is 0.
+        __m256i v = _mm256_or_si256(
+                _mm256_srl_epi32(lo, _mm_cvtsi32_si128(sh)),
+                _mm256_sll_epi32(hi, _mm_cvtsi32_si128(32 - sh)));
+        v = _mm256_add_epi32(_mm256_and_si256(v, mask), min);
+
+        // Prefix sums within each half, then carry the low half's total
+        // into the high half and the previous step's into both.
+        v = _mm256_add_epi32(v, _mm256_slli_si256(v, 4));
+        v = _mm256_add_epi32(v, _mm256_slli_si256(v, 8));
+        v = _mm256_add_epi32(v, _mm256_blend_epi32(
+                zero, _mm256_permutevar8x32_epi32(v, lane3), 0xF0));
+        v = _mm256_add_epi32(v, carry);
+
+        _mm256_storeu_si256((__m256i*) (out + LANES * k), v);
+        carry = _mm256_permutevar8x32_epi32(v, lane7);
+    }
+}
+
+#endif // HAVE_X86_SIMD
+
+static decode_kernel* choose_decode(void)
+{
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2")) return decode_avx2;
+#endif // HAVE_X86_SIMD
+    return decode_scalar;
+}
+
+
+//
+// Building
+//
+
+static size_t rows_for(uint32_t bits)
+{
+    return (LANE_LENGTH * bits + 31) / 32;
+}
+
+static size_t block_length(c_packed_list_t pl, size_t i)
+{
+    return i + 1 < pl->nblocks
+        ? PL_BLOCK_SIZE
+        : pl->length - i * PL_BLOCK_SIZE;
+}
+
+static bool builder_init(struct builder* b)
+{
+    b->pl = calloc(1, sizeof *b->pl);
+    if (!b->pl) return false;
+
+    b->block_cap = 0;
+    b->word_cap  = 0;
+    b->prev      = 0;
+    b->fill      = 0;
+    b->pl->decode = choose_decode();
+    return true;
+}
+
+static bool builder_push(struct builder* b, int value)
+{
+    b->buf[b->fill++] = value;
+    if (b->fill < PL_BLOCK_SIZE) return true;
+
+    if (flush_block(b)) return true;
+
+    pl_destroy(b->pl);
+    return false;
+}
+
+static packed_list_t builder_finish(struct builder* b)
+{
+    packed_list_t pl = b->pl;
+
+    if ((b->fill && !flush_block(b)) ||
+            !reserve_words(b, PADDING_ROWS * LANES)) {
+        pl_destroy(pl);
+        return NULL;
+    }
+
+    memset(pl->words + pl->nwords, 0, PADDING_ROWS * LANES * sizeof *pl->words);
+    pl->nwords += PADDING_ROWS * LANES;
+
+    // Give back the slack from growing; failing to shrink is harmless.
+    void* words = realloc(pl->words, pl->nwords * sizeof *pl->words);
+    if (words) pl->words = words;
+    if (pl->nblocks) {
+        void* blocks = realloc(pl->blocks, pl->nblocks * sizeof *pl->blocks);
+        if (blocks) pl->blocks = blocks;
+    }
+
+    return pl;
+}
+
+static bool flush_block(struct builder* b)
+{
+    packed_list_t pl = b->pl;
+    size_t n = b->fill;
+
+    if (pl->nblocks == b->block_cap) {
+        size_t cap = b->block_cap ? 2 * b->block_cap : 16;
+        struct block* blocks = realloc(pl->blocks, cap * sizeof *blocks);
+        if (!blocks) return false;
+        pl->blocks = blocks;
+        b->block_cap = cap;
+    }
+
+    // Differences from the element before, as signed so that small
+    // negative ones are close to small positive ones.
+    uint32_t deltas[PL_BLOCK_SIZE];
+    uint32_t prev = b->prev;
+    int32_t lo = INT32_MAX, hi = INT32_MIN;
+
+    for (size_t i = 0; i < n; ++i) {
+        deltas[i] = (uint32_t) b->buf[i] - prev;
+        prev = (uint32_t) b->buf[i];
+
+        int32_t d = (int32_t) deltas[i];
+        if (d < lo) lo = d;
+        if (d > hi) hi = d;
+    }
+
+    uint32_t range = (uint32_t) hi - (uint32_t) lo;
+    uint32_t bits  = range ? 32 - (uint32_t) __builtin_clz(range) : 0;
+    size_t   words = LANES * rows_for(bits);
+
+    if (!reserve_words(b, words)) return false;
+
+    // (With bits == 0 there's nothing to store, maybe not even a buffer.)
+    uint32_t* rows = bits ? pl->words + pl->nwords : NULL;
+    if (bits) memset(rows, 0, words * sizeof *rows);
+
+    for (size_t i = 0; bits && i < n; ++i) {
+        uint32_t v  = deltas[i] - (uint32_t) lo;
+        size_t pos  = (i / LANES) * bits;
+        size_t row  = pos / 32;
+        unsigned sh = pos % 32;
+        size_t l    = i % LANES;
+
+        rows[LANES * row + l] |= v << sh;
+        if (sh + bits > 32) rows[LANES * (row + 1) + l] |= v >> (32 - sh);
+    }
+
+    pl->blocks[pl->nblocks++] = (struct block) {
+        .offset    = pl->nwords,
+        .prev      = b->prev,
+        .min_delta = (uint32_t) lo,
+        .bits      = bits,
+    };
+    pl->nwords += words;
+    pl->length += n;
+
+    b->prev = prev;
+    b->fill = 0;
+    return true;
+}
+
+static bool reserve_words(struct builder* b, size_t n)
+{
+    packed_list_t pl = b->pl;
+    if (b->word_cap - pl->nwords >= n) return true;
+
+    size_t cap = b->word_cap ? b->word_cap : 256;
+    while (cap - pl->nwords < n) cap *= 2;
+
+    uint32_t* words = realloc(pl->words, cap * sizeof *words);
+    if (!words) return false;
+
+    pl->words = words;
+    b->word_cap = cap;
+    return true;
+}
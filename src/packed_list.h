@@ -0,0 +1,77 @@
+// Compressed immutable lists of `int`s.
+
+#pragma once
+
+#include "cons.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A packed list holds the same elements as a `list_t` in a fraction of
+ * the space, as long as neighboring elements are close together (as in
+ * a mostly sorted list of IDs). It can't be changed once built.
+ *
+ * The elements are stored in blocks of PL_BLOCK_SIZE. Within a block,
+ * each element is kept as its difference from the one before, less the
+ * block's smallest difference, in just as many bits as the largest of
+ * those needs. A sorted list whose neighbors differ by less than 256
+ * takes about a byte per element, rather than a cons cell's 16 plus
+ * malloc's overhead.
+ *
+ * Blocks are bit-packed across eight interleaved lanes, so that decoding
+ * unpacks eight consecutive elements per step with AVX2 where available.
+ * Each block decodes independently of the others.
+ */
+
+typedef        struct packed_list*    packed_list_t;
+typedef  const struct packed_list*  c_packed_list_t;
+
+// The number of elements per block (all blocks but the last are full).
+#define PL_BLOCK_SIZE  128
+
+
+// Returns a new packed list with the elements of `lst` (which it
+// borrows), or of `values[0]` through `values[n - 1]`. Returns NULL on
+// allocation error.
+packed_list_t pl_from_list(list_t lst);
+packed_list_t pl_from_array(const int* values, size_t n);
+
+// Deallocates a packed list. Allows NULL.
+void pl_destroy(packed_list_t);
+
+// The number of elements, and the number of bytes that the list takes
+// up (not counting malloc's overhead).
+size_t pl_length(c_packed_list_t), pl_bytes(c_packed_list_t);
+
+// Returns a new `list_t` with the same elements, which the caller owns.
+//
+// ERRORS: exits if memory cannot be allocated.
+list_t pl_to_list(c_packed_list_t);
+
+// The number of blocks, and decodes block `i` into `out`, returning
+// the number of elements it holds. Decoding blocks 0, 1, ... in turn
+// visits the elements in order.
+//
+// PRECONDITION: i < pl_block_count(pl)   (UB otherwise)
+size_t pl_block_count(c_packed_list_t);
+size_t pl_decode_block(c_packed_list_t, size_t i, int out[PL_BLOCK_SIZE]);
+
+// Like `pl_decode_block`, but always uses the scalar version. (For
+// comparison.)
+size_t pl_decode_block_scalar(c_packed_list_t, size_t i,
+                              int out[PL_BLOCK_SIZE]);
+
+// Calls `f(x, env)` for each element `x`, in order.
+void pl_for_each(c_packed_list_t, void (*f)(int, void*), void* env);
+
+// Maps function `f` over the elements, returning a new packed list (as
+// `map` does for `list_t`). Returns NULL on allocation error.
+packed_list_t pl_map(int (*f)(int), c_packed_list_t);
+
+// Folds `f` over the elements from the left: returns
+// f(... f(f(init, x0), x1) ..., xn-1).
+int64_t pl_fold(int64_t (*f)(int64_t, int), int64_t init, c_packed_list_t);
+
+// The sum of the elements, decoding and adding them a block at a time.
+int64_t pl_sum(c_packed_list_t);
@@ -0,0 +1,68 @@
+#include "parallel.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+struct range_job
+{
+    void       (*body)(size_t, size_t, void*);
+    void*      env;
+    size_t     begin, end;
+    pthread_t  thread;
+    bool       started;
+};
+
+static void* run_range_job(void* arg)
+{
+    struct range_job* job = arg;
+    job->body(job->begin, job->end, job->env);
+    return NULL;
+}
+
+void parallel_for(size_t n, int threads, size_t min_chunk,
+                  void (*body)(size_t begin, size_t end, void* env),
+                  void* env)
+{
+    if (min_chunk == 0) min_chunk = 1;
+
+    size_t chunks = threads > 1 ? (size_t) threads : 1;
+    if (chunks > PARALLEL_MAX_THREADS) chunks = PARALLEL_MAX_THREADS;
+    if (chunks > n / min_chunk) chunks = n / min_chunk;
+
+    if (chunks <= 1) {
+        if (n) body(0, n, env);
+        return;
+    }
+
+    struct range_job jobs[PARALLEL_MAX_THREADS];
+
+    for (size_t i = 0; i < chunks; ++i) {
+        jobs[i].body    = body;
+        jobs[i].env     = env;
+        jobs[i].begin   = n * i / chunks;
+        jobs[i].end     = n * (i + 1) / chunks;
+        jobs[i].started = false;
+    }
+
+    // The calling thread takes the first range itself.
+    for (size_t i = 1; i < chunks; ++i) {
+        jobs[i].started = !pthread_create(&jobs[i].thread, NULL,
+                                          run_range_job, &jobs[i]);
+    }
+
+    run_range_job(&jobs[0]);
+
+    for (size_t i = 1; i < chunks; ++i) {
+        if (jobs[i].started) pthread_join(jobs[i].thread, NULL);
+        else run_range_job(&jobs[i]);
+    }
+}
+
+int parallel_default_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) return 1;
+    return n < PARALLEL_MAX_THREADS ? (int) n : PARALLEL_MAX_THREADS;
+}
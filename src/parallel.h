@@ -0,0 +1,23 @@
+// A minimal fork-join helper for splitting loops across threads.
+
+#pragma once
+
+#include <stddef.h>
+
+// The most threads `parallel_for` uses; asking for more gets this many.
+#define PARALLEL_MAX_THREADS  256
+
+// Calls `body(begin, end, env)` on disjoint, contiguous ranges that
+// together cover [0, n), using up to `threads` threads (including the
+// calling one) and giving each at least `min_chunk` items. Returns when
+// all ranges are done.
+//
+// If a thread can't be started, its range runs on the calling thread
+// instead, so `body` always sees all of [0, n) exactly once.
+void parallel_for(size_t n, int threads, size_t min_chunk,
+                  void (*body)(size_t begin, size_t end, void* env),
+                  void* env);
+
+// The number of threads to use when the user doesn't say: the number
+// of online processors, or 1 if that can't be determined.
+int parallel_default_threads(void);
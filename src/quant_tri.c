@@ -0,0 +1,299 @@
+#include "quant_tri.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MAGIC           "GEOQ"
+#define MAGIC_LEN       4
+#define MAX_VARINT_LEN  10
+#define INITIAL_CAP     256
+
+struct quant_tris
+{
+    double          step;
+    double          x0, y0;     // offset; valid once `count > 0`
+    int32_t         qx, qy;     // last vertex pushed, for delta coding
+    size_t          count;
+    size_t          size;
+    size_t          capacity;
+    unsigned char*  bytes;
+};
+
+// The fixed-size part of the binary form, after the magic number.
+struct qt_header
+{
+    double    step, x0, y0;
+    uint64_t  count, size;
+};
+
+
+quant_tris_t qt_create(double max_err)
+{
+    if (!(max_err > 0) || !isfinite(max_err)) return NULL;
+
+    quant_tris_t result = malloc(sizeof *result);
+    if (!result) return NULL;
+
+    result->step     = 2 * max_err;
+    result->x0       = 0;
+    result->y0       = 0;
+    result->qx       = 0;
+    result->qy       = 0;
+    result->count    = 0;
+    result->size     = 0;
+    result->capacity = 0;
+    result->bytes    = NULL;
+
+    return result;
+}
+
+void qt_destroy(quant_tris_t qt)
+{
+    if (!qt) return;
+
+    free(qt->bytes);
+    free(qt);
+}
+
+void qt_clear(quant_tris_t qt)
+{
+    qt->x0    = 0;
+    qt->y0    = 0;
+    qt->qx    = 0;
+    qt->qy    = 0;
+    qt->count = 0;
+    qt->size  = 0;
+}
+
+// Snaps `v` to the grid relative to `origin`. Returns false if the
+// result doesn't fit in an int32.
+static bool quantize(double v, double origin, double step, int32_t* out)
+{
+    double q = nearbyint((v - origin) / step);
+    if (!(q >= INT32_MIN && q <= INT32_MAX)) return false;
+
+    *out = (int32_t) q;
+    return true;
+}
+
+// Appends the zigzag varint encoding of `delta` at `buf`, returning
+// the number of bytes written (at most MAX_VARINT_LEN).
+static size_t put_varint(unsigned char* buf, int64_t delta)
+{
+    uint64_t z = ((uint64_t) delta << 1) ^ (uint64_t) (delta >> 63);
+    size_t len = 0;
+
+    while (z >= 0x80) {
+        buf[len++] = (unsigned char) (z | 0x80);
+        z >>= 7;
+    }
+
+    buf[len++] = (unsigned char) z;
+    return len;
+}
+
+// Decodes a zigzag varint at `*offset`, advancing it.
+static int64_t get_varint(const unsigned char* bytes, size_t* offset)
+{
+    uint64_t z = 0;
+    int shift = 0;
+    unsigned char b;
+
+    do {
+        b = bytes[(*offset)++];
+        z |= (uint64_t) (b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+
+    return (int64_t) (z >> 1) ^ -(int64_t) (z & 1);
+}
+
+// Ensures room for `extra` more bytes. Returns false on allocation
+// error, or if the capacity needed doesn't fit in a size_t.
+static bool reserve(quant_tris_t qt, size_t extra)
+{
+    if (extra > SIZE_MAX - qt->size) return false;
+
+    size_t need = qt->size + extra;
+    if (need <= qt->capacity) return true;
+
+    size_t new_cap = qt->capacity ? qt->capacity : INITIAL_CAP;
+    while (new_cap < need) {
+        if (new_cap > SIZE_MAX / 2) return false;
+        new_cap *= 2;
+    }
+
+    unsigned char* new_bytes = realloc(qt->bytes, new_cap);
+    if (!new_bytes) return false;
+
+    qt->bytes    = new_bytes;
+    qt->capacity = new_cap;
+    return true;
+}
+
+bool qt_push(quant_tris_t qt, const double xs[3], const double ys[3])
+{
+    double x0 = qt->count ? qt->x0 : xs[0];
+    double y0 = qt->count ? qt->y0 : ys[0];
+
+    int32_t qxs[3], qys[3];
+    for (int i = 0; i < 3; ++i) {
+        if (!quantize(xs[i], x0, qt->step, &qxs[i]) ||
+                !quantize(ys[i], y0, qt->step, &qys[i]))
+            return false;
+    }
+
+    if (!reserve(qt, 6 * MAX_VARINT_LEN)) return false;
+
+    int32_t px = qt->qx, py = qt->qy;
+    for (int i = 0; i < 3; ++i) {
+        qt->size += put_varint(qt->bytes + qt->size, (int64_t) qxs[i] - px);
+        qt->size += put_varint(qt->bytes + qt->size, (int64_t) qys[i] - py);
+        px = qxs[i];
+        py = qys[i];
+    }
+
+    qt->x0 = x0;
+    qt->y0 = y0;
+    qt->qx = px;
+    qt->qy = py;
+    ++qt->count;
+
+    return true;
+}
+
+size_t qt_count(c_quant_tris_t qt)
+{
+    return qt->count;
+}
+
+size_t qt_size(c_quant_tris_t qt)
+{
+    return qt->size;
+}
+
+void qt_begin(c_quant_tris_t qt, struct qt_cursor* cur)
+{
+    (void) qt;
+    cur->offset = 0;
+    cur->qx     = 0;
+    cur->qy     = 0;
+}
+
+bool qt_next(c_quant_tris_t qt, struct qt_cursor* cur,
+             double xs[3], double ys[3])
+{
+    if (cur->offset >= qt->size) return false;
+
+    for (int i = 0; i < 3; ++i) {
+        cur->qx = (int32_t) (cur->qx + get_varint(qt->bytes, &cur->offset));
+        cur->qy = (int32_t) (cur->qy + get_varint(qt->bytes, &cur->offset));
+        xs[i] = qt->x0 + cur->qx * qt->step;
+        ys[i] = qt->y0 + cur->qy * qt->step;
+    }
+
+    return true;
+}
+
+bool qt_write(c_quant_tris_t qt, FILE* fout)
+{
+    struct qt_header hdr = {
+        .step  = qt->step,
+        .x0    = qt->x0,
+        .y0    = qt->y0,
+        .count = qt->count,
+        .size  = qt->size,
+    };
+
+    return fwrite(MAGIC, 1, MAGIC_LEN, fout) == MAGIC_LEN
+        && fwrite(&hdr, sizeof hdr, 1, fout) == 1
+        && fwrite(qt->bytes, 1, qt->size, fout) == qt->size;
+}
+
+// Could a store of `count` triangles take `size` bytes? Each triangle
+// is six varints of 1 to MAX_VARINT_LEN bytes.
+static bool plausible_size(uint64_t count, uint64_t size)
+{
+    return count <= UINT64_MAX / (6 * MAX_VARINT_LEN)
+        && size >= 6 * count
+        && size <= 6 * MAX_VARINT_LEN * count;
+}
+
+// Are there at least `size` bytes left to read from `fin`? (True if
+// that can't be told, as for a pipe.)
+static bool size_fits_file(FILE* fin, uint64_t size)
+{
+    struct stat st;
+    off_t pos = ftello(fin);
+
+    if (pos < 0 || fstat(fileno(fin), &st) || !S_ISREG(st.st_mode))
+        return true;
+
+    return pos <= st.st_size && size <= (uint64_t) (st.st_size - pos);
+}
+
+// Checks that `qt->bytes` holds exactly `qt->count` well-formed
+// triangles, so that `qt_next()` never reads out of bounds.
+static bool validate(c_quant_tris_t qt)
+{
+    size_t offset = 0, count = 0;
+
+    while (offset < qt->size) {
+        for (int i = 0; i < 6; ++i) {
+            int len = 0;
+            do {
+                if (offset >= qt->size || ++len > MAX_VARINT_LEN)
+                    return false;
+            } while (qt->bytes[offset++] & 0x80);
+        }
+        ++count;
+    }
+
+    return count == qt->count;
+}
+
+int qt_read(FILE* fin, quant_tris_t qt)
+{
+    char magic[MAGIC_LEN];
+    struct qt_header hdr;
+
+    qt_clear(qt);
+
+    size_t got = fread(magic, 1, MAGIC_LEN, fin);
+    if (got == 0 && feof(fin)) return 0;
+
+    if (got != MAGIC_LEN || memcmp(magic, MAGIC, MAGIC_LEN) ||
+            fread(&hdr, sizeof hdr, 1, fin) != 1 ||
+            !(hdr.step > 0) || !isfinite(hdr.step))
+        return -1;
+
+    // Check the size before allocating for it, so that a corrupt header
+    // fails here rather than asking for an absurd amount of memory.
+    if (hdr.size > SIZE_MAX || !plausible_size(hdr.count, hdr.size) ||
+            !size_fits_file(fin, hdr.size) || !reserve(qt, hdr.size) ||
+            fread(qt->bytes, 1, hdr.size, fin) != hdr.size)
+        return -1;
+
+    qt->step  = hdr.step;
+    qt->x0    = hdr.x0;
+    qt->y0    = hdr.y0;
+    qt->count = hdr.count;
+    qt->size  = hdr.size;
+
+    if (!validate(qt)) {
+        qt_clear(qt);
+        return -1;
+    }
+
+    // Find the last vertex, so that further pushes delta-code from it.
+    struct qt_cursor cur;
+    double xs[3], ys[3];
+    qt_begin(qt, &cur);
+    while (qt_next(qt, &cur, xs, ys)) { }
+    qt->qx = cur.qx;
+    qt->qy = cur.qy;
+
+    return 1;
+}
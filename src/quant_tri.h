@@ -0,0 +1,86 @@
+// Compact storage for streams of triangles with bounded precision.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * A quantized triangle store holds a sequence of triangles whose
+ * coordinates have been snapped to a grid of int32s:
+ *
+ *     x = x0 + qx * step,   y = y0 + qy * step
+ *
+ * where `step` is twice the requested error bound and (x0, y0), the
+ * per-stream offset, is the first vertex stored. Consecutive vertices
+ * (including across triangles) are delta-coded, and each delta is
+ * stored as a zigzag varint, so nearby vertices typically take 2-3
+ * bytes per coordinate instead of the 8 of a `double`.
+ *
+ * Stores are append-only; triangles are read back in order with a
+ * `struct qt_cursor`.
+ *
+ * To stream any number of triangles in bounded memory, the binary form
+ * of a stream is a sequence of stores, each with its own offset: the
+ * writer writes out its store with `qt_write()` and `qt_clear()`s it
+ * whenever it reaches QT_BLOCK_SIZE bytes (and at the end), and the
+ * reader reads one store at a time with `qt_read()`.
+ */
+
+// How large a store a stream writer lets grow before writing it out.
+#define QT_BLOCK_SIZE  ((size_t) 1 << 20)
+
+typedef        struct quant_tris*    quant_tris_t;
+typedef  const struct quant_tris*  c_quant_tris_t;
+
+// Position of a reader within a store. Initialize with `qt_begin()`;
+// the fields are private to quant_tri.c.
+struct qt_cursor
+{
+    size_t   offset;
+    int32_t  qx, qy;
+};
+
+
+// Returns a new, empty store whose coordinates will be within `max_err`
+// of those pushed into it. Returns NULL if `max_err` isn't positive and
+// finite, or on allocation error.
+quant_tris_t qt_create(double max_err);
+
+// Deallocates a store. Allows NULL.
+void qt_destroy(quant_tris_t);
+
+// Appends a triangle with vertices (xs[i], ys[i]).
+//
+// ERRORS:
+//  - Returns false (leaving the store unchanged) if a coordinate is so
+//    far from the stream's offset that it doesn't fit on the grid, or
+//    if memory allocation fails.
+bool qt_push(quant_tris_t, const double xs[3], const double ys[3]);
+
+// Empties a store, keeping its error bound (and its memory, for reuse).
+void qt_clear(quant_tris_t);
+
+// The number of triangles in the store, and the number of bytes their
+// encoding occupies.
+size_t qt_count(c_quant_tris_t), qt_size(c_quant_tris_t);
+
+// Positions `*cur` at the first triangle of the store.
+void qt_begin(c_quant_tris_t, struct qt_cursor* cur);
+
+// Decodes the triangle at `*cur` into `xs` and `ys` and advances the
+// cursor. Returns false (without writing) at the end of the store.
+bool qt_next(c_quant_tris_t, struct qt_cursor* cur,
+             double xs[3], double ys[3]);
+
+// Writes a store to a binary stream. Returns false on write error.
+// (The encoding uses the host's byte order for the header.)
+bool qt_write(c_quant_tris_t, FILE*);
+
+// Reads the next store written by `qt_write()` into `qt`, replacing
+// its contents and error bound. Returns positive on success, 0 at end
+// of file (before any of a store), or negative on badly formatted
+// input, read error, or allocation error (leaving `qt` empty).
+int qt_read(FILE*, quant_tris_t qt);
@@ -0,0 +1,57 @@
+#include "small_list.h"
+
+#include <string.h>
+
+const small_list_t sl_empty = { .count = 0, .spill = NULL };
+
+void sl_spill_one(small_list_t* sl)
+{
+    // The deepest inline element is the one just before the spill.
+    sl->spill = cons(sl->items[0], sl->spill);
+    memmove(sl->items, sl->items + 1,
+            (SMALL_LIST_INLINE - 1) * sizeof *sl->items);
+    --sl->count;
+}
+
+size_t sl_length(small_list_t sl)
+{
+    size_t length = (size_t) sl.count;
+    for (list_t p = sl.spill; is_cons(p); p = rest(p)) ++length;
+    return length;
+}
+
+void sl_free(small_list_t sl)
+{
+    uncons_all(sl.spill);
+}
+
+small_list_t sl_map(int (*f)(int), small_list_t sl)
+{
+    small_list_t result = { .count = sl.count };
+
+    for (int i = sl.count; i-- > 0; )
+        result.items[i] = f(sl.items[i]);
+
+    result.spill = map(f, sl.spill);
+    return result;
+}
+
+void sl_for_each(void (*f)(int*), small_list_t* sl)
+{
+    for (int i = sl->count; i-- > 0; )
+        f(&sl->items[i]);
+
+    for_each(f, sl->spill);
+}
+
+static int identity(int z) { return z; }
+
+list_t sl_to_list(small_list_t sl)
+{
+    list_t result = map(identity, sl.spill);
+
+    for (int i = 0; i < sl.count; ++i)
+        result = cons(sl.items[i], result);
+
+    return result;
+}
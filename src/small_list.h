@@ -0,0 +1,115 @@
+// Lists of `int`s that keep short lists out of the heap.
+
+#pragma once
+
+#include "cons.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A `small_list_t` is a list value, passed and returned by value, that
+ * holds up to SMALL_LIST_INLINE elements in itself and so needs no heap
+ * allocation at all until it grows past that. Past that, the elements
+ * furthest from the front spill into an ordinary `list_t`.
+ *
+ * Ownership works as for `list_t`, except that only the spilled part
+ * is ever on the heap: a small list owns its spill, `sl_rest` borrows
+ * it, and `sl_free` frees it (and does nothing at all for a list that
+ * never spilled).
+ *
+ * The fields are exposed only so that small lists can live on the
+ * stack, and so that the constant-time operations can be inlined; use
+ * the functions below rather than the fields.
+ */
+
+// The most elements a small list holds without allocating.
+#define SMALL_LIST_INLINE  8
+
+typedef struct small_list
+{
+    // The first `count` elements, in reverse: the first element is
+    // `items[count - 1]`. Then come the elements of `spill`.
+    int     items[SMALL_LIST_INLINE];
+    int     count;
+    list_t  spill;
+} small_list_t;
+
+// The empty small list.
+extern const small_list_t sl_empty;
+
+// Moves the deepest inline element of full `*sl` into its spill. (Used
+// by `sl_cons`.)
+//
+// ERRORS: exits if memory cannot be allocated.
+void sl_spill_one(small_list_t* sl);
+
+// Constructs a new list from a first element and the remaining list,
+// taking ownership of `rest` (as `cons` does). Allocates only if `rest`
+// already holds SMALL_LIST_INLINE elements inline.
+//
+// ERRORS: exits if memory cannot be allocated.
+static inline small_list_t sl_cons(int first, small_list_t rest)
+{
+    if (rest.count == SMALL_LIST_INLINE) sl_spill_one(&rest);
+    rest.items[rest.count++] = first;
+    return rest;
+}
+
+// Is the list empty? Nonempty?
+static inline bool sl_is_empty(small_list_t sl)
+{
+    return sl.count == 0 && is_empty(sl.spill);
+}
+
+static inline bool sl_is_cons(small_list_t sl)
+{
+    return !sl_is_empty(sl);
+}
+
+// The number of elements.
+size_t sl_length(small_list_t);
+
+// Returns the first element of `sl`.
+//
+// PRECONDITION (asserted): sl_is_cons(sl)
+static inline int sl_first(small_list_t sl)
+{
+    assert(sl_is_cons(sl));
+    return sl.count ? sl.items[sl.count - 1] : first(sl.spill);
+}
+
+// *Borrows* the rest of `sl`: the result shares `sl`'s spill, so it
+// must not be freed (nor passed to `sl_cons`, which would take
+// ownership of it).
+//
+// PRECONDITION (asserted): sl_is_cons(sl)
+static inline small_list_t sl_rest(small_list_t sl)
+{
+    assert(sl_is_cons(sl));
+
+    if (sl.count) --sl.count;
+    else sl.spill = rest(sl.spill);
+
+    return sl;
+}
+
+// Frees the heap part of `sl`, if any, taking ownership of it.
+void sl_free(small_list_t sl);
+
+// Maps function `f` over the elements of `sl` (which it borrows),
+// returning a new list that the caller owns. Allocates only for the
+// elements past the inline ones.
+//
+// ERRORS: exits if memory cannot be allocated.
+small_list_t sl_map(int (*f)(int), small_list_t sl);
+
+// Applies function `f` to the pointer to each element of `*sl`, in
+// order, so it can modify the list in place.
+void sl_for_each(void (*f)(int*), small_list_t* sl);
+
+// Returns a new `list_t` with the same elements, which the caller owns.
+//
+// ERRORS: exits if memory cannot be allocated.
+list_t sl_to_list(small_list_t sl);
@@ -0,0 +1,155 @@
+#include "trace.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+struct trace_event
+{
+    uint64_t     ns;
+    const char*  name;
+    char         phase;
+};
+
+// One thread's events. Event `i` (counting from the thread's first) is
+// in `events[i % TRACE_RING_EVENTS]`.
+struct trace_ring
+{
+    struct trace_ring*  next;
+    unsigned            tid;
+    uint64_t            count;
+    struct trace_event  events[TRACE_RING_EVENTS];
+};
+
+bool trace_active = false;
+
+// When tracing was turned on, as the zero of the timeline.
+static uint64_t start_ns;
+
+// Every thread's ring, newest first, and the last thread id issued.
+static struct trace_ring* all_rings;
+static unsigned last_tid;
+
+// The calling thread's ring, once it has recorded an event.
+static _Thread_local struct trace_ring* my_ring;
+static _Thread_local bool my_ring_failed;
+
+
+//
+// Forward declarations
+//
+
+// A monotonic clock in nanoseconds.
+static uint64_t now_ns(void);
+
+// Allocates and registers a ring for the calling thread. Returns NULL
+// on allocation error.
+static struct trace_ring* new_ring(void);
+
+// Writes one thread's events. Ends that have lost their beginnings to
+// the ring wrapping around are skipped. Returns false on I/O error.
+static bool write_ring(FILE*, const struct trace_ring*, long pid,
+                       bool* first);
+
+
+void trace_enable(void)
+{
+    start_ns = now_ns();
+    __atomic_store_n(&trace_active, true, __ATOMIC_RELEASE);
+}
+
+void trace_record(const char* name, char phase)
+{
+    struct trace_ring* ring = my_ring;
+
+    if (!ring) {
+        if (my_ring_failed) return;
+        ring = my_ring = new_ring();
+        if (!ring) {
+            my_ring_failed = true;
+            return;
+        }
+    }
+
+    struct trace_event* e =
+        &ring->events[ring->count++ % TRACE_RING_EVENTS];
+    e->ns    = now_ns();
+    e->name  = name;
+    e->phase = phase;
+}
+
+bool trace_write(const char* path)
+{
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    long pid = (long) getpid();
+    bool first = true;
+    bool ok = fprintf(f, "{\"traceEvents\":[") >= 0;
+
+    struct trace_ring* ring = __atomic_load_n(&all_rings, __ATOMIC_ACQUIRE);
+    for (; ok && ring; ring = ring->next)
+        ok = write_ring(f, ring, pid, &first);
+
+    ok = ok && fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n") >= 0;
+    ok = !fclose(f) && ok;
+
+    if (!ok) perror(path);
+    return ok;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct trace_ring* new_ring(void)
+{
+    struct trace_ring* ring = malloc(sizeof *ring);
+    if (!ring) return NULL;
+
+    ring->tid   = __atomic_add_fetch(&last_tid, 1, __ATOMIC_RELAXED);
+    ring->count = 0;
+
+    ring->next = __atomic_load_n(&all_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&all_rings, &ring->next, ring, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        continue;
+
+    return ring;
+}
+
+static bool write_ring(FILE* f, const struct trace_ring* ring, long pid,
+                       bool* first)
+{
+    uint64_t begin = ring->count > TRACE_RING_EVENTS
+                   ? ring->count - TRACE_RING_EVENTS
+                   : 0;
+    size_t depth = 0;
+
+    for (uint64_t i = begin; i < ring->count; ++i) {
+        const struct trace_event* e = &ring->events[i % TRACE_RING_EVENTS];
+
+        if (e->phase == 'B') ++depth;
+        else if (depth) --depth;
+        else continue;
+
+        // Chrome wants microseconds.
+        if (fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,"
+                       "\"pid\":%ld,\"tid\":%u}",
+                    *first ? "" : ",", e->name, e->phase,
+                    (double) (e->ns - start_ns) / 1000, pid, ring->tid) < 0)
+            return false;
+
+        *first = false;
+    }
+
+    return true;
+}
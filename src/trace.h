@@ -0,0 +1,48 @@
+// Low-overhead tracing of timed spans, for viewing as a timeline.
+
+#pragma once
+
+#include <stdbool.h>
+
+/*
+ * Code marks the spans it wants to see with TRACE_BEGIN and TRACE_END.
+ * While tracing is off (the default), each of those costs a test of one
+ * global flag. Once `trace_enable()` turns it on, each records the
+ * time, in the calling thread's own ring buffer, so threads never
+ * contend; each ring keeps that thread's last TRACE_RING_EVENTS events.
+ *
+ * `trace_write()` then saves all the threads' events in Chrome's trace
+ * event format, which chrome://tracing and https://ui.perfetto.dev can
+ * display, one row of nested spans per thread.
+ */
+
+// The most events kept per thread; older ones are overwritten.
+#define TRACE_RING_EVENTS  (1 << 16)
+
+// Whether tracing is on. (Read it via TRACE_BEGIN and TRACE_END.)
+extern bool trace_active;
+
+// Marks the beginning or end of a span named `name` on the calling
+// thread. Spans on a thread must nest. `name` must be a string literal
+// (or otherwise live as long as the trace), without quotes or
+// backslashes.
+#define TRACE_BEGIN(name) \
+    do { if (__builtin_expect(trace_active, 0)) trace_record((name), 'B'); } \
+    while (0)
+#define TRACE_END(name) \
+    do { if (__builtin_expect(trace_active, 0)) trace_record((name), 'E'); } \
+    while (0)
+
+// Turns tracing on, for all threads.
+void trace_enable(void);
+
+// Records an event with phase 'B' (begin) or 'E' (end). (Used by
+// TRACE_BEGIN and TRACE_END.) If a thread's ring can't be allocated,
+// its events are dropped.
+void trace_record(const char* name, char phase);
+
+// Writes the events recorded so far to file `path` as Chrome trace
+// JSON. Returns false (having reported why with `perror`) on error.
+//
+// PRECONDITION: no other thread is recording events.
+bool trace_write(const char* path);
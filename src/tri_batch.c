@@ -0,0 +1,107 @@
+#include "tri_batch.h"
+
+#include <stdlib.h>
+
+struct tri_batch
+{
+    size_t   count;
+    size_t   capacity;
+    double*  xs;
+    double*  ys;
+};
+
+tri_batch_t tb_create(size_t capacity)
+{
+    tri_batch_t result = malloc(sizeof *result);
+    if (!result) return NULL;
+
+    result->count    = 0;
+    result->capacity = capacity;
+    result->xs       = malloc(3 * capacity * sizeof result->xs[0]);
+    result->ys       = malloc(3 * capacity * sizeof result->ys[0]);
+
+    if (!result->xs || !result->ys) {
+        tb_destroy(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+void tb_destroy(tri_batch_t b)
+{
+    if (!b) return;
+
+    free(b->xs);
+    free(b->ys);
+    free(b);
+}
+
+size_t tb_count(c_tri_batch_t b)
+{
+    return b->count;
+}
+
+size_t tb_capacity(c_tri_batch_t b)
+{
+    return b->capacity;
+}
+
+bool tb_is_empty(c_tri_batch_t b)
+{
+    return b->count == 0;
+}
+
+bool tb_is_full(c_tri_batch_t b)
+{
+    return b->count == b->capacity;
+}
+
+void tb_clear(tri_batch_t b)
+{
+    b->count = 0;
+}
+
+bool tb_push(tri_batch_t b, const double xs[3], const double ys[3])
+{
+    if (tb_is_full(b)) return false;
+
+    double* dx = b->xs + 3 * b->count;
+    double* dy = b->ys + 3 * b->count;
+
+    for (int v = 0; v < 3; ++v) {
+        dx[v] = xs[v];
+        dy[v] = ys[v];
+    }
+
+    ++b->count;
+    return true;
+}
+
+void tb_get(c_tri_batch_t b, size_t i, double xs[3], double ys[3])
+{
+    for (int v = 0; v < 3; ++v) {
+        xs[v] = b->xs[3 * i + v];
+        ys[v] = b->ys[3 * i + v];
+    }
+}
+
+double* tb_xs(tri_batch_t b)
+{
+    return b->xs;
+}
+
+double* tb_ys(tri_batch_t b)
+{
+    return b->ys;
+}
+
+const double* tb_const_xs(c_tri_batch_t b)
+{
+    return b->xs;
+}
+
+const double* tb_const_ys(c_tri_batch_t b)
+{
+    return b->ys;
+}
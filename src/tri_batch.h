@@ -0,0 +1,51 @@
+// Batches of triangles stored contiguously, for bulk processing.
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A triangle batch holds up to a fixed number of triangles as plain
+ * coordinates rather than as `posn_t`s, in structure-of-arrays layout:
+ * vertex `v` (0-2) of triangle `i` is
+ *
+ *     (tb_xs(b)[3 * i + v], tb_ys(b)[3 * i + v])
+ *
+ * so that kernels can stream through all the x (or y) coordinates of a
+ * batch at once. The batch owns its coordinate arrays.
+ */
+
+typedef        struct tri_batch*    tri_batch_t;
+typedef  const struct tri_batch*  c_tri_batch_t;
+
+
+// Returns a new, empty batch with room for `capacity` (> 0) triangles.
+// Returns NULL on allocation error.
+tri_batch_t tb_create(size_t capacity);
+
+// Deallocates a batch. Allows NULL.
+void tb_destroy(tri_batch_t);
+
+// The number of triangles in the batch, and the most it can hold.
+size_t tb_count(c_tri_batch_t), tb_capacity(c_tri_batch_t);
+
+// Is the batch empty? Full?
+bool tb_is_empty(c_tri_batch_t), tb_is_full(c_tri_batch_t);
+
+// Removes all triangles from the batch.
+void tb_clear(tri_batch_t);
+
+// Appends the triangle with vertices (xs[v], ys[v]). Returns false
+// (and does nothing) if the batch is full.
+bool tb_push(tri_batch_t, const double xs[3], const double ys[3]);
+
+// Copies the vertices of triangle `i` into `xs` and `ys`.
+//
+// PRECONDITION: i < tb_count(b)      (UB otherwise)
+void tb_get(c_tri_batch_t, size_t i, double xs[3], double ys[3]);
+
+// Borrows the coordinate arrays, each of length 3 * tb_count(b). They
+// remain valid until the batch is destroyed.
+double* tb_xs(tri_batch_t), * tb_ys(tri_batch_t);
+const double* tb_const_xs(c_tri_batch_t), * tb_const_ys(c_tri_batch_t);
@@ -0,0 +1,455 @@
+#include "tri_hull.h"
+#include "parallel.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#   define HAVE_X86_SIMD
+#   include <immintrin.h>
+#endif
+
+// Vertices collected before they're folded into the hull.
+#define CHUNK_SIZE     (1 << 20)
+// Widest kernel, and so the padding after the chunk.
+#define MAX_LANES      8
+// Don't split a chunk finer than this.
+#define MIN_CHUNK      16384
+// Largest number of partial hulls, one per thread.
+#define MAX_PARTS      256
+
+struct point
+{
+    double  x, y;
+};
+
+struct tri_hull
+{
+    int            threads;
+    size_t         seen;
+
+    // The chunk, in structure-of-arrays form.
+    size_t         n;
+    double*        xs;
+    double*        ys;
+
+    // Room to filter the chunk into, and its partial hulls.
+    struct point*  kept;
+
+    // The hull so far.
+    size_t         size;
+    struct point*  hull;
+};
+
+// Points that are extreme in the directions -y, x - y, x, x + y, y,
+// y - x, -x and -(x + y): that is, counterclockwise around the points
+// so far, starting from the bottom.
+struct extremes
+{
+    bool          any;
+    double        key[8];
+    struct point  p[8];
+};
+
+// The octagon spanned by the extreme points, as its edges of nonzero
+// length, each from (ax, ay) by (dx, dy). A point is strictly inside
+// if it's strictly left of every edge.
+struct octagon
+{
+    int     n;
+    double  ax[8], ay[8], dx[8], dy[8];
+};
+
+// Copies the points among xs[0 .. n - 1], ys[0 .. n - 1] that aren't
+// strictly inside `oct` to `out`, in order. Returns how many.
+typedef size_t filter_kernel(const struct octagon* oct, const double* xs,
+                             const double* ys, size_t n, struct point* out);
+
+// The state shared by chunk workers.
+struct chunk_job
+{
+    tri_hull_t          h;
+    struct octagon      oct;
+    filter_kernel*      filter;
+    pthread_mutex_t     lock;
+    struct extremes     ext;
+    size_t              n_parts;
+    size_t              part_begin[MAX_PARTS], part_size[MAX_PARTS];
+    bool                failed;
+};
+
+
+//
+// Geometry
+//
+
+static void extremes_add(struct extremes* e, double x, double y)
+{
+    double key[8] = { -y, x - y, x, x + y, y, y - x, -x, -(x + y) };
+
+    for (int d = 0; d < 8; ++d) {
+        if (!e->any || key[d] > e->key[d]) {
+            e->key[d] = key[d];
+            e->p[d]   = (struct point) { x, y };
+        }
+    }
+
+    e->any = true;
+}
+
+static void extremes_merge(struct extremes* e, const struct extremes* other)
+{
+    if (!other->any) return;
+
+    for (int d = 0; d < 8; ++d)
+        extremes_add(e, other->p[d].x, other->p[d].y);
+}
+
+static void make_octagon(struct octagon* oct, const struct extremes* e)
+{
+    oct->n = 0;
+    if (!e->any) return;
+
+    for (int d = 0; d < 8; ++d) {
+        struct point a = e->p[d], b = e->p[(d + 1) % 8];
+        if (a.x == b.x && a.y == b.y) continue;
+
+        oct->ax[oct->n] = a.x;
+        oct->ay[oct->n] = a.y;
+        oct->dx[oct->n] = b.x - a.x;
+        oct->dy[oct->n] = b.y - a.y;
+        ++oct->n;
+    }
+}
+
+static double cross(struct point o, struct point a, struct point b)
+{
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+static int compare_points(const void* a, const void* b)
+{
+    const struct point* p = a;
+    const struct point* q = b;
+    if (p->x != q->x) return (p->x > q->x) - (p->x < q->x);
+    return (p->y > q->y) - (p->y < q->y);
+}
+
+// Replaces the `n` points at `pts` with their hull, counterclockwise
+// from the least, by Andrew's monotone chain, using `tmp` (room for
+// n + 1 points). Returns the hull's size.
+static size_t monotone_chain(struct point* pts, size_t n, struct point* tmp)
+{
+    qsort(pts, n, sizeof *pts, compare_points);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < n; ++i)
+        if (!unique || compare_points(&pts[unique - 1], &pts[i]))
+            pts[unique++] = pts[i];
+
+    if (unique < 3) return unique;
+
+    // The lower hull left to right, then the upper hull right to left;
+    // turns that aren't strictly counterclockwise are dropped.
+    size_t k = 0;
+
+    for (size_t i = 0; i < unique; ++i) {
+        while (k >= 2 && cross(tmp[k - 2], tmp[k - 1], pts[i]) <= 0) --k;
+        tmp[k++] = pts[i];
+    }
+
+    for (size_t i = unique - 1, lower = k + 1; i-- > 0; ) {
+        while (k >= lower && cross(tmp[k - 2], tmp[k - 1], pts[i]) <= 0) --k;
+        tmp[k++] = pts[i];
+    }
+
+    // The last point repeats the first.
+    --k;
+    memcpy(pts, tmp, k * sizeof *pts);
+    return k;
+}
+
+
+//
+// Kernels
+//
+
+static bool strictly_inside(const struct octagon* oct, double x, double y)
+{
+    for (int k = 0; k < oct->n; ++k)
+        if (!(oct->dx[k] * (y - oct->ay[k]) -
+              oct->dy[k] * (x - oct->ax[k]) > 0))
+            return false;
+
+    return oct->n > 0;
+}
+
+static size_t filter_scalar(const struct octagon* oct, const double* xs,
+                            const double* ys, size_t n, struct point* out)
+{
+    size_t kept = 0;
+
+    for (size_t i = 0; i < n; ++i)
+        if (!strictly_inside(oct, xs[i], ys[i]))
+            out[kept++] = (struct point) { xs[i], ys[i] };
+
+    return kept;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("avx2")))
+static size_t filter_avx2(const struct octagon* oct, const double* xs,
+                          const double* ys, size_t n, struct point* out)
+{
+    if (!oct->n) return filter_scalar(oct, xs, ys, n, out);
+
+    const __m256d zero = _mm256_setzero_pd();
+    size_t kept = 0;
+
+    // The chunk is padded, so whole steps are safe to read.
+    for (size_t i = 0; i < n; i += 4) {
+        __m256d x = _mm256_loadu_pd(xs + i), y = _mm256_loadu_pd(ys + i);
+        __m256d inside = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+
+        for (int k = 0; k < oct->n; ++k) {
+            __m256d c = _mm256_sub_pd(
+                _mm256_mul_pd(_mm256_set1_pd(oct->dx[k]),
+                              _mm256_sub_pd(y, _mm256_set1_pd(oct->ay[k]))),
+                _mm256_mul_pd(_mm256_set1_pd(oct->dy[k]),
+                              _mm256_sub_pd(x, _mm256_set1_pd(oct->ax[k]))));
+            inside = _mm256_and_pd(inside, _mm256_cmp_pd(c, zero, _CMP_GT_OQ));
+        }
+
+        unsigned keep = ~(unsigned) _mm256_movemask_pd(inside) & 0xF;
+        if (n - i < 4) keep &= (1u << (n - i)) - 1;
+
+        for (; keep; keep &= keep - 1) {
+            size_t j = i + (size_t) __builtin_ctz(keep);
+            out[kept++] = (struct point) { xs[j], ys[j] };
+        }
+    }
+
+    return kept;
+}
+
+__attribute__((target("avx512f")))
+static size_t filter_avx512(const struct octagon* oct, const double* xs,
+                            const double* ys, size_t n, struct point* out)
+{
+    if (!oct->n) return filter_scalar(oct, xs, ys, n, out);
+
+    const __m512d zero = _mm512_setzero_pd();
+    size_t kept = 0;
+
+    for (size_t i = 0; i < n; i += 8) {
+        __m512d x = _mm512_loadu_pd(xs + i), y = _mm512_loadu_pd(ys + i);
+        __mmask8 inside = 0xFF;
+
+        for (int k = 0; k < oct->n; ++k) {
+            __m512d c = _mm512_sub_pd(
+                _mm512_mul_pd(_mm512_set1_pd(oct->dx[k]),
+                              _mm512_sub_pd(y, _mm512_set1_pd(oct->ay[k]))),
+                _mm512_mul_pd(_mm512_set1_pd(oct->dy[k]),
+                              _mm512_sub_pd(x, _mm512_set1_pd(oct->ax[k]))));
+            inside &= _mm512_cmp_pd_mask(c, zero, _CMP_GT_OQ);
+        }
+
+        unsigned keep = ~(unsigned) inside & 0xFF;
+        if (n - i < 8) keep &= (1u << (n - i)) - 1;
+
+        for (; keep; keep &= keep - 1) {
+            size_t j = i + (size_t) __builtin_ctz(keep);
+            out[kept++] = (struct point) { xs[j], ys[j] };
+        }
+    }
+
+    return kept;
+}
+
+#endif // HAVE_X86_SIMD
+
+static filter_kernel* choose_filter(void)
+{
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx512f")) return filter_avx512;
+    if (__builtin_cpu_supports("avx2")) return filter_avx2;
+#endif // HAVE_X86_SIMD
+
+    return filter_scalar;
+}
+
+
+//
+// Building
+//
+
+tri_hull_t th_create(int threads)
+{
+    tri_hull_t h = calloc(1, sizeof *h);
+    if (!h) return NULL;
+
+    h->threads = threads;
+    h->xs   = malloc((CHUNK_SIZE + MAX_LANES) * sizeof(double));
+    h->ys   = malloc((CHUNK_SIZE + MAX_LANES) * sizeof(double));
+    h->kept = malloc(CHUNK_SIZE * sizeof(struct point));
+    if (!h->xs || !h->ys || !h->kept) {
+        th_destroy(h);
+        return NULL;
+    }
+
+    // Padding that kernels may read but never keep.
+    for (size_t i = CHUNK_SIZE; i < CHUNK_SIZE + MAX_LANES; ++i)
+        h->xs[i] = h->ys[i] = 0;
+
+    return h;
+}
+
+void th_destroy(tri_hull_t h)
+{
+    if (!h) return;
+
+    free(h->xs);
+    free(h->ys);
+    free(h->kept);
+    free(h->hull);
+    free(h);
+}
+
+// Finds the extremes of part of the chunk.
+static void extremes_worker(size_t begin, size_t end, void* env)
+{
+    struct chunk_job* job = env;
+    struct extremes e = { .any = false };
+
+    for (size_t i = begin; i < end; ++i)
+        extremes_add(&e, job->h->xs[i], job->h->ys[i]);
+
+    pthread_mutex_lock(&job->lock);
+    extremes_merge(&job->ext, &e);
+    pthread_mutex_unlock(&job->lock);
+}
+
+// Filters part of the chunk into `kept` at the same offset, and
+// replaces what's left with its hull.
+static void hull_worker(size_t begin, size_t end, void* env)
+{
+    struct chunk_job* job = env;
+    tri_hull_t h = job->h;
+
+    struct point* part = h->kept + begin;
+    size_t n = job->filter(&job->oct, h->xs + begin, h->ys + begin,
+                           end - begin, part);
+
+    struct point* tmp = malloc((n + 1) * sizeof *tmp);
+    if (tmp) n = monotone_chain(part, n, tmp);
+    free(tmp);
+
+    pthread_mutex_lock(&job->lock);
+    if (!tmp) job->failed = true;
+    job->part_begin[job->n_parts] = begin;
+    job->part_size[job->n_parts]  = n;
+    ++job->n_parts;
+    pthread_mutex_unlock(&job->lock);
+}
+
+// Folds the chunk into the hull, and empties it.
+static bool fold_chunk(tri_hull_t h)
+{
+    struct chunk_job job = {
+        .h      = h,
+        .filter = choose_filter(),
+    };
+    pthread_mutex_init(&job.lock, NULL);
+
+    // The hull so far contains every earlier extreme point.
+    for (size_t i = 0; i < h->size; ++i)
+        extremes_add(&job.ext, h->hull[i].x, h->hull[i].y);
+
+    parallel_for(h->n, h->threads, MIN_CHUNK, extremes_worker, &job);
+    make_octagon(&job.oct, &job.ext);
+    parallel_for(h->n, h->threads, MIN_CHUNK, hull_worker, &job);
+
+    pthread_mutex_destroy(&job.lock);
+    if (job.failed) return false;
+
+    // Merge the partial hulls with the hull so far.
+    size_t total = h->size;
+    for (size_t k = 0; k < job.n_parts; ++k) total += job.part_size[k];
+
+    struct point* all = malloc((total + 1) * sizeof *all);
+    struct point* tmp = malloc((total + 1) * sizeof *tmp);
+    if (!all || !tmp) {
+        free(all);
+        free(tmp);
+        return false;
+    }
+
+    memcpy(all, h->hull, h->size * sizeof *all);
+    size_t n = h->size;
+    for (size_t k = 0; k < job.n_parts; ++k) {
+        memcpy(all + n, h->kept + job.part_begin[k],
+               job.part_size[k] * sizeof *all);
+        n += job.part_size[k];
+    }
+
+    h->size = monotone_chain(all, n, tmp);
+    free(tmp);
+    free(h->hull);
+
+    // Give back the room the inputs took.
+    struct point* fit = realloc(all, (h->size ? h->size : 1) * sizeof *fit);
+    h->hull = fit ? fit : all;
+
+    h->n = 0;
+    return true;
+}
+
+bool th_add_batch(tri_hull_t h, c_tri_batch_t batch)
+{
+    size_t n = 3 * tb_count(batch);
+    const double* xs = tb_const_xs(batch);
+    const double* ys = tb_const_ys(batch);
+
+    for (size_t i = 0; i < n; ++i) {
+        if (!isfinite(xs[i]) || !isfinite(ys[i])) continue;
+
+        if (h->n == CHUNK_SIZE && !fold_chunk(h)) return false;
+
+        h->xs[h->n] = xs[i];
+        h->ys[h->n] = ys[i];
+        ++h->n;
+        ++h->seen;
+    }
+
+    return true;
+}
+
+bool th_finish(tri_hull_t h)
+{
+    return fold_chunk(h);
+}
+
+
+//
+// Queries
+//
+
+size_t th_vertex_count(c_tri_hull_t h)
+{
+    return h->seen;
+}
+
+size_t th_size(c_tri_hull_t h)
+{
+    return h->size;
+}
+
+void th_get(c_tri_hull_t h, size_t i, double* x, double* y)
+{
+    *x = h->hull[i].x;
+    *y = h->hull[i].y;
+}
@@ -0,0 +1,57 @@
+// The convex hull of the vertices of a triangle stream.
+
+#pragma once
+
+#include "tri_batch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A hull builder accepts triangles a batch at a time and keeps only the
+ * convex hull of their vertices so far, plus a bounded chunk of
+ * vertices that it hasn't folded into the hull yet, so memory doesn't
+ * grow with the input.
+ *
+ * Each full chunk is split among threads. Vertices strictly inside the
+ * octagon spanned by the extreme points in eight directions (the
+ * Akl-Toussaint heuristic) can't be on the hull and are dropped, several
+ * at a time with AVX2 or AVX-512 where available; each thread then finds
+ * the hull of its survivors by Andrew's monotone chain, and those
+ * partial hulls are merged with the hull so far the same way.
+ *
+ * Vertices with NaN or infinite coordinates are ignored. The hull's
+ * vertices are strictly convex: points along its edges aren't included.
+ */
+
+typedef        struct tri_hull*    tri_hull_t;
+typedef  const struct tri_hull*  c_tri_hull_t;
+
+
+// Returns a new, empty hull builder that uses up to `threads` threads.
+// Returns NULL on allocation error.
+tri_hull_t th_create(int threads);
+
+// Deallocates a hull builder. Allows NULL.
+void th_destroy(tri_hull_t);
+
+// Adds the vertices of all the triangles of `batch` (which it borrows).
+// Returns false on allocation error.
+//
+// PRECONDITION: `th_finish()` hasn't been called yet.
+bool th_add_batch(tri_hull_t, c_tri_batch_t batch);
+
+// Folds the remaining vertices into the hull. Call at most once.
+// Returns false on allocation error.
+bool th_finish(tri_hull_t);
+
+// The number of vertices added so far (not counting ignored ones).
+size_t th_vertex_count(c_tri_hull_t);
+
+// After `th_finish()`: the number of vertices of the hull, and vertex
+// `i` of them. Vertices are in counterclockwise order, starting from
+// the one with the least x (and then the least y).
+//
+// PRECONDITION: i < th_size(h)   (UB otherwise)
+size_t th_size(c_tri_hull_t);
+void th_get(c_tri_hull_t, size_t i, double* x, double* y);
@@ -0,0 +1,906 @@
+#include "tri_overlap.h"
+#include "parallel.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#   define HAVE_X86_SIMD
+#   include <immintrin.h>
+#endif
+
+// Initial capacity for triangles, for each worker's pairs, and for
+// each worker's sweep arrays.
+#define INITIAL_TRIS   1024
+#define INITIAL_PAIRS  256
+#define INITIAL_SWEEP  1024
+// Largest triangle count, so numbers fit in 32 bits.
+#define MAX_COUNT      ((size_t) UINT32_MAX - 1)
+// Widest kernel, and so the padding after the sweep arrays.
+#define MAX_LANES      8
+// Strips are about this many times the mean triangle height...
+#define STRIP_HEIGHTS  4
+// ...but hold this many triangles on average, at least.
+#define MIN_PER_STRIP  64
+// Don't split loops over triangles finer than this.
+#define MIN_CHUNK      16384
+
+struct tri_overlap
+{
+    // Input, in input order: x0, x1, x2, y0, y1, y2. `to_find()` makes
+    // every triangle counterclockwise and notes which are `usable` (not
+    // degenerate).
+    size_t     n, cap;
+    double*    coords[6];
+    uint8_t*   usable;
+
+    // The narrow-phase kernel `to_find()` uses.
+    enum to_kernel  kernel;
+
+    // Results of `to_find()`: (a << 32 | b) for each pair.
+    size_t     n_pairs;
+    uint64_t*  pairs;
+};
+
+// The triangles of one strip sorted by least x, in structure-of-arrays
+// form, with MAX_LANES entries of padding at the end that never overlap
+// anything.
+struct sweep
+{
+    size_t     n, cap;
+    double*    xmin;
+    double*    xmax;
+    double*    ymin;
+    double*    ymax;
+    double*    xs[3];
+    double*    ys[3];
+    uint32_t*  ids;
+};
+
+// A triangle being compared against candidates.
+struct query
+{
+    double  xs[3], ys[3];
+    double  exs[3], eys[3];     // edge k runs from vertex k to k + 1
+    double  xmax, ymin, ymax;
+};
+
+// Compares a query against candidates `j` to `j + lanes - 1`, returning
+// a bit mask of those it overlaps.
+typedef unsigned overlap_kernel(const struct sweep*, const struct query*,
+                                size_t j);
+
+struct kernel
+{
+    overlap_kernel*  fn;
+    size_t           lanes;
+};
+
+// A growable list of pairs, or just a count of them if `keep` is false.
+struct pair_list
+{
+    bool       keep;
+    size_t     len, cap;
+    uint64_t*  data;
+};
+
+// The broad phase divides the y range of the triangles into strips of
+// equal height, and lists each triangle in every strip it reaches, in
+// order of least x. Overlapping triangles must be in a strip together,
+// and then only candidates close in x need to be tested.
+struct strips
+{
+    double     y0, height;
+    size_t     n;
+    size_t*    starts;    // strip s is entries[starts[s]..starts[s + 1])
+    uint32_t*  entries;   // triangle numbers
+};
+
+// The state shared by sweep workers.
+struct sweep_job
+{
+    c_tri_overlap_t        o;
+    const struct strips*   strips;
+    struct kernel          kernel;
+    pthread_mutex_t        lock;
+    size_t                 next;      // next strip to claim
+    struct pair_list       all;
+    bool                   failed;
+};
+
+
+//
+// Geometry
+//
+
+// Makes the triangle counterclockwise. Returns false if it's degenerate
+// (or has NaN coordinates).
+static bool orient(double xs[3], double ys[3])
+{
+    double area2 = (xs[1] - xs[0]) * (ys[2] - ys[0]) -
+                   (ys[1] - ys[0]) * (xs[2] - xs[0]);
+
+    if (area2 < 0) {
+        double t = xs[1]; xs[1] = xs[2]; xs[2] = t;
+        t = ys[1]; ys[1] = ys[2]; ys[2] = t;
+    }
+
+    return area2 != 0 && !isnan(area2);
+}
+
+static double min3(const double v[3])
+{
+    double m = v[0] < v[1] ? v[0] : v[1];
+    return m < v[2] ? m : v[2];
+}
+
+static double max3(const double v[3])
+{
+    double m = v[0] > v[1] ? v[0] : v[1];
+    return m > v[2] ? m : v[2];
+}
+
+static void make_query(struct query* q, const double xs[3], const double ys[3])
+{
+    for (int k = 0; k < 3; ++k) {
+        q->xs[k]  = xs[k];
+        q->ys[k]  = ys[k];
+        q->exs[k] = xs[(k + 1) % 3] - xs[k];
+        q->eys[k] = ys[(k + 1) % 3] - ys[k];
+    }
+
+    q->xmax = max3(xs);
+    q->ymin = min3(ys);
+    q->ymax = max3(ys);
+}
+
+// Is every vertex of one triangle on the outer side of (or on) edge k
+// of the other? All the kernels compute exactly this, in this order,
+// rounding each product (no fused multiply-adds):
+//
+//     ex * (vy - py) - ey * (vx - px) <= 0
+//
+// Two convex polygons have disjoint interiors exactly when one of their
+// edges separates them in this way.
+static bool separates(double px, double py, double ex, double ey,
+                      const double vxs[3], const double vys[3])
+{
+    for (int v = 0; v < 3; ++v)
+        if (ex * (vys[v] - py) - ey * (vxs[v] - px) > 0) return false;
+    return true;
+}
+
+// The narrow phase for one candidate, both triangles counterclockwise.
+static bool overlaps_one(const struct query* q,
+                         const double bxs[3], const double bys[3])
+{
+    for (int k = 0; k < 3; ++k)
+        if (separates(q->xs[k], q->ys[k], q->exs[k], q->eys[k], bxs, bys))
+            return false;
+
+    for (int k = 0; k < 3; ++k) {
+        int k1 = (k + 1) % 3;
+        if (separates(bxs[k], bys[k], bxs[k1] - bxs[k], bys[k1] - bys[k],
+                      q->xs, q->ys))
+            return false;
+    }
+
+    return true;
+}
+
+bool tri_interiors_overlap(const double axs[3], const double ays[3],
+                           const double bxs[3], const double bys[3])
+{
+    double ax[3], ay[3], bx[3], by[3];
+    memcpy(ax, axs, sizeof ax);
+    memcpy(ay, ays, sizeof ay);
+    memcpy(bx, bxs, sizeof bx);
+    memcpy(by, bys, sizeof by);
+
+    if (!orient(ax, ay) || !orient(bx, by)) return false;
+
+    struct query q;
+    make_query(&q, ax, ay);
+    return overlaps_one(&q, bx, by);
+}
+
+
+//
+// Kernels
+//
+
+// Whether candidate `j` passes the bounding-box test against `q`. (Its
+// least x is known not to be below the query's.) Boxes that only touch
+// can't hold overlapping interiors, so the comparisons are strict.
+static bool boxes_meet(const struct sweep* s, const struct query* q, size_t j)
+{
+    return s->xmin[j] < q->xmax &&
+           s->ymin[j] < q->ymax && s->ymax[j] > q->ymin;
+}
+
+static unsigned overlap_scalar(const struct sweep* s, const struct query* q,
+                               size_t j)
+{
+    unsigned mask = 0;
+
+    for (unsigned l = 0; l < 4; ++l) {
+        size_t c = j + l;
+        if (!boxes_meet(s, q, c)) continue;
+
+        double bxs[3] = { s->xs[0][c], s->xs[1][c], s->xs[2][c] };
+        double bys[3] = { s->ys[0][c], s->ys[1][c], s->ys[2][c] };
+        if (overlaps_one(q, bxs, bys)) mask |= 1u << l;
+    }
+
+    return mask;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("avx2")))
+static unsigned overlap_avx2(const struct sweep* s, const struct query* q,
+                             size_t j)
+{
+    const __m256d zero = _mm256_setzero_pd();
+
+    __m256d ok = _mm256_and_pd(
+        _mm256_cmp_pd(_mm256_loadu_pd(s->xmin + j),
+                      _mm256_set1_pd(q->xmax), _CMP_LT_OQ),
+        _mm256_and_pd(
+            _mm256_cmp_pd(_mm256_loadu_pd(s->ymin + j),
+                          _mm256_set1_pd(q->ymax), _CMP_LT_OQ),
+            _mm256_cmp_pd(_mm256_loadu_pd(s->ymax + j),
+                          _mm256_set1_pd(q->ymin), _CMP_GT_OQ)));
+
+    if (!_mm256_movemask_pd(ok)) return 0;
+
+    __m256d bx[3], by[3];
+    for (int v = 0; v < 3; ++v) {
+        bx[v] = _mm256_loadu_pd(s->xs[v] + j);
+        by[v] = _mm256_loadu_pd(s->ys[v] + j);
+    }
+
+    // The query's edges against the candidates' vertices.
+    for (int k = 0; k < 3; ++k) {
+        __m256d px = _mm256_set1_pd(q->xs[k]),  py = _mm256_set1_pd(q->ys[k]);
+        __m256d ex = _mm256_set1_pd(q->exs[k]), ey = _mm256_set1_pd(q->eys[k]);
+        __m256d sep = ok;
+
+        for (int v = 0; v < 3; ++v) {
+            __m256d c = _mm256_sub_pd(
+                _mm256_mul_pd(ex, _mm256_sub_pd(by[v], py)),
+                _mm256_mul_pd(ey, _mm256_sub_pd(bx[v], px)));
+            sep = _mm256_and_pd(sep, _mm256_cmp_pd(c, zero, _CMP_LE_OQ));
+        }
+
+        ok = _mm256_andnot_pd(sep, ok);
+    }
+
+    // The candidates' edges against the query's vertices.
+    for (int k = 0; k < 3; ++k) {
+        int k1 = (k + 1) % 3;
+        __m256d px = bx[k], py = by[k];
+        __m256d ex = _mm256_sub_pd(bx[k1], bx[k]);
+        __m256d ey = _mm256_sub_pd(by[k1], by[k]);
+        __m256d sep = ok;
+
+        for (int v = 0; v < 3; ++v) {
+            __m256d c = _mm256_sub_pd(
+                _mm256_mul_pd(ex, _mm256_sub_pd(_mm256_set1_pd(q->ys[v]), py)),
+                _mm256_mul_pd(ey, _mm256_sub_pd(_mm256_set1_pd(q->xs[v]), px)));
+            sep = _mm256_and_pd(sep, _mm256_cmp_pd(c, zero, _CMP_LE_OQ));
+        }
+
+        ok = _mm256_andnot_pd(sep, ok);
+    }
+
+    return (unsigned) _mm256_movemask_pd(ok);
+}
+
+__attribute__((target("avx512f")))
+static unsigned overlap_avx512(const struct sweep* s, const struct query* q,
+                               size_t j)
+{
+    const __m512d zero = _mm512_setzero_pd();
+
+    __mmask8 ok =
+        _mm512_cmp_pd_mask(_mm512_loadu_pd(s->xmin + j),
+                           _mm512_set1_pd(q->xmax), _CMP_LT_OQ) &
+        _mm512_cmp_pd_mask(_mm512_loadu_pd(s->ymin + j),
+                           _mm512_set1_pd(q->ymax), _CMP_LT_OQ) &
+        _mm512_cmp_pd_mask(_mm512_loadu_pd(s->ymax + j),
+                           _mm512_set1_pd(q->ymin), _CMP_GT_OQ);
+
+    if (!ok) return 0;
+
+    __m512d bx[3], by[3];
+    for (int v = 0; v < 3; ++v) {
+        bx[v] = _mm512_loadu_pd(s->xs[v] + j);
+        by[v] = _mm512_loadu_pd(s->ys[v] + j);
+    }
+
+    for (int k = 0; k < 3; ++k) {
+        __m512d px = _mm512_set1_pd(q->xs[k]),  py = _mm512_set1_pd(q->ys[k]);
+        __m512d ex = _mm512_set1_pd(q->exs[k]), ey = _mm512_set1_pd(q->eys[k]);
+        __mmask8 sep = ok;
+
+        for (int v = 0; v < 3; ++v) {
+            __m512d c = _mm512_sub_pd(
+                _mm512_mul_pd(ex, _mm512_sub_pd(by[v], py)),
+                _mm512_mul_pd(ey, _mm512_sub_pd(bx[v], px)));
+            sep &= _mm512_cmp_pd_mask(c, zero, _CMP_LE_OQ);
+        }
+
+        ok &= (__mmask8) ~sep;
+    }
+
+    for (int k = 0; k < 3; ++k) {
+        int k1 = (k + 1) % 3;
+        __m512d px = bx[k], py = by[k];
+        __m512d ex = _mm512_sub_pd(bx[k1], bx[k]);
+        __m512d ey = _mm512_sub_pd(by[k1], by[k]);
+        __mmask8 sep = ok;
+
+        for (int v = 0; v < 3; ++v) {
+            __m512d c = _mm512_sub_pd(
+                _mm512_mul_pd(ex, _mm512_sub_pd(_mm512_set1_pd(q->ys[v]), py)),
+                _mm512_mul_pd(ey, _mm512_sub_pd(_mm512_set1_pd(q->xs[v]), px)));
+            sep &= _mm512_cmp_pd_mask(c, zero, _CMP_LE_OQ);
+        }
+
+        ok &= (__mmask8) ~sep;
+    }
+
+    return ok;
+}
+
+#endif // HAVE_X86_SIMD
+
+// Looks up kernel `k`, returning false if this CPU doesn't support it.
+static bool find_kernel(enum to_kernel k, struct kernel* out)
+{
+    switch (k) {
+#ifdef HAVE_X86_SIMD
+    case TO_KERNEL_AVX512:
+        if (!__builtin_cpu_supports("avx512f")) return false;
+        *out = (struct kernel) { overlap_avx512, 8 };
+        return true;
+
+    case TO_KERNEL_AVX2:
+        if (!__builtin_cpu_supports("avx2")) return false;
+        *out = (struct kernel) { overlap_avx2, 4 };
+        return true;
+#endif // HAVE_X86_SIMD
+
+    case TO_KERNEL_SCALAR:
+        *out = (struct kernel) { overlap_scalar, 4 };
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// The fastest kernel this CPU supports.
+static enum to_kernel choose_kernel(void)
+{
+    struct kernel unused;
+
+    if (find_kernel(TO_KERNEL_AVX512, &unused)) return TO_KERNEL_AVX512;
+    if (find_kernel(TO_KERNEL_AVX2, &unused)) return TO_KERNEL_AVX2;
+    return TO_KERNEL_SCALAR;
+}
+
+
+//
+// Building up
+//
+
+tri_overlap_t to_create(void)
+{
+    tri_overlap_t o = calloc(1, sizeof *o);
+    if (!o) return NULL;
+
+    o->kernel = choose_kernel();
+    o->cap = INITIAL_TRIS;
+    for (int k = 0; k < 6; ++k) {
+        o->coords[k] = malloc(o->cap * sizeof(double));
+        if (!o->coords[k]) {
+            to_destroy(o);
+            return NULL;
+        }
+    }
+
+    return o;
+}
+
+void to_destroy(tri_overlap_t o)
+{
+    if (!o) return;
+
+    for (int k = 0; k < 6; ++k) free(o->coords[k]);
+    free(o->usable);
+    free(o->pairs);
+    free(o);
+}
+
+bool to_add_batch(tri_overlap_t o, c_tri_batch_t batch)
+{
+    size_t n = tb_count(batch);
+    if (n > MAX_COUNT - o->n) return false;
+
+    if (o->n + n > o->cap) {
+        size_t cap = o->cap;
+        while (cap < o->n + n) cap *= 2;
+
+        for (int k = 0; k < 6; ++k) {
+            double* bigger = realloc(o->coords[k], cap * sizeof(double));
+            if (!bigger) return false;
+            o->coords[k] = bigger;
+        }
+
+        o->cap = cap;
+    }
+
+    const double* xs = tb_const_xs(batch);
+    const double* ys = tb_const_ys(batch);
+
+    for (size_t i = 0; i < n; ++i) {
+        for (int v = 0; v < 3; ++v) {
+            o->coords[v][o->n + i]     = xs[3 * i + v];
+            o->coords[3 + v][o->n + i] = ys[3 * i + v];
+        }
+    }
+
+    o->n += n;
+    return true;
+}
+
+
+//
+// Broad phase
+//
+
+// Maps a double to a uint64 such that a <= b implies f(a) <= f(b).
+static uint64_t ordered_bits(double d)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof bits);
+    return (bits >> 63) ? ~bits : bits | (UINT64_C(1) << 63);
+}
+
+struct sort_item
+{
+    uint64_t  key;
+    uint32_t  id;
+};
+
+// Sorts by key with a stable LSD radix sort on 16-bit digits, skipping
+// digits that are the same for every item. Returns false on allocation
+// error.
+static bool radix_sort(struct sort_item** items, size_t n)
+{
+    struct sort_item* tmp = malloc((n ? n : 1) * sizeof *tmp);
+    size_t* counts = malloc((1 << 16) * sizeof *counts);
+    if (!tmp || !counts) {
+        free(tmp);
+        free(counts);
+        return false;
+    }
+
+    struct sort_item* src = *items;
+
+    for (int shift = 0; shift < 64; shift += 16) {
+        memset(counts, 0, (1 << 16) * sizeof *counts);
+        for (size_t i = 0; i < n; ++i) ++counts[(src[i].key >> shift) & 0xFFFF];
+
+        if (n && counts[(src[0].key >> shift) & 0xFFFF] == n) continue;
+
+        size_t sum = 0;
+        for (size_t d = 0; d < (1 << 16); ++d) {
+            size_t c = counts[d];
+            counts[d] = sum;
+            sum += c;
+        }
+
+        for (size_t i = 0; i < n; ++i)
+            tmp[counts[(src[i].key >> shift) & 0xFFFF]++] = src[i];
+
+        struct sort_item* t = src;
+        src = tmp;
+        tmp = t;
+    }
+
+    *items = src;
+    free(tmp);
+    free(counts);
+    return true;
+}
+
+static void get_tri(c_tri_overlap_t o, size_t i, double xs[3], double ys[3])
+{
+    for (int v = 0; v < 3; ++v) {
+        xs[v] = o->coords[v][i];
+        ys[v] = o->coords[3 + v][i];
+    }
+}
+
+// Makes triangles counterclockwise and notes which are usable.
+static void orient_range(size_t begin, size_t end, void* env)
+{
+    tri_overlap_t o = env;
+
+    for (size_t i = begin; i < end; ++i) {
+        double xs[3], ys[3];
+        get_tri(o, i, xs, ys);
+        o->usable[i] = orient(xs, ys);
+
+        for (int v = 0; v < 3; ++v) {
+            o->coords[v][i]     = xs[v];
+            o->coords[3 + v][i] = ys[v];
+        }
+    }
+}
+
+static size_t strip_of(const struct strips* st, double y)
+{
+    double f = (y - st->y0) / st->height;
+    if (!(f >= 0)) return 0;
+    if (f >= (double) (st->n - 1)) return st->n - 1;
+    return (size_t) f;
+}
+
+static void strips_free(struct strips* st)
+{
+    free(st->starts);
+    free(st->entries);
+}
+
+// Lays out `*st` for the usable triangles of `o`. Returns false on
+// allocation error.
+static bool strips_init(struct strips* st, c_tri_overlap_t o)
+{
+    memset(st, 0, sizeof *st);
+
+    double y0 = INFINITY, y1 = -INFINITY, heights = 0;
+    size_t n = 0;
+
+    for (size_t i = 0; i < o->n; ++i) {
+        if (!o->usable[i]) continue;
+
+        double xs[3], ys[3];
+        get_tri(o, i, xs, ys);
+
+        double lo = min3(ys), hi = max3(ys);
+        if (lo < y0) y0 = lo;
+        if (hi > y1) y1 = hi;
+        heights += hi - lo;
+        ++n;
+    }
+
+    if (!n) return true;
+
+    size_t max_strips = n / MIN_PER_STRIP + 1;
+    double height = STRIP_HEIGHTS * heights / n;
+    if (!(height > 0) || (y1 - y0) / height > max_strips)
+        height = (y1 - y0) / max_strips;
+    if (!(height > 0)) height = 1;
+
+    st->y0     = y0;
+    st->height = height;
+    st->n      = 1;
+    while (st->n < max_strips && y0 + st->n * height < y1) ++st->n;
+
+    // Sort by least x, then deal out to strips in that order.
+    struct sort_item* order = malloc(n * sizeof *order);
+    st->starts = calloc(st->n + 1, sizeof(size_t));
+    size_t* fill = malloc(st->n * sizeof(size_t));
+    if (!order || !st->starts || !fill) goto fail;
+
+    for (size_t i = 0, k = 0; i < o->n; ++i) {
+        if (!o->usable[i]) continue;
+
+        double xs[3], ys[3];
+        get_tri(o, i, xs, ys);
+        order[k].key = ordered_bits(min3(xs));
+        order[k].id  = (uint32_t) i;
+        ++k;
+    }
+
+    if (!radix_sort(&order, n)) goto fail;
+
+    for (size_t k = 0; k < n; ++k) {
+        double xs[3], ys[3];
+        get_tri(o, order[k].id, xs, ys);
+
+        size_t last = strip_of(st, max3(ys));
+        for (size_t s = strip_of(st, min3(ys)); s <= last; ++s)
+            ++st->starts[s + 1];
+    }
+
+    for (size_t s = 0; s < st->n; ++s) {
+        st->starts[s + 1] += st->starts[s];
+        fill[s] = st->starts[s];
+    }
+
+    st->entries = malloc((st->starts[st->n] + 1) * sizeof(uint32_t));
+    if (!st->entries) goto fail;
+
+    for (size_t k = 0; k < n; ++k) {
+        double xs[3], ys[3];
+        get_tri(o, order[k].id, xs, ys);
+
+        size_t last = strip_of(st, max3(ys));
+        for (size_t s = strip_of(st, min3(ys)); s <= last; ++s)
+            st->entries[fill[s]++] = order[k].id;
+    }
+
+    free(order);
+    free(fill);
+    return true;
+
+fail:
+    free(order);
+    free(fill);
+    strips_free(st);
+    return false;
+}
+
+static void sweep_free(struct sweep* s)
+{
+    free(s->xmin);
+    free(s->xmax);
+    free(s->ymin);
+    free(s->ymax);
+    for (int v = 0; v < 3; ++v) {
+        free(s->xs[v]);
+        free(s->ys[v]);
+    }
+    free(s->ids);
+}
+
+static bool grow(void* pp, size_t cap, size_t size)
+{
+    void** p = pp;
+    void* bigger = realloc(*p, cap * size);
+    if (!bigger) return false;
+
+    *p = bigger;
+    return true;
+}
+
+// Loads the `n` triangles listed in `ids` into `*s`, growing it as
+// needed. Returns false on allocation error.
+static bool sweep_load(struct sweep* s, c_tri_overlap_t o,
+                       const uint32_t* ids, size_t n)
+{
+    size_t len = n + MAX_LANES;
+
+    if (len > s->cap) {
+        size_t cap = s->cap ? s->cap : INITIAL_SWEEP;
+        while (cap < len) cap *= 2;
+
+        bool ok = grow(&s->xmin, cap, sizeof(double)) &&
+                  grow(&s->xmax, cap, sizeof(double)) &&
+                  grow(&s->ymin, cap, sizeof(double)) &&
+                  grow(&s->ymax, cap, sizeof(double)) &&
+                  grow(&s->ids, cap, sizeof(uint32_t));
+
+        for (int v = 0; v < 3; ++v)
+            ok = ok && grow(&s->xs[v], cap, sizeof(double))
+                    && grow(&s->ys[v], cap, sizeof(double));
+
+        if (!ok) return false;
+        s->cap = cap;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        double xs[3], ys[3];
+        get_tri(o, ids[i], xs, ys);
+
+        for (int v = 0; v < 3; ++v) {
+            s->xs[v][i] = xs[v];
+            s->ys[v][i] = ys[v];
+        }
+
+        s->ids[i]  = ids[i];
+        s->xmin[i] = min3(xs);
+        s->xmax[i] = max3(xs);
+        s->ymin[i] = min3(ys);
+        s->ymax[i] = max3(ys);
+    }
+
+    for (size_t i = n; i < len; ++i) {
+        for (int v = 0; v < 3; ++v) s->xs[v][i] = s->ys[v][i] = 0;
+        s->xmin[i] = s->xmax[i] = s->ymin[i] = INFINITY;
+        s->ymax[i] = -INFINITY;
+        s->ids[i]  = 0;
+    }
+
+    s->n = n;
+    return true;
+}
+
+static bool push_pair(struct pair_list* list, uint32_t a, uint32_t b)
+{
+    if (!list->keep) {
+        ++list->len;
+        return true;
+    }
+
+    if (list->len == list->cap) {
+        size_t cap = list->cap ? 2 * list->cap : INITIAL_PAIRS;
+        uint64_t* bigger = realloc(list->data, cap * sizeof *bigger);
+        if (!bigger) return false;
+
+        list->data = bigger;
+        list->cap  = cap;
+    }
+
+    list->data[list->len++] = a < b ? (uint64_t) a << 32 | b
+                                    : (uint64_t) b << 32 | a;
+    return true;
+}
+
+// Compares position `i` of strip `strip` with everything after it that
+// its x extent reaches. A pair in several strips together is reported
+// only by the strip holding the bottom of their common y range. Returns
+// false on allocation error.
+static bool sweep_one(const struct sweep* s, struct kernel kernel, size_t i,
+                      const struct strips* st, size_t strip,
+                      struct pair_list* out)
+{
+    double xs[3] = { s->xs[0][i], s->xs[1][i], s->xs[2][i] };
+    double ys[3] = { s->ys[0][i], s->ys[1][i], s->ys[2][i] };
+
+    struct query q;
+    make_query(&q, xs, ys);
+
+    for (size_t j = i + 1; j < s->n; j += kernel.lanes) {
+        unsigned mask = kernel.fn(s, &q, j);
+
+        for (; mask; mask &= mask - 1) {
+            size_t c = j + (size_t) __builtin_ctz(mask);
+            double bottom = s->ymin[i] > s->ymin[c] ? s->ymin[i] : s->ymin[c];
+
+            if (c < s->n && strip_of(st, bottom) == strip &&
+                    !push_pair(out, s->ids[i], s->ids[c]))
+                return false;
+        }
+
+        // Candidates are sorted by least x, so once one is out of reach,
+        // so are the rest.
+        if (!(s->xmin[j + kernel.lanes - 1] < q.xmax)) break;
+    }
+
+    return true;
+}
+
+static void sweep_worker(size_t begin, size_t end, void* env)
+{
+    (void) begin, (void) end;
+    struct sweep_job* job = env;
+    const struct strips* st = job->strips;
+
+    struct sweep s;
+    memset(&s, 0, sizeof s);
+    struct pair_list mine = { job->all.keep, 0, 0, NULL };
+    bool ok = true;
+
+    while (ok) {
+        pthread_mutex_lock(&job->lock);
+        size_t strip = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (strip >= st->n) break;
+
+        ok = sweep_load(&s, job->o, st->entries + st->starts[strip],
+                        st->starts[strip + 1] - st->starts[strip]);
+
+        for (size_t i = 0; i < s.n && ok; ++i)
+            ok = sweep_one(&s, job->kernel, i, st, strip, &mine);
+    }
+
+    pthread_mutex_lock(&job->lock);
+
+    if (ok && !mine.keep) {
+        job->all.len += mine.len;
+    } else if (ok && mine.len) {
+        size_t len = job->all.len + mine.len;
+        uint64_t* bigger = realloc(job->all.data, len * sizeof *bigger);
+
+        if (bigger) {
+            memcpy(bigger + job->all.len, mine.data,
+                   mine.len * sizeof *bigger);
+            job->all.data = bigger;
+            job->all.len  = job->all.cap = len;
+        } else {
+            ok = false;
+        }
+    }
+
+    if (!ok) job->failed = true;
+    pthread_mutex_unlock(&job->lock);
+
+    sweep_free(&s);
+    free(mine.data);
+}
+
+static int compare_pairs(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b;
+    return (x > y) - (x < y);
+}
+
+bool to_use_kernel(tri_overlap_t o, enum to_kernel k)
+{
+    struct kernel unused;
+    if (!find_kernel(k, &unused)) return false;
+
+    o->kernel = k;
+    return true;
+}
+
+bool to_find(tri_overlap_t o, int threads, bool keep_pairs)
+{
+    o->usable = malloc(o->n ? o->n : 1);
+    if (!o->usable) return false;
+
+    parallel_for(o->n, threads, MIN_CHUNK, orient_range, o);
+
+    struct strips st;
+    if (!strips_init(&st, o)) return false;
+
+    struct sweep_job job = {
+        .o      = o,
+        .strips = &st,
+        .all    = { keep_pairs, 0, 0, NULL },
+    };
+    find_kernel(o->kernel, &job.kernel);
+    pthread_mutex_init(&job.lock, NULL);
+
+    size_t workers = threads > 1 ? (size_t) threads : 1;
+    if (workers > st.n) workers = st.n ? st.n : 1;
+
+    parallel_for(workers, (int) workers, 1, sweep_worker, &job);
+
+    pthread_mutex_destroy(&job.lock);
+    strips_free(&st);
+
+    if (job.failed) {
+        free(job.all.data);
+        return false;
+    }
+
+    // Workers finish in any order; sorting makes the result the same
+    // whatever the thread count. (With no pairs there may be no array.)
+    if (keep_pairs && job.all.len)
+        qsort(job.all.data, job.all.len, sizeof(uint64_t), compare_pairs);
+
+    o->pairs   = job.all.data;
+    o->n_pairs = job.all.len;
+    return true;
+}
+
+
+//
+// Queries
+//
+
+size_t to_triangle_count(c_tri_overlap_t o)
+{
+    return o->n;
+}
+
+size_t to_pair_count(c_tri_overlap_t o)
+{
+    return o->n_pairs;
+}
+
+void to_pair(c_tri_overlap_t o, size_t i, uint32_t* a, uint32_t* b)
+{
+    *a = (uint32_t) (o->pairs[i] >> 32);
+    *b = (uint32_t) o->pairs[i];
+}
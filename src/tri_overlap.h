@@ -0,0 +1,71 @@
+// Finding overlapping triangles in a triangle stream.
+
+#pragma once
+
+#include "tri_batch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * An overlap finder accepts triangles a batch at a time and then finds
+ * every pair whose interiors intersect. Triangles that merely touch,
+ * like neighbors in a mesh sharing an edge or a vertex, don't overlap,
+ * and neither do degenerate (zero-area) triangles.
+ *
+ * The broad phase cuts the y range into strips a few triangles high
+ * and, within each strip, sweeps across the triangles in order of least
+ * x, so each is only compared with those nearby whose x extents reach
+ * it. The narrow phase tests a triangle against a run of those
+ * candidates at once with a separating-axis test vectorized across
+ * candidates (AVX-512 or AVX2 where available). Strips are divided
+ * among threads.
+ *
+ * Triangles are numbered from 0 in the order they're added.
+ */
+
+typedef        struct tri_overlap*    tri_overlap_t;
+typedef  const struct tri_overlap*  c_tri_overlap_t;
+
+// The narrow-phase kernels.
+enum to_kernel { TO_KERNEL_SCALAR, TO_KERNEL_AVX2, TO_KERNEL_AVX512 };
+
+
+// Returns a new, empty overlap finder. Returns NULL on allocation error.
+tri_overlap_t to_create(void);
+
+// Deallocates an overlap finder. Allows NULL.
+void to_destroy(tri_overlap_t);
+
+// Adds all the triangles of `batch` (which it borrows). Returns false
+// on allocation error, or once there are 2^32 - 1 triangles.
+//
+// PRECONDITION: `to_find()` hasn't been called yet.
+bool to_add_batch(tri_overlap_t, c_tri_batch_t batch);
+
+// Makes `to_find()` use kernel `k` rather than the fastest one this
+// CPU supports. (For comparison.) Returns false, changing nothing, if
+// the CPU doesn't support `k`.
+bool to_use_kernel(tri_overlap_t, enum to_kernel k);
+
+// Finds all overlapping pairs among the triangles added so far, using
+// up to `threads` threads, and keeps them if `keep_pairs` (or else just
+// counts them). Call at most once. Returns false on allocation error.
+bool to_find(tri_overlap_t, int threads, bool keep_pairs);
+
+// The number of triangles added so far.
+size_t to_triangle_count(c_tri_overlap_t);
+
+// After `to_find()`: the number of overlapping pairs found, and (if
+// they were kept) pair `i` of them, as triangle numbers `*a < *b`.
+// Pairs are ordered by `a` and then `b`.
+//
+// PRECONDITION: i < to_pair_count(o)   (UB otherwise)
+size_t to_pair_count(c_tri_overlap_t);
+void to_pair(c_tri_overlap_t, size_t i, uint32_t* a, uint32_t* b);
+
+// Do the interiors of the two triangles intersect? (The same test as
+// the narrow phase, one pair at a time.)
+bool tri_interiors_overlap(const double axs[3], const double ays[3],
+                           const double bxs[3], const double bys[3]);
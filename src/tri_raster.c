@@ -0,0 +1,906 @@
+#include "tri_raster.h"
+#include "parallel.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#   define HAVE_X86_SIMD
+#   include <immintrin.h>
+#endif
+
+// Initial capacity for triangles.
+#define INITIAL_TRIS   1024
+// Largest triangle count, so numbers fit in 32 bits.
+#define MAX_COUNT      ((size_t) UINT32_MAX - 1)
+// Largest number of cells.
+#define MAX_CELLS      ((size_t) UINT32_MAX)
+// Widest kernel, and so the padding after the cell centers.
+#define MAX_LANES      16
+// Tiles are TILE by TILE cells.
+#define TILE           64
+// Don't split loops over triangles finer than this.
+#define MIN_CHUNK      16384
+
+struct tri_raster
+{
+    size_t        width, height;
+    enum tr_mode  mode;
+    bool          windowed;
+    double        x0, y0, x1, y1;
+
+    // Input, in input order: x0, x1, x2, y0, y1, y2. `tr_render()` makes
+    // every triangle counterclockwise and notes which are `usable` (not
+    // degenerate and finite).
+    size_t        n, cap;
+    double*       coords[6];
+    uint8_t*      usable;
+
+    // The kernel `tr_render()` uses.
+    enum tr_kernel  kernel;
+
+    // The grid, one of them depending on the mode.
+    uint32_t*     counts;
+    float*        coverage;
+};
+
+// A triangle's three edge functions, set up for a kernel. Edge k runs
+// between (ax, ay) and (ax + dx, ay + dy) and has the function
+//
+//     E(x, y) = dx * (y - ay) - dy * (x - ax)
+//
+// which all the kernels compute exactly this way, rounding each product
+// (no fused multiply-adds). Each edge is taken from its lesser endpoint
+// (by x, then y) to its greater, whatever the triangle's direction, so
+// triangles sharing it compute the same E; then `s` (+1 or -1) is the
+// sign that makes it positive inside this triangle. A cell is inside if
+// s * E >= lo for every edge, and outside if s * E <= hi for some edge.
+// `reach` is how far E can vary from a cell's center to its corners.
+struct edges
+{
+    double  ax[3], ay[3], dx[3], dy[3], s[3], lo[3], hi[3], reach[3];
+};
+
+// Classifies `lanes` consecutive cells in a row: those whose centers
+// are at x = cx[0 .. lanes - 1] and y = cy. Returns the mask of those
+// inside, and stores the mask of those outside in `*outside`.
+typedef unsigned raster_kernel(const struct edges* e, const double* cx,
+                               double cy, unsigned* outside);
+
+struct kernel
+{
+    raster_kernel*  fn;
+    unsigned        lanes;
+};
+
+// The geometry of the grid, shared by the render workers.
+struct layout
+{
+    double      x0, y0, cw, ch;   // origin, cell width and height
+    double*     cx;               // cell centers, padded by MAX_LANES
+    double*     cy;
+    size_t      tiles_x, tiles_y;
+    size_t*     starts;           // tile t is entries[starts[t]..starts[t+1])
+    uint32_t*   entries;          // triangle numbers, in input order
+};
+
+// A worker's sums for the tile it's rendering: the cells [c0, c1) by
+// [r0, r1). A cell's count (in area mode, of triangles covering all of
+// it) is `uniform` plus the sum of its row of `diff` up to it; in area
+// mode, `part` adds the fractions of triangles covering some of it.
+struct tile_sums
+{
+    size_t    c0, c1, r0, r1;
+    int64_t   uniform;
+    int64_t   diff[TILE][TILE + 1];
+    double    part[TILE][TILE];
+};
+
+// The state shared by render workers.
+struct render_job
+{
+    tri_raster_t           r;
+    const struct layout*   lay;
+    struct kernel          kernel;
+    pthread_mutex_t        lock;
+    size_t                 next;     // next tile to claim
+    bool                   failed;
+};
+
+
+//
+// Geometry
+//
+
+// Makes the triangle counterclockwise. Returns false if it's degenerate
+// (or has NaN or infinite coordinates).
+static bool orient(double xs[3], double ys[3])
+{
+    double area2 = (xs[1] - xs[0]) * (ys[2] - ys[0]) -
+                   (ys[1] - ys[0]) * (xs[2] - xs[0]);
+
+    if (area2 < 0) {
+        double t = xs[1]; xs[1] = xs[2]; xs[2] = t;
+        t = ys[1]; ys[1] = ys[2]; ys[2] = t;
+    }
+
+    return area2 != 0 && isfinite(area2);
+}
+
+static double min3(const double v[3])
+{
+    double m = v[0] < v[1] ? v[0] : v[1];
+    return m < v[2] ? m : v[2];
+}
+
+static double max3(const double v[3])
+{
+    double m = v[0] > v[1] ? v[0] : v[1];
+    return m > v[2] ? m : v[2];
+}
+
+// Sets up the edges of a counterclockwise triangle. In count mode a
+// center exactly on an edge is inside only for the triangle with s = +1,
+// so exactly one of two triangles sharing the edge counts it; this is
+// the same as moving the center up by a tiny amount and left by a far
+// tinier one, which settles shared vertices too. In area mode, `lo` and
+// `hi` are how far E can vary from a cell's center to its corners.
+static void make_edges(struct edges* e, const double xs[3], const double ys[3],
+                       enum tr_mode mode, double cw, double ch)
+{
+    for (int k = 0; k < 3; ++k) {
+        int k1 = (k + 1) % 3;
+        bool forward = xs[k] < xs[k1] || (xs[k] == xs[k1] && ys[k] < ys[k1]);
+        int a = forward ? k : k1, b = forward ? k1 : k;
+
+        e->ax[k] = xs[a];
+        e->ay[k] = ys[a];
+        e->dx[k] = xs[b] - xs[a];
+        e->dy[k] = ys[b] - ys[a];
+        e->s[k]  = forward ? 1 : -1;
+        e->reach[k] = 0.5 * (fabs(e->dy[k]) * cw + fabs(e->dx[k]) * ch);
+
+        if (mode == TR_COUNT) {
+            // s * E > 0 is s * E >= the least positive double.
+            e->lo[k] = forward ? 0 : 4.9406564584124654e-324;
+            e->hi[k] = -INFINITY;
+        } else {
+            // Widened a little so rounding only sends borderline cells
+            // to be clipped exactly.
+            e->lo[k] = e->reach[k] * (1 + 1e-9);
+            e->hi[k] = -e->reach[k] * (1 + 1e-9);
+        }
+    }
+}
+
+// Clips the polygon `in` (n vertices) to the side of the line through
+// `at` on axis `axis` (0 for x, 1 for y) where the coordinate is >= `at`
+// (if `keep_above`) or <= it. Returns the new vertex count.
+static int clip(double in[][2], int n, double out[][2],
+                int axis, double at, bool keep_above)
+{
+    int m = 0;
+
+    for (int i = 0; i < n; ++i) {
+        const double* p = in[i];
+        const double* q = in[(i + 1) % n];
+        bool p_in = keep_above ? p[axis] >= at : p[axis] <= at;
+        bool q_in = keep_above ? q[axis] >= at : q[axis] <= at;
+
+        if (p_in) {
+            out[m][0] = p[0];
+            out[m][1] = p[1];
+            ++m;
+        }
+
+        if (p_in != q_in) {
+            double t = (at - p[axis]) / (q[axis] - p[axis]);
+            out[m][axis]     = at;
+            out[m][1 - axis] = p[1 - axis] + t * (q[1 - axis] - p[1 - axis]);
+            ++m;
+        }
+    }
+
+    return m;
+}
+
+// The fraction of the cell with lower-left corner (left, bottom) that
+// the counterclockwise triangle covers, by clipping it to the cell.
+static double cell_fraction(const double xs[3], const double ys[3],
+                            double left, double bottom, double cw, double ch)
+{
+    // Each clip adds at most one vertex.
+    double a[7][2], b[7][2];
+
+    // Relative to the corner, to keep the arithmetic small.
+    for (int v = 0; v < 3; ++v) {
+        a[v][0] = xs[v] - left;
+        a[v][1] = ys[v] - bottom;
+    }
+
+    int n = clip(a, 3, b, 0, 0, true);
+    n = clip(b, n, a, 0, cw, false);
+    n = clip(a, n, b, 1, 0, true);
+    n = clip(b, n, a, 1, ch, false);
+
+    double area2 = 0;
+    for (int i = 0; i < n; ++i) {
+        int j = (i + 1) % n;
+        area2 += a[i][0] * a[j][1] - a[j][0] * a[i][1];
+    }
+
+    return 0.5 * area2 / (cw * ch);
+}
+
+
+//
+// Kernels
+//
+
+static unsigned raster_scalar(const struct edges* e, const double* cx,
+                              double cy, unsigned* outside)
+{
+    unsigned in = 0, out = 0;
+
+    for (unsigned l = 0; l < 8; ++l) {
+        bool all_in = true, any_out = false;
+
+        for (int k = 0; k < 3; ++k) {
+            double v = e->s[k] * (e->dx[k] * (cy - e->ay[k]) -
+                                  e->dy[k] * (cx[l] - e->ax[k]));
+            all_in  = all_in && v >= e->lo[k];
+            any_out = any_out || v <= e->hi[k];
+        }
+
+        in  |= (unsigned) all_in << l;
+        out |= (unsigned) any_out << l;
+    }
+
+    *outside = out;
+    return in;
+}
+
+#ifdef HAVE_X86_SIMD
+
+// 8 cells, as two vectors of 4.
+__attribute__((target("avx2")))
+static unsigned raster_avx2(const struct edges* e, const double* cx,
+                            double cy, unsigned* outside)
+{
+    unsigned in = 0, out = 0;
+
+    for (int h = 0; h < 2; ++h) {
+        __m256d x = _mm256_loadu_pd(cx + 4 * h);
+        __m256d all_in  = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+        __m256d any_out = _mm256_setzero_pd();
+
+        for (int k = 0; k < 3; ++k) {
+            __m256d t = _mm256_sub_pd(
+                _mm256_set1_pd(e->dx[k] * (cy - e->ay[k])),
+                _mm256_mul_pd(_mm256_set1_pd(e->dy[k]),
+                              _mm256_sub_pd(x, _mm256_set1_pd(e->ax[k]))));
+            __m256d v = _mm256_mul_pd(_mm256_set1_pd(e->s[k]), t);
+
+            all_in = _mm256_and_pd(all_in, _mm256_cmp_pd(
+                         v, _mm256_set1_pd(e->lo[k]), _CMP_GE_OQ));
+            any_out = _mm256_or_pd(any_out, _mm256_cmp_pd(
+                          v, _mm256_set1_pd(e->hi[k]), _CMP_LE_OQ));
+        }
+
+        in  |= (unsigned) _mm256_movemask_pd(all_in) << 4 * h;
+        out |= (unsigned) _mm256_movemask_pd(any_out) << 4 * h;
+    }
+
+    *outside = out;
+    return in;
+}
+
+// 16 cells, as two vectors of 8.
+__attribute__((target("avx512f")))
+static unsigned raster_avx512(const struct edges* e, const double* cx,
+                              double cy, unsigned* outside)
+{
+    unsigned in = 0, out = 0;
+
+    for (int h = 0; h < 2; ++h) {
+        __m512d x = _mm512_loadu_pd(cx + 8 * h);
+        __mmask8 all_in = 0xFF, any_out = 0;
+
+        for (int k = 0; k < 3; ++k) {
+            __m512d t = _mm512_sub_pd(
+                _mm512_set1_pd(e->dx[k] * (cy - e->ay[k])),
+                _mm512_mul_pd(_mm512_set1_pd(e->dy[k]),
+                              _mm512_sub_pd(x, _mm512_set1_pd(e->ax[k]))));
+            __m512d v = _mm512_mul_pd(_mm512_set1_pd(e->s[k]), t);
+
+            all_in  &= _mm512_cmp_pd_mask(v, _mm512_set1_pd(e->lo[k]),
+                                          _CMP_GE_OQ);
+            any_out |= _mm512_cmp_pd_mask(v, _mm512_set1_pd(e->hi[k]),
+                                          _CMP_LE_OQ);
+        }
+
+        in  |= (unsigned) all_in << 8 * h;
+        out |= (unsigned) any_out << 8 * h;
+    }
+
+    *outside = out;
+    return in;
+}
+
+#endif // HAVE_X86_SIMD
+
+// Looks up kernel `k`, returning false if this CPU doesn't support it.
+static bool find_kernel(enum tr_kernel k, struct kernel* out)
+{
+    switch (k) {
+#ifdef HAVE_X86_SIMD
+    case TR_KERNEL_AVX512:
+        if (!__builtin_cpu_supports("avx512f")) return false;
+        *out = (struct kernel) { raster_avx512, 16 };
+        return true;
+
+    case TR_KERNEL_AVX2:
+        if (!__builtin_cpu_supports("avx2")) return false;
+        *out = (struct kernel) { raster_avx2, 8 };
+        return true;
+#endif // HAVE_X86_SIMD
+
+    case TR_KERNEL_SCALAR:
+        *out = (struct kernel) { raster_scalar, 8 };
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// The fastest kernel this CPU supports.
+static enum tr_kernel choose_kernel(void)
+{
+    struct kernel unused;
+
+    if (find_kernel(TR_KERNEL_AVX512, &unused)) return TR_KERNEL_AVX512;
+    if (find_kernel(TR_KERNEL_AVX2, &unused)) return TR_KERNEL_AVX2;
+    return TR_KERNEL_SCALAR;
+}
+
+
+//
+// Building
+//
+
+tri_raster_t tr_create(size_t width, size_t height, enum tr_mode mode)
+{
+    if (!width || !height || width > MAX_CELLS / height) return NULL;
+
+    tri_raster_t r = calloc(1, sizeof *r);
+    if (!r) return NULL;
+
+    r->width  = width;
+    r->height = height;
+    r->mode   = mode;
+    r->kernel = choose_kernel();
+
+    r->cap = INITIAL_TRIS;
+    for (int k = 0; k < 6; ++k) {
+        r->coords[k] = malloc(r->cap * sizeof(double));
+        if (!r->coords[k]) {
+            tr_destroy(r);
+            return NULL;
+        }
+    }
+
+    return r;
+}
+
+void tr_destroy(tri_raster_t r)
+{
+    if (!r) return;
+
+    for (int k = 0; k < 6; ++k) free(r->coords[k]);
+    free(r->usable);
+    free(r->counts);
+    free(r->coverage);
+    free(r);
+}
+
+void tr_set_window(tri_raster_t r, double x0, double y0, double x1, double y1)
+{
+    r->windowed = true;
+    r->x0 = x0;
+    r->y0 = y0;
+    r->x1 = x1;
+    r->y1 = y1;
+}
+
+bool tr_add_batch(tri_raster_t r, c_tri_batch_t batch)
+{
+    size_t n = tb_count(batch);
+    if (n > MAX_COUNT - r->n) return false;
+
+    if (r->n + n > r->cap) {
+        size_t cap = r->cap;
+        while (cap < r->n + n) cap *= 2;
+
+        for (int k = 0; k < 6; ++k) {
+            double* bigger = realloc(r->coords[k], cap * sizeof(double));
+            if (!bigger) return false;
+            r->coords[k] = bigger;
+        }
+
+        r->cap = cap;
+    }
+
+    const double* xs = tb_const_xs(batch);
+    const double* ys = tb_const_ys(batch);
+
+    for (size_t i = 0; i < n; ++i) {
+        for (int v = 0; v < 3; ++v) {
+            r->coords[v][r->n + i]     = xs[3 * i + v];
+            r->coords[3 + v][r->n + i] = ys[3 * i + v];
+        }
+    }
+
+    r->n += n;
+    return true;
+}
+
+
+//
+// Rendering
+//
+
+static void get_tri(c_tri_raster_t r, size_t i, double xs[3], double ys[3])
+{
+    for (int v = 0; v < 3; ++v) {
+        xs[v] = r->coords[v][i];
+        ys[v] = r->coords[3 + v][i];
+    }
+}
+
+// Makes triangles counterclockwise and notes which are usable.
+static void orient_range(size_t begin, size_t end, void* env)
+{
+    tri_raster_t r = env;
+
+    for (size_t i = begin; i < end; ++i) {
+        double xs[3], ys[3];
+        get_tri(r, i, xs, ys);
+        r->usable[i] = orient(xs, ys);
+
+        for (int v = 0; v < 3; ++v) {
+            r->coords[v][i]     = xs[v];
+            r->coords[3 + v][i] = ys[v];
+        }
+    }
+}
+
+// Fits the window to the usable triangles, unless it was set.
+static void fit_window(tri_raster_t r)
+{
+    if (r->windowed) return;
+
+    double x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+
+    for (size_t i = 0; i < r->n; ++i) {
+        if (!r->usable[i]) continue;
+
+        double xs[3], ys[3];
+        get_tri(r, i, xs, ys);
+
+        if (min3(xs) < x0) x0 = min3(xs);
+        if (max3(xs) > x1) x1 = max3(xs);
+        if (min3(ys) < y0) y0 = min3(ys);
+        if (max3(ys) > y1) y1 = max3(ys);
+    }
+
+    if (x0 > x1) x0 = y0 = 0, x1 = y1 = 1;
+
+    if (!(x0 < x1)) x0 -= 0.5, x1 += 0.5;
+    if (!(y0 < y1)) y0 -= 0.5, y1 += 0.5;
+
+    tr_set_window(r, x0, y0, x1, y1);
+}
+
+// Finds the cells, [lo, hi], that [from, to] reaches along an axis of
+// `n` cells of size `size` starting at `origin`. Returns false if none.
+static bool cell_range(double from, double to, double origin, double size,
+                       size_t n, size_t* lo, size_t* hi)
+{
+    double f = (from - origin) / size, t = (to - origin) / size;
+    if (!(t >= 0) || !(f < (double) n)) return false;
+
+    *lo = f > 0 ? (size_t) f : 0;
+    *hi = t < (double) n ? (size_t) t : n - 1;
+    return *lo <= *hi;
+}
+
+// Finds the cells that triangle `i`'s bounding box reaches. Returns
+// false if none.
+static bool cell_box(c_tri_raster_t r, const struct layout* lay, size_t i,
+                     size_t* c0, size_t* c1, size_t* r0, size_t* r1)
+{
+    double xs[3], ys[3];
+    get_tri(r, i, xs, ys);
+
+    return cell_range(min3(xs), max3(xs), lay->x0, lay->cw, r->width, c0, c1)
+        && cell_range(min3(ys), max3(ys), lay->y0, lay->ch, r->height, r0, r1);
+}
+
+static void layout_free(struct layout* lay)
+{
+    free(lay->cx);
+    free(lay->cy);
+    free(lay->starts);
+    free(lay->entries);
+}
+
+// Lays out `*lay` for the usable triangles of `r`, binning them into
+// tiles. Returns false on allocation error.
+static bool layout_init(struct layout* lay, c_tri_raster_t r)
+{
+    memset(lay, 0, sizeof *lay);
+
+    lay->x0 = r->x0;
+    lay->y0 = r->y0;
+    lay->cw = (r->x1 - r->x0) / r->width;
+    lay->ch = (r->y1 - r->y0) / r->height;
+    lay->tiles_x = (r->width + TILE - 1) / TILE;
+    lay->tiles_y = (r->height + TILE - 1) / TILE;
+
+    size_t tiles = lay->tiles_x * lay->tiles_y;
+
+    lay->cx = malloc((r->width + MAX_LANES) * sizeof(double));
+    lay->cy = malloc(r->height * sizeof(double));
+    lay->starts = calloc(tiles + 1, sizeof(size_t));
+    if (!lay->cx || !lay->cy || !lay->starts) goto fail;
+
+    for (size_t c = 0; c < r->width + MAX_LANES; ++c)
+        lay->cx[c] = lay->x0 + (c + 0.5) * lay->cw;
+    for (size_t row = 0; row < r->height; ++row)
+        lay->cy[row] = lay->y0 + (row + 0.5) * lay->ch;
+
+    // Count, then fill, in input order so that every tile adds up its
+    // triangles in the same order whatever the thread count.
+    for (int pass = 0; pass < 2; ++pass) {
+        for (size_t i = 0; i < r->n; ++i) {
+            size_t c0, c1, r0, r1;
+            if (!r->usable[i] || !cell_box(r, lay, i, &c0, &c1, &r0, &r1))
+                continue;
+
+            for (size_t ty = r0 / TILE; ty <= r1 / TILE; ++ty) {
+                for (size_t tx = c0 / TILE; tx <= c1 / TILE; ++tx) {
+                    size_t t = ty * lay->tiles_x + tx;
+                    if (pass == 0) ++lay->starts[t + 1];
+                    else lay->entries[lay->starts[t]++] = (uint32_t) i;
+                }
+            }
+        }
+
+        if (pass == 0) {
+            for (size_t t = 0; t < tiles; ++t)
+                lay->starts[t + 1] += lay->starts[t];
+
+            lay->entries = malloc((lay->starts[tiles] + 1) * sizeof(uint32_t));
+            if (!lay->entries) goto fail;
+        }
+    }
+
+    // Filling moved each start to the next tile's.
+    memmove(lay->starts + 1, lay->starts, tiles * sizeof(size_t));
+    lay->starts[0] = 0;
+    return true;
+
+fail:
+    layout_free(lay);
+    return false;
+}
+
+// Is the rectangle [x0, x1] by [y0, y1] inside the triangle by a margin
+// of at least a cell's reach?
+static bool rect_inside(const struct edges* e,
+                        double x0, double x1, double y0, double y1)
+{
+    for (int k = 0; k < 3; ++k) {
+        for (int corner = 0; corner < 4; ++corner) {
+            double x = corner & 1 ? x1 : x0, y = corner & 2 ? y1 : y0;
+            double v = e->s[k] * (e->dx[k] * (y - e->ay[k]) -
+                                  e->dy[k] * (x - e->ax[k]));
+            if (!(v >= e->reach[k])) return false;
+        }
+    }
+
+    return true;
+}
+
+// Estimates where in the row of cells centered at y = cy every edge has
+// s * E >= t[k], as a range of (fractional) column numbers. Returns
+// false if it's certainly empty. Rounding can move the ends a little,
+// so cells near them have to be classified by a kernel.
+static bool row_span(const struct edges* e, const double t[3], double cy,
+                     const struct layout* lay, double* from, double* to)
+{
+    double lo = -INFINITY, hi = INFINITY;
+
+    for (int k = 0; k < 3; ++k) {
+        // s * E = c - g * (x - ax), so it's the same along the row if
+        // g = 0, and computed just as the kernels do.
+        double c = e->s[k] * (e->dx[k] * (cy - e->ay[k]));
+        double g = e->s[k] * e->dy[k];
+
+        if (g == 0) {
+            if (!(c >= t[k])) return false;
+            continue;
+        }
+
+        double x = e->ax[k] + (c - t[k]) / g;
+        if (g > 0 && x < hi) hi = x;
+        if (g < 0 && x > lo) lo = x;
+    }
+
+    *from = (lo - lay->x0) / lay->cw - 0.5;
+    *to   = (hi - lay->x0) / lay->cw - 0.5;
+    return !isnan(*from) && !isnan(*to);
+}
+
+// Classifies the cells [c0, c1] of `row` with the kernel, adding the
+// triangle to those it covers.
+static void classify(const struct render_job* job, struct tile_sums* sums,
+                     const struct edges* e, const double xs[3],
+                     const double ys[3], size_t row, size_t c0, size_t c1)
+{
+    const struct layout* lay = job->lay;
+    unsigned lanes = job->kernel.lanes;
+    int64_t* diff = sums->diff[row - sums->r0];
+
+    for (size_t c = c0; c <= c1; c += lanes) {
+        unsigned outside;
+        unsigned inside = job->kernel.fn(e, lay->cx + c, lay->cy[row],
+                                         &outside);
+
+        unsigned valid = c1 - c + 1 >= lanes ? (1u << lanes) - 1
+                                             : (1u << (c1 - c + 1)) - 1;
+        unsigned partial = valid & ~inside & ~outside;
+        inside &= valid;
+
+        for (; inside; inside &= inside - 1) {
+            size_t col = c + (size_t) __builtin_ctz(inside) - sums->c0;
+            ++diff[col];
+            --diff[col + 1];
+        }
+
+        if (job->r->mode == TR_COUNT) continue;
+
+        for (; partial; partial &= partial - 1) {
+            size_t col = c + (size_t) __builtin_ctz(partial);
+            sums->part[row - sums->r0][col - sums->c0] += cell_fraction(
+                xs, ys, lay->x0 + col * lay->cw,
+                lay->y0 + row * lay->ch, lay->cw, lay->ch);
+        }
+    }
+}
+
+// Renders triangle `i` into the tile.
+static void render_one(const struct render_job* job, struct tile_sums* sums,
+                       size_t i)
+{
+    c_tri_raster_t r = job->r;
+    const struct layout* lay = job->lay;
+
+    double xs[3], ys[3];
+    get_tri(r, i, xs, ys);
+
+    struct edges e;
+    make_edges(&e, xs, ys, r->mode, lay->cw, lay->ch);
+
+    size_t c0, c1, r0, r1;
+    cell_box(r, lay, i, &c0, &c1, &r0, &r1);
+
+    // A tile wholly inside is common with big triangles.
+    if (c0 <= sums->c0 && c1 >= sums->c1 - 1 &&
+            r0 <= sums->r0 && r1 >= sums->r1 - 1 &&
+            rect_inside(&e, lay->x0 + sums->c0 * lay->cw,
+                        lay->x0 + sums->c1 * lay->cw,
+                        lay->y0 + sums->r0 * lay->ch,
+                        lay->y0 + sums->r1 * lay->ch)) {
+        ++sums->uniform;
+        return;
+    }
+
+    if (c0 < sums->c0) c0 = sums->c0;
+    if (r0 < sums->r0) r0 = sums->r0;
+    if (c1 > sums->c1 - 1) c1 = sums->c1 - 1;
+    if (r1 > sums->r1 - 1) r1 = sums->r1 - 1;
+
+    // Narrow rows take a step or two of the kernel anyway.
+    if (c1 - c0 < 2 * job->kernel.lanes) {
+        for (size_t row = r0; row <= r1; ++row)
+            classify(job, sums, &e, xs, ys, row, c0, c1);
+        return;
+    }
+
+    // Cells that aren't outside (or, in count mode, that are inside)...
+    const double* outer = r->mode == TR_COUNT ? e.lo : e.hi;
+
+    for (size_t row = r0; row <= r1; ++row) {
+        double from, to;
+        if (!row_span(&e, outer, lay->cy[row], lay, &from, &to)) continue;
+
+        // ...are all in [a, b], allowing for rounding.
+        double fa = fmax(floor(from) - 1, (double) c0);
+        double fb = fmin(ceil(to) + 1, (double) c1);
+        if (!(fa <= fb)) continue;
+        size_t a = (size_t) fa, b = (size_t) fb;
+
+        // Cells well inside the span of inside cells are inside without
+        // checking; the kernel classifies the rest, near the ends.
+        double f0 = 1, f1 = 0;
+        if (row_span(&e, e.lo, lay->cy[row], lay, &from, &to)) {
+            f0 = fmax(ceil(from) + 1, fa);
+            f1 = fmin(floor(to) - 1, fb);
+        }
+
+        if (!(f0 <= f1)) {
+            classify(job, sums, &e, xs, ys, row, a, b);
+            continue;
+        }
+
+        size_t in0 = (size_t) f0, in1 = (size_t) f1;
+
+        int64_t* diff = sums->diff[row - sums->r0];
+        ++diff[in0 - sums->c0];
+        --diff[in1 + 1 - sums->c0];
+
+        if (a < in0) classify(job, sums, &e, xs, ys, row, a, in0 - 1);
+        if (in1 < b) classify(job, sums, &e, xs, ys, row, in1 + 1, b);
+    }
+}
+
+// Adds up `*sums` into the grid, and clears it.
+static void finish_tile(tri_raster_t r, struct tile_sums* sums)
+{
+    for (size_t row = sums->r0; row < sums->r1; ++row) {
+        int64_t* diff = sums->diff[row - sums->r0];
+        double* part = sums->part[row - sums->r0];
+        int64_t full = sums->uniform;
+
+        for (size_t col = sums->c0; col < sums->c1; ++col) {
+            full += diff[col - sums->c0];
+            size_t i = row * r->width + col;
+
+            if (r->mode == TR_COUNT) r->counts[i] = (uint32_t) full;
+            else r->coverage[i] = (float) (full + part[col - sums->c0]);
+        }
+    }
+
+    sums->uniform = 0;
+    memset(sums->diff, 0, sizeof sums->diff);
+    memset(sums->part, 0, sizeof sums->part);
+}
+
+static void render_worker(size_t begin, size_t end, void* env)
+{
+    (void) begin, (void) end;
+    struct render_job* job = env;
+    const struct layout* lay = job->lay;
+    size_t tiles = lay->tiles_x * lay->tiles_y;
+
+    struct tile_sums* sums = calloc(1, sizeof *sums);
+    if (!sums) {
+        pthread_mutex_lock(&job->lock);
+        job->failed = true;
+        pthread_mutex_unlock(&job->lock);
+        return;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        size_t t = job->next++;
+        pthread_mutex_unlock(&job->lock);
+
+        if (t >= tiles) break;
+
+        sums->c0 = t % lay->tiles_x * TILE;
+        sums->r0 = t / lay->tiles_x * TILE;
+        sums->c1 = sums->c0 + TILE < job->r->width ? sums->c0 + TILE
+                                                   : job->r->width;
+        sums->r1 = sums->r0 + TILE < job->r->height ? sums->r0 + TILE
+                                                    : job->r->height;
+
+        // In input order, so that sums come out the same whatever the
+        // thread count.
+        for (size_t k = lay->starts[t]; k < lay->starts[t + 1]; ++k)
+            render_one(job, sums, lay->entries[k]);
+
+        finish_tile(job->r, sums);
+    }
+
+    free(sums);
+}
+
+bool tr_use_kernel(tri_raster_t r, enum tr_kernel k)
+{
+    struct kernel unused;
+    if (!find_kernel(k, &unused)) return false;
+
+    r->kernel = k;
+    return true;
+}
+
+bool tr_render(tri_raster_t r, int threads)
+{
+    size_t cells = r->width * r->height;
+
+    r->usable = malloc(r->n ? r->n : 1);
+    if (r->mode == TR_COUNT) r->counts = calloc(cells, sizeof(uint32_t));
+    else r->coverage = calloc(cells, sizeof(float));
+    if (!r->usable || (!r->counts && !r->coverage)) return false;
+
+    parallel_for(r->n, threads, MIN_CHUNK, orient_range, r);
+    fit_window(r);
+
+    struct layout lay;
+    if (!layout_init(&lay, r)) return false;
+
+    struct render_job job = {
+        .r      = r,
+        .lay    = &lay,
+    };
+    find_kernel(r->kernel, &job.kernel);
+    pthread_mutex_init(&job.lock, NULL);
+
+    size_t tiles = lay.tiles_x * lay.tiles_y;
+    size_t workers = threads > 1 ? (size_t) threads : 1;
+    if (workers > tiles) workers = tiles;
+
+    parallel_for(workers, (int) workers, 1, render_worker, &job);
+
+    pthread_mutex_destroy(&job.lock);
+    layout_free(&lay);
+    return !job.failed;
+}
+
+
+//
+// Queries
+//
+
+size_t tr_width(c_tri_raster_t r)
+{
+    return r->width;
+}
+
+size_t tr_height(c_tri_raster_t r)
+{
+    return r->height;
+}
+
+enum tr_mode tr_get_mode(c_tri_raster_t r)
+{
+    return r->mode;
+}
+
+size_t tr_triangle_count(c_tri_raster_t r)
+{
+    return r->n;
+}
+
+void tr_window(c_tri_raster_t r, double* x0, double* y0, double* x1, double* y1)
+{
+    *x0 = r->x0;
+    *y0 = r->y0;
+    *x1 = r->x1;
+    *y1 = r->y1;
+}
+
+const uint32_t* tr_counts(c_tri_raster_t r)
+{
+    return r->counts;
+}
+
+const float* tr_coverage(c_tri_raster_t r)
+{
+    return r->coverage;
+}
@@ -0,0 +1,86 @@
+// Rasterizing triangle streams into coverage grids.
+
+#pragma once
+
+#include "tri_batch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A rasterizer accepts triangles a batch at a time and then renders
+ * them into a grid of `width` by `height` cells over a window of the
+ * plane, in one of two modes:
+ *
+ *   TR_COUNT   each cell counts the triangles containing its center;
+ *              triangles that share an edge or a vertex never both
+ *              count a center lying on it
+ *   TR_AREA    each cell sums the fractions of its area that the
+ *              triangles cover (so overlaps can take it past 1)
+ *
+ * Cell (col, row) covers [x0 + col * w, x0 + (col + 1) * w) by
+ * [y0 + row * h, y0 + (row + 1) * h), where w and h are the window's
+ * width and height divided by the grid's. Row 0 is at the bottom.
+ *
+ * Rendering bins the triangles into square tiles of cells and renders
+ * the tiles in parallel. A tile wholly inside a triangle takes it in one
+ * step; otherwise, in each row, cells near the ends of the triangle's
+ * span are classified by evaluating its edge functions over a run of
+ * cells at once (8 cells per step with AVX2, 16 with AVX-512), and the
+ * cells between are filled as a run. In area mode, only cells that an
+ * edge crosses are clipped exactly.
+ */
+
+typedef        struct tri_raster*    tri_raster_t;
+typedef  const struct tri_raster*  c_tri_raster_t;
+
+enum tr_mode { TR_COUNT, TR_AREA };
+
+// The kernels that classify runs of cells.
+enum tr_kernel { TR_KERNEL_SCALAR, TR_KERNEL_AVX2, TR_KERNEL_AVX512 };
+
+
+// Returns a new rasterizer with a `width` by `height` grid. Returns
+// NULL on allocation error, or if either size is 0 or the grid would
+// have more than 2^32 cells.
+tri_raster_t tr_create(size_t width, size_t height, enum tr_mode);
+
+// Deallocates a rasterizer. Allows NULL.
+void tr_destroy(tri_raster_t);
+
+// Sets the window that the grid covers, which otherwise is the bounding
+// box of the triangles (widened if it's empty in either direction).
+//
+// PRECONDITION: x0 < x1 && y0 < y1
+void tr_set_window(tri_raster_t, double x0, double y0, double x1, double y1);
+
+// Adds all the triangles of `batch` (which it borrows). Returns false
+// on allocation error, or once there are 2^32 - 1 triangles.
+//
+// PRECONDITION: `tr_render()` hasn't been called yet.
+bool tr_add_batch(tri_raster_t, c_tri_batch_t batch);
+
+// Makes `tr_render()` use kernel `k` rather than the fastest one this
+// CPU supports. (For comparison.) Returns false, changing nothing, if
+// the CPU doesn't support `k`.
+bool tr_use_kernel(tri_raster_t, enum tr_kernel k);
+
+// Renders the triangles added so far, using up to `threads` threads.
+// Call at most once. Returns false on allocation error.
+bool tr_render(tri_raster_t, int threads);
+
+// The grid's size, mode and number of triangles added so far.
+size_t tr_width(c_tri_raster_t), tr_height(c_tri_raster_t);
+enum tr_mode tr_get_mode(c_tri_raster_t);
+size_t tr_triangle_count(c_tri_raster_t);
+
+// Stores the window in `*x0`, `*y0`, `*x1` and `*y1`. (After
+// `tr_render()`, if it wasn't set.)
+void tr_window(c_tri_raster_t, double* x0, double* y0, double* x1, double* y1);
+
+// After `tr_render()`: the cells, row by row from row 0, as counts in
+// count mode (else NULL) or as covered fractions in area mode (else
+// NULL).
+const uint32_t* tr_counts(c_tri_raster_t);
+const float* tr_coverage(c_tri_raster_t);
@@ -0,0 +1,545 @@
+#include "tri_sort.h"
+#include "parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Don't bother splitting a run into partitions smaller than this.
+#define MIN_PARTITION  4096
+// Smallest run we'll use, whatever the memory budget.
+#define MIN_RUN        1024
+// Most partitions a run is sorted in.
+#define MAX_PARTITIONS 64
+// Stdio buffer for writing each temporary file.
+#define SPILL_BUFSIZ   (64 * 1024)
+// Read buffer wanted for each spilled run being merged. The buffers
+// share the run's memory, so this sets the merge fan-in, within limits.
+#define MERGE_BUFSIZ   (64 * 1024)
+#define MIN_FAN_IN     2
+#define MAX_FAN_IN     1024
+
+// One triangle with its key, as sorted in memory. `seq` is the input
+// position, so that equal keys keep input order.
+struct sort_rec
+{
+    uint64_t  key;
+    uint64_t  seq;
+    double    xs[3];
+    double    ys[3];
+};
+
+// One triangle as stored in spill files. The key is recomputed when
+// it's read back, and equal keys are ordered by which run they're in
+// instead of by `seq`, so neither takes up space on disk.
+struct spill_rec
+{
+    double    xs[3];
+    double    ys[3];
+};
+
+// A sorted run of records in a spill file.
+struct run
+{
+    off_t     offset;
+    size_t    count;
+};
+
+// A sorted sequence of records being merged: either a slice of memory
+// or a spilled run, read through `buf`. `head` is its current smallest
+// record.
+struct source
+{
+    const struct sort_rec*  mem;
+    size_t                  pos, end;
+    int                     fd;
+    off_t                   offset;
+    size_t                  left;       // records not yet read into `buf`
+    struct spill_rec*       buf;
+    size_t                  buf_cap, buf_pos, buf_len;
+    bool                    failed;     // on read error
+    struct sort_rec         head;
+};
+
+struct tri_sorter
+{
+    int               threads;
+    uint64_t          next_seq;
+    size_t            run_cap;
+    size_t            run_len;
+    struct sort_rec*  run;
+
+    // The runs spilled so far, in input order, all in `file`. A merge
+    // pass merges them into `spare`, and then the two swap.
+    FILE*             file;
+    FILE*             spare;
+    size_t            n_runs, runs_cap;
+    struct run*       runs;
+    size_t            n_spilled;
+
+    // Merges take at most `fan_in` spilled runs (or MAX_PARTITIONS
+    // partitions of the run in memory) at a time. Spilled runs are read
+    // through equal slices of `run`, which is free by then.
+    size_t            fan_in;
+    struct source*    srcs;
+    size_t*           heap;
+};
+
+// Where merged records go.
+typedef bool merge_out_fn(const struct sort_rec*, void* env);
+
+
+//
+// Keys
+//
+
+// Maps a double to a uint32 such that a <= b implies f(a) <= f(b).
+static uint32_t ordered_bits(double d)
+{
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof bits);
+    bits = (bits >> 63) ? ~bits : bits | (UINT64_C(1) << 63);
+    return (uint32_t) (bits >> 32);
+}
+
+// Spreads the 32 bits of `v` out to the even bits of the result.
+static uint64_t spread_bits(uint32_t v)
+{
+    uint64_t x = v;
+    x = (x | (x << 16)) & UINT64_C(0x0000FFFF0000FFFF);
+    x = (x | (x << 8))  & UINT64_C(0x00FF00FF00FF00FF);
+    x = (x | (x << 4))  & UINT64_C(0x0F0F0F0F0F0F0F0F);
+    x = (x | (x << 2))  & UINT64_C(0x3333333333333333);
+    x = (x | (x << 1))  & UINT64_C(0x5555555555555555);
+    return x;
+}
+
+uint64_t tri_morton_key(const double xs[3], const double ys[3])
+{
+    double cx = (xs[0] + xs[1] + xs[2]) / 3;
+    double cy = (ys[0] + ys[1] + ys[2]) / 3;
+    return spread_bits(ordered_bits(cx)) |
+           spread_bits(ordered_bits(cy)) << 1;
+}
+
+static int rec_cmp(const struct sort_rec* a, const struct sort_rec* b)
+{
+    if (a->key != b->key) return a->key < b->key ? -1 : 1;
+    if (a->seq != b->seq) return a->seq < b->seq ? -1 : 1;
+    return 0;
+}
+
+static int rec_qsort_cmp(const void* a, const void* b)
+{
+    return rec_cmp(a, b);
+}
+
+
+//
+// Creating and filling
+//
+
+tri_sorter_t ts_create(size_t mem_bytes, int threads)
+{
+    tri_sorter_t result = malloc(sizeof *result);
+    if (!result) return NULL;
+
+    result->threads   = threads;
+    result->next_seq  = 0;
+    result->run_cap   = mem_bytes / sizeof(struct sort_rec);
+    result->run_len   = 0;
+    result->file      = NULL;
+    result->spare     = NULL;
+    result->n_runs    = 0;
+    result->runs_cap  = 0;
+    result->runs      = NULL;
+    result->n_spilled = 0;
+
+    if (result->run_cap < MIN_RUN) result->run_cap = MIN_RUN;
+
+    result->fan_in = result->run_cap * sizeof(struct sort_rec) / MERGE_BUFSIZ;
+    if (result->fan_in < MIN_FAN_IN) result->fan_in = MIN_FAN_IN;
+    if (result->fan_in > MAX_FAN_IN) result->fan_in = MAX_FAN_IN;
+
+    size_t max_srcs = result->fan_in > MAX_PARTITIONS
+                    ? result->fan_in
+                    : MAX_PARTITIONS;
+
+    result->run  = malloc(result->run_cap * sizeof result->run[0]);
+    result->srcs = malloc(max_srcs * sizeof result->srcs[0]);
+    result->heap = malloc(max_srcs * sizeof result->heap[0]);
+
+    if (!result->run || !result->srcs || !result->heap) {
+        ts_destroy(result);
+        return NULL;
+    }
+
+    return result;
+}
+
+void ts_destroy(tri_sorter_t ts)
+{
+    if (!ts) return;
+
+    if (ts->file) fclose(ts->file);
+    if (ts->spare) fclose(ts->spare);
+
+    free(ts->runs);
+    free(ts->srcs);
+    free(ts->heap);
+    free(ts->run);
+    free(ts);
+}
+
+// Empties temporary file `*f`, or if that fails, closes it so that a
+// fresh one is opened when needed.
+static void empty_temp(FILE** f)
+{
+    if (!*f) return;
+
+    rewind(*f);
+    if (ftruncate(fileno(*f), 0)) {
+        fclose(*f);
+        *f = NULL;
+    }
+}
+
+void ts_reset(tri_sorter_t ts)
+{
+    empty_temp(&ts->file);
+    empty_temp(&ts->spare);
+
+    ts->next_seq  = 0;
+    ts->run_len   = 0;
+    ts->n_runs    = 0;
+    ts->n_spilled = 0;
+}
+
+size_t ts_spilled_runs(c_tri_sorter_t ts)
+{
+    return ts->n_spilled;
+}
+
+// Opens an anonymous temporary file in $TMPDIR for reading and writing.
+static FILE* open_temp(void)
+{
+    const char* dir = getenv("TMPDIR");
+    if (!dir || !*dir) dir = "/tmp";
+
+    char path[4096];
+    if (snprintf(path, sizeof path, "%s/tri_sort.XXXXXX", dir) >=
+            (int) sizeof path)
+        return NULL;
+
+    int fd = mkstemp(path);
+    if (fd < 0) return NULL;
+    unlink(path);
+
+    FILE* result = fdopen(fd, "w+b");
+    if (!result) {
+        close(fd);
+        return NULL;
+    }
+
+    setvbuf(result, NULL, _IOFBF, SPILL_BUFSIZ);
+    return result;
+}
+
+
+//
+// Sorting and merging
+//
+
+struct sort_job
+{
+    struct sort_rec*  recs;
+    size_t            n;
+    size_t            parts;
+};
+
+static size_t part_begin(const struct sort_job* job, size_t i)
+{
+    return job->n * i / job->parts;
+}
+
+static void sort_parts(size_t begin, size_t end, void* env)
+{
+    struct sort_job* job = env;
+
+    for (size_t i = begin; i < end; ++i) {
+        size_t lo = part_begin(job, i), hi = part_begin(job, i + 1);
+        qsort(job->recs + lo, hi - lo, sizeof job->recs[0], rec_qsort_cmp);
+    }
+}
+
+// Sorts the current run as independent partitions, one per thread, and
+// makes each partition a source, in order, starting at `ts->srcs[0]`.
+// Returns the number of sources.
+static size_t sort_run(tri_sorter_t ts)
+{
+    size_t parts = ts->threads > 1 ? (size_t) ts->threads : 1;
+    if (parts > MAX_PARTITIONS) parts = MAX_PARTITIONS;
+    if (parts > ts->run_len / MIN_PARTITION)
+        parts = ts->run_len / MIN_PARTITION;
+    if (parts < 1) parts = 1;
+
+    struct sort_job job = { ts->run, ts->run_len, parts };
+    parallel_for(parts, ts->threads, 1, sort_parts, &job);
+
+    for (size_t i = 0; i < parts; ++i) {
+        struct source* s = &ts->srcs[i];
+        s->mem    = ts->run;
+        s->pos    = part_begin(&job, i);
+        s->end    = part_begin(&job, i + 1);
+        s->buf    = NULL;
+        s->failed = false;
+    }
+
+    return parts;
+}
+
+// Makes the `n` (at most `ts->fan_in`) spilled runs starting at `runs`
+// sources, in order, starting at `ts->srcs[0]`. Uses the memory of the
+// in-memory run, which must be empty.
+static void open_runs(tri_sorter_t ts, const struct run* runs, size_t n)
+{
+    size_t buf_cap = ts->run_cap * sizeof(struct sort_rec) / ts->fan_in /
+                     sizeof(struct spill_rec);
+
+    for (size_t i = 0; i < n; ++i) {
+        struct source* s = &ts->srcs[i];
+        s->mem     = NULL;
+        s->fd      = fileno(ts->file);
+        s->offset  = runs[i].offset;
+        s->left    = runs[i].count;
+        s->buf     = (struct spill_rec*) ts->run + i * buf_cap;
+        s->buf_cap = buf_cap;
+        s->buf_pos = 0;
+        s->buf_len = 0;
+        s->failed  = false;
+    }
+}
+
+// Reads exactly `len` bytes at `offset` of `fd`.
+static bool read_at(int fd, void* buf, size_t len, off_t offset)
+{
+    while (len) {
+        ssize_t got = pread(fd, buf, len, offset);
+        if (got <= 0) return false;
+
+        buf     = (char*) buf + got;
+        len    -= (size_t) got;
+        offset += got;
+    }
+
+    return true;
+}
+
+// Loads the next record of `s` into `s->head`; false at the end (or on
+// read error, setting `s->failed`).
+static bool source_next(struct source* s)
+{
+    if (!s->buf) {
+        if (s->pos == s->end) return false;
+
+        s->head = s->mem[s->pos++];
+        return true;
+    }
+
+    if (s->buf_pos == s->buf_len) {
+        if (!s->left) return false;
+
+        size_t n = s->left < s->buf_cap ? s->left : s->buf_cap;
+        size_t bytes = n * sizeof s->buf[0];
+
+        if (!read_at(s->fd, s->buf, bytes, s->offset)) {
+            s->failed = true;
+            return false;
+        }
+
+        s->offset += (off_t) bytes;
+        s->left   -= n;
+        s->buf_pos = 0;
+        s->buf_len = n;
+    }
+
+    const struct spill_rec* rec = &s->buf[s->buf_pos++];
+    memcpy(s->head.xs, rec->xs, sizeof rec->xs);
+    memcpy(s->head.ys, rec->ys, sizeof rec->ys);
+    s->head.key = tri_morton_key(rec->xs, rec->ys);
+    return true;
+}
+
+// Orders by key, and then by source, since sources are in input order.
+static bool heap_less(const struct source* srcs, size_t a, size_t b)
+{
+    if (srcs[a].head.key != srcs[b].head.key)
+        return srcs[a].head.key < srcs[b].head.key;
+    return a < b;
+}
+
+static void sift_down(const struct source* srcs, size_t* heap,
+                      size_t n, size_t i)
+{
+    for (;;) {
+        size_t least = i, l = 2 * i + 1, r = l + 1;
+        if (l < n && heap_less(srcs, heap[l], heap[least])) least = l;
+        if (r < n && heap_less(srcs, heap[r], heap[least])) least = r;
+        if (least == i) return;
+
+        size_t tmp = heap[i];
+        heap[i] = heap[least];
+        heap[least] = tmp;
+        i = least;
+    }
+}
+
+// K-way merges the first `n_srcs` of `ts->srcs` into `out`. Returns
+// false if `out` does, or on read error.
+static bool merge(tri_sorter_t ts, size_t n_srcs,
+                  merge_out_fn* out, void* env)
+{
+    struct source* srcs = ts->srcs;
+    size_t* heap = ts->heap;
+
+    size_t n = 0;
+    for (size_t i = 0; i < n_srcs; ++i)
+        if (source_next(&srcs[i])) heap[n++] = i;
+
+    for (size_t i = n / 2; i-- > 0; ) sift_down(srcs, heap, n, i);
+
+    bool ok = true;
+
+    while (ok && n) {
+        struct source* s = &srcs[heap[0]];
+        ok = out(&s->head, env);
+
+        if (!source_next(s)) heap[0] = heap[--n];
+        sift_down(srcs, heap, n, 0);
+    }
+
+    for (size_t i = 0; i < n_srcs; ++i)
+        if (srcs[i].failed) ok = false;
+
+    return ok;
+}
+
+static bool write_rec(const struct sort_rec* rec, void* env)
+{
+    struct spill_rec out;
+    memcpy(out.xs, rec->xs, sizeof out.xs);
+    memcpy(out.ys, rec->ys, sizeof out.ys);
+    return fwrite(&out, sizeof out, 1, env) == 1;
+}
+
+// Makes room for one more run in `ts->runs`.
+static bool reserve_run(tri_sorter_t ts)
+{
+    if (ts->n_runs < ts->runs_cap) return true;
+
+    size_t new_cap = ts->runs_cap ? 2 * ts->runs_cap : 8;
+    struct run* new_runs = realloc(ts->runs, new_cap * sizeof new_runs[0]);
+    if (!new_runs) return false;
+
+    ts->runs     = new_runs;
+    ts->runs_cap = new_cap;
+    return true;
+}
+
+// Sorts the current run and appends it to the spill file.
+static bool spill(tri_sorter_t ts)
+{
+    if (!reserve_run(ts)) return false;
+    if (!ts->file && !(ts->file = open_temp())) return false;
+
+    struct run run = { ftello(ts->file), ts->run_len };
+    if (run.offset < 0) return false;
+
+    if (!merge(ts, sort_run(ts), write_rec, ts->file) || fflush(ts->file))
+        return false;
+
+    ts->runs[ts->n_runs++] = run;
+    ++ts->n_spilled;
+    ts->run_len = 0;
+    return true;
+}
+
+// Merges each `ts->fan_in` consecutive spilled runs into one, in the
+// spare file, which then becomes the spill file.
+static bool merge_pass(tri_sorter_t ts)
+{
+    if (!ts->spare && !(ts->spare = open_temp())) return false;
+
+    size_t n_merged = 0;
+
+    for (size_t i = 0; i < ts->n_runs; i += ts->fan_in) {
+        size_t n = ts->n_runs - i < ts->fan_in ? ts->n_runs - i : ts->fan_in;
+
+        struct run merged = { ftello(ts->spare), 0 };
+        if (merged.offset < 0) return false;
+        for (size_t j = 0; j < n; ++j) merged.count += ts->runs[i + j].count;
+
+        open_runs(ts, ts->runs + i, n);
+        if (!merge(ts, n, write_rec, ts->spare)) return false;
+
+        ts->runs[n_merged++] = merged;
+    }
+
+    if (fflush(ts->spare)) return false;
+
+    // Swap, and empty the old spill file to be the next spare.
+    FILE* old = ts->file;
+    ts->file   = ts->spare;
+    ts->spare  = old;
+    ts->n_runs = n_merged;
+
+    rewind(old);
+    return !ftruncate(fileno(old), 0);
+}
+
+bool ts_add_batch(tri_sorter_t ts, c_tri_batch_t batch)
+{
+    for (size_t i = 0; i < tb_count(batch); ++i) {
+        if (ts->run_len == ts->run_cap && !spill(ts)) return false;
+
+        struct sort_rec* rec = &ts->run[ts->run_len++];
+        tb_get(batch, i, rec->xs, rec->ys);
+        rec->key = tri_morton_key(rec->xs, rec->ys);
+        rec->seq = ts->next_seq++;
+    }
+
+    return true;
+}
+
+struct sink_env
+{
+    tri_sink_fn*  sink;
+    void*         env;
+};
+
+static bool call_sink(const struct sort_rec* rec, void* env)
+{
+    struct sink_env* se = env;
+    se->sink(rec->xs, rec->ys, se->env);
+    return true;
+}
+
+bool ts_finish(tri_sorter_t ts, tri_sink_fn* sink, void* env)
+{
+    struct sink_env se = { sink, env };
+
+    // If it all fit in memory, merge the partitions straight to `sink`.
+    if (!ts->n_runs) return merge(ts, sort_run(ts), call_sink, &se);
+
+    // Otherwise spill the last run too, so that its memory can buffer
+    // the merges, and merge in as many passes as the fan-in requires.
+    if (ts->run_len && !spill(ts)) return false;
+
+    while (ts->n_runs > ts->fan_in)
+        if (!merge_pass(ts)) return false;
+
+    open_runs(ts, ts->runs, ts->n_runs);
+    return merge(ts, ts->n_runs, call_sink, &se);
+}
@@ -0,0 +1,64 @@
+// Out-of-core sorting of triangle streams by a spatial key.
+
+#pragma once
+
+#include "tri_batch.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A triangle sorter accepts triangles a batch at a time and then emits
+ * them all ordered by the Morton (Z-order) code of each triangle's
+ * centroid, with ties kept in input order. Triangles that are near each
+ * other in the plane thus tend to be near each other in the output.
+ *
+ * Only a bounded amount of memory is used: whenever the in-memory run
+ * fills, it's sorted (split across threads) and appended to a temporary
+ * file, at 48 bytes per triangle. At the end, the runs are merged, a
+ * fixed number at a time (as many as can be read through buffers that
+ * share the run's memory), in as many passes as that takes. At most two
+ * temporary files are open, whatever the number of runs. They go in
+ * $TMPDIR (default /tmp) and are removed automatically.
+ */
+
+typedef        struct tri_sorter*    tri_sorter_t;
+typedef  const struct tri_sorter*  c_tri_sorter_t;
+
+// Called with each triangle in sorted order.
+typedef void tri_sink_fn(const double xs[3], const double ys[3], void* env);
+
+
+// Returns a new sorter that keeps at most about `mem_bytes` of
+// triangles in memory and uses up to `threads` threads to sort them.
+// Returns NULL on allocation error.
+tri_sorter_t ts_create(size_t mem_bytes, int threads);
+
+// Deallocates a sorter and removes its temporary files. Allows NULL.
+void ts_destroy(tri_sorter_t);
+
+// Discards all the triangles added, so that the sorter can be used
+// again, keeping its memory and temporary files. Can be called at any
+// time, including after an interrupted `ts_finish`.
+void ts_reset(tri_sorter_t);
+
+// Adds all the triangles of `batch` (which it borrows).
+//
+// ERRORS: returns false if a run can't be spilled to disk.
+bool ts_add_batch(tri_sorter_t, c_tri_batch_t batch);
+
+// Calls `sink(xs, ys, env)` on every triangle added so far, in sorted
+// order. Call at most once (until `ts_reset`). Allocates nothing, so
+// `sink` may escape with `longjmp` without leaking.
+//
+// ERRORS: returns false on a temporary-file or allocation error.
+bool ts_finish(tri_sorter_t, tri_sink_fn* sink, void* env);
+
+// The number of runs spilled to disk so far.
+size_t ts_spilled_runs(c_tri_sorter_t);
+
+// The sort key for a triangle: the Morton code of its centroid, where
+// each coordinate is first mapped to an order-preserving 32-bit
+// integer. (This needs no bounding box, so it works in one pass.)
+uint64_t tri_morton_key(const double xs[3], const double ys[3]);
@@ -0,0 +1,25 @@
+#include "grid_mesh.h"
+
+tri_batch_t grid_mesh(size_t size, const double* xs, const double* ys)
+{
+    tri_batch_t b = tb_create(size ? 2 * size * size : 1);
+    if (!b) return NULL;
+
+    size_t row = size + 1;
+
+    for (size_t i = 0; i < size; ++i)
+        for (size_t j = 0; j < size; ++j) {
+            size_t v00 = i * row + j,  v10 = v00 + row;
+            size_t v01 = v00 + 1,      v11 = v10 + 1;
+
+            double axs[3] = { xs[v00], xs[v10], xs[v11] };
+            double ays[3] = { ys[v00], ys[v10], ys[v11] };
+            double bxs[3] = { xs[v00], xs[v11], xs[v01] };
+            double bys[3] = { ys[v00], ys[v11], ys[v01] };
+
+            tb_push(b, axs, ays);
+            tb_push(b, bxs, bys);
+        }
+
+    return b;
+}
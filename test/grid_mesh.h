@@ -0,0 +1,17 @@
+// Triangle meshes over jittered grids, for tests of the geometry
+// kernels.
+
+#pragma once
+
+#include "../src/tri_batch.h"
+
+#include <stddef.h>
+
+// Triangulates a grid of (size + 1) by (size + 1) vertices, where
+// vertex (i, j) is (xs[i * (size + 1) + j], ys[i * (size + 1) + j]).
+// Cell (i, j) becomes triangles 2 * (i * size + j) and the one after,
+// which share the cell's diagonal from vertex (i, j) to (i + 1, j + 1).
+// Neighboring triangles share vertices exactly, so as long as the grid
+// stays untangled, no two triangles' interiors overlap. Returns NULL on
+// allocation error.
+tri_batch_t grid_mesh(size_t size, const double* xs, const double* ys);
@@ -0,0 +1,50 @@
+#include "../src/affine.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Odd, so that the SIMD kernels have a scalar tail to finish.
+#define N  100003
+
+// Checks that `affine_apply` (whichever kernel this CPU gets) and
+// `affine_apply_parallel` give exactly the results of the scalar
+// kernel for transformation `m`. (Not with `assert`, so that Release
+// builds check too.)
+static bool check_kernels(struct affine m)
+{
+    static double xs[N], ys[N], xs1[N], ys1[N], xs2[N], ys2[N];
+
+    for (size_t i = 0; i < N; ++i) {
+        xs[i] = (rand() - RAND_MAX / 2) / 7.3;
+        ys[i] = (rand() - RAND_MAX / 2) / 3.1;
+    }
+
+    memcpy(xs1, xs, sizeof xs);
+    memcpy(ys1, ys, sizeof ys);
+    memcpy(xs2, xs, sizeof xs);
+    memcpy(ys2, ys, sizeof ys);
+
+    affine_apply_scalar(&m, xs, ys, N);
+    affine_apply(&m, xs1, ys1, N);
+    affine_apply_parallel(&m, xs2, ys2, N, 4);
+
+    return !memcmp(xs, xs1, sizeof xs) && !memcmp(ys, ys1, sizeof ys)
+        && !memcmp(xs, xs2, sizeof xs) && !memcmp(ys, ys2, sizeof ys);
+}
+
+int main(void)
+{
+    srand(1);
+
+    bool ok = check_kernels(affine_identity())
+           && check_kernels(affine_translate(1.5, -2.25))
+           && check_kernels(affine_compose(affine_rotate(30),
+                                           affine_translate(1.5, -2.25)))
+           && check_kernels(affine_compose(affine_scale(0.1, 3),
+                                           affine_project(17)));
+
+    printf("affine kernels %s\n", ok ? "agree" : "DISAGREE");
+    return ok ? 0 : 1;
+}
@@ -1,4 +1,11 @@
+// Check the `assert`s in Release builds too.
+#undef NDEBUG
+
 #include "../src/cons.h"
+#include "../src/int_hash.h"
+#include "../src/packed_list.h"
+#include "../src/small_list.h"
+#include "../src/trace.h"
 
 // Uncomment the following `#define` line to see what’s happening in the
 // program. If `ENABLE_TRACEF` is #defined above the #include <libipd.h>
@@ -11,8 +18,11 @@
 #include <libipd.h>
 
 #include <assert.h>
+#include <limits.h>
 #include <printf.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 // Computes the length of a list. Recursive, which means it will “blow
 // the stack” on a sufficiently long list.
@@ -35,6 +45,24 @@ size_t list_len(list_t lst)
     return count;
 }
 
+// Adds one to the count that `count` points to, for `list_len_foldr`.
+static void* count_one(int element, void* count)
+{
+    (void) element;
+    ++*(size_t*) count;
+    return count;
+}
+
+// Computes the length of a list. Recursive in the way that
+// `list_len_bsl_style` is, but `foldr` keeps the pending calls on the
+// heap, so this works regardless of list length.
+size_t list_len_foldr(list_t lst)
+{
+    size_t count = 0;
+    foldr(count_one, &count, lst);
+    return count;
+}
+
 // Helper for recursive list printing function.
 void print_list_bsl_style_helper(list_t lst)
 {
@@ -100,8 +128,317 @@ static int dbl(int z) { return z << 1; }
 
 static void dblp(int* pz) { *pz <<= 1; }
 
+// Little function for passing to `foldr`, to do what `map(dbl, ...)`
+// does:
+static void* cons_dbl(int z, void* acc) { return cons(dbl(z), acc); }
+
+// Checks that `pl` holds exactly `values[0]` through `values[n - 1]`:
+// block by block, with both the kernel this CPU gets and the scalar
+// one, and as a `list_t`.
+static void check_packed(c_packed_list_t pl, const int* values, size_t n)
+{
+    int buf[PL_BLOCK_SIZE], scalar_buf[PL_BLOCK_SIZE];
+    size_t at = 0;
+    int64_t sum = 0;
+
+    assert(pl_length(pl) == n);
+    assert(pl_block_count(pl) == (n + PL_BLOCK_SIZE - 1) / PL_BLOCK_SIZE);
+
+    for (size_t i = 0; i < pl_block_count(pl); ++i) {
+        size_t len = pl_decode_block(pl, i, buf);
+        assert(pl_decode_block_scalar(pl, i, scalar_buf) == len);
+        assert(len == PL_BLOCK_SIZE || i + 1 == pl_block_count(pl));
+        assert(!memcmp(buf, scalar_buf, len * sizeof *buf));
+        assert(!memcmp(buf, values + at, len * sizeof *buf));
+        at += len;
+    }
+
+    for (size_t i = 0; i < n; ++i) sum += values[i];
+    assert(pl_sum(pl) == sum);
+
+    list_t lst = pl_to_list(pl);
+    for (list_t p = lst; is_cons(p); p = rest(p)) assert(first(p) == *values++);
+    assert(list_len(lst) == n);
+    uncons_all(lst);
+}
+
+// Packs `values[0]` through `values[n - 1]` both from the array and
+// from a list, and checks both.
+static void check_pack(const int* values, size_t n)
+{
+    list_t lst = empty;
+    for (size_t i = n; i > 0; --i) lst = cons(values[i - 1], lst);
+
+    packed_list_t from_array = pl_from_array(values, n);
+    packed_list_t from_list = pl_from_list(lst);
+    assert(from_array && from_list);
+    check_packed(from_array, values, n);
+    check_packed(from_list, values, n);
+
+    pl_destroy(from_list);
+    pl_destroy(from_array);
+    uncons_all(lst);
+}
+
+// The elements that `fold_in_order` expects, in order.
+static const int* fold_expected;
+
+// For `pl_fold`: counts the elements seen so far while they match
+// `fold_expected`, or gives -1 once one doesn't.
+static int64_t fold_in_order(int64_t seen, int z)
+{
+    return seen >= 0 && fold_expected[seen] == z ? seen + 1 : -1;
+}
+
+// Little function for passing to `pl_map`; unlike `dbl` it's defined
+// for every `int`.
+static int flip(int z) { return ~z; }
+
+// Number of elements in the packed-list tests: several blocks and a
+// partial one.
+#define PACKED_N  (5 * PL_BLOCK_SIZE + 37)
+
+// Tests packed lists on lengths around a block, on a long list whose
+// differences vary in sign and size from block to block, and on the
+// extremes of `int`, where differences wrap around and take all 32 bits.
+static void test_packed_lists(void)
+{
+    static int values[PACKED_N], flipped[PACKED_N];
+
+    srand(4);
+
+    for (size_t n = 0; n <= 2 * PL_BLOCK_SIZE + 1; ++n) {
+        for (size_t i = 0; i < n; ++i) values[i] = rand() % 1000 - 500;
+        if (n <= 2 || n % PL_BLOCK_SIZE <= 1
+                   || n % PL_BLOCK_SIZE == PL_BLOCK_SIZE - 1)
+            check_pack(values, n);
+    }
+
+    // Differences of up to 2^(j % 20) in each stretch of 50, alternately
+    // increasing and decreasing, with a long run of equal elements.
+    int x = 0;
+    for (size_t i = 0; i < PACKED_N; ++i) {
+        size_t j = i / 50;
+        int delta = rand() % (1 << (j % 20));
+        if (j % 3 == 1) delta = -delta;
+        if (j == 7) delta = 0;
+        x += delta;
+        values[i] = x;
+    }
+    check_pack(values, PACKED_N);
+
+    // Swings between INT_MIN and INT_MAX (differences of 2^32 - 1 and 1,
+    // mod 2^32), so those blocks use all 32 bits, and then small values
+    // around 0.
+    static const int extremes[] = {
+        INT_MIN, INT_MAX, INT_MIN, INT_MAX, 0, -1, INT_MAX, INT_MAX, INT_MIN,
+        INT_MIN + 1, INT_MAX - 1, 1, -2, INT_MIN,
+    };
+    for (size_t i = 0; i < PACKED_N; ++i) {
+        values[i] = i < 3 * PL_BLOCK_SIZE
+            ? extremes[i % (sizeof extremes / sizeof *extremes)]
+            : (int) (i % 7) - 3;
+    }
+    check_pack(values, PACKED_N);
+
+    packed_list_t pl = pl_from_array(values, PACKED_N);
+    assert(pl);
+    // The 32-bit blocks take a word per element.
+    assert(pl_bytes(pl) > 3 * PL_BLOCK_SIZE * sizeof(uint32_t));
+
+    fold_expected = values;
+    assert(pl_fold(fold_in_order, 0, pl) == PACKED_N);
+
+    for (size_t i = 0; i < PACKED_N; ++i) flipped[i] = flip(values[i]);
+    packed_list_t mapped = pl_map(flip, pl);
+    assert(mapped);
+    check_packed(mapped, flipped, PACKED_N);
+    fold_expected = flipped;
+    assert(pl_fold(fold_in_order, 0, mapped) == PACKED_N);
+    assert(pl_fold(fold_in_order, 0, pl) == -1);
+
+    pl_destroy(mapped);
+    pl_destroy(pl);
+}
+
+// Keys in the hash table tests: the extremes of `int` and the KEY_RANGE
+// around 0. Enough of them that the tables grow several times.
+#define KEY_RANGE  6000
+#define KEY_COUNT  (KEY_RANGE + 4)
+
+// Returns key number `i` (< KEY_COUNT).
+static int key_at(size_t i)
+{
+    static const int extremes[] = { INT_MIN, INT_MIN + 1, INT_MAX - 1, INT_MAX };
+    return i < 4 ? extremes[i] : (int) i - 4 - KEY_RANGE / 2;
+}
+
+// What the hash table tests expect: for key number `i`, whether it's
+// there and (for maps) its value.
+static bool ref_present[KEY_COUNT];
+static int  ref_value[KEY_COUNT];
+static size_t ref_size;
+
+// Returns the number of `key`, which must be one of `key_at`'s.
+static size_t key_index(int key)
+{
+    for (size_t i = 0; i < 4; ++i)
+        if (key_at(i) == key) return i;
+
+    size_t i = (size_t) (key + KEY_RANGE / 2) + 4;
+    assert(i >= 4 && i < KEY_COUNT);
+    return i;
+}
+
+// Checks that `keys` (and `values`, unless it's NULL) list exactly the
+// expected keys and values, each key once.
+static void check_against_ref(list_t keys, list_t values)
+{
+    static bool seen[KEY_COUNT];
+    memset(seen, 0, sizeof seen);
+    size_t count = 0;
+
+    for (; is_cons(keys); keys = rest(keys), ++count) {
+        size_t i = key_index(first(keys));
+        assert(ref_present[i] && !seen[i]);
+        seen[i] = true;
+        if (values) {
+            assert(is_cons(values) && first(values) == ref_value[i]);
+            values = rest(values);
+        }
+    }
+
+    assert(count == ref_size);
+    assert(!values || is_empty(values));
+}
+
+// Checks every key of `set` (or, if `set` is NULL, `map`) against the
+// reference, and its list of elements (or keys and values).
+static void check_table(c_int_set_t set, c_int_map_t map)
+{
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        int value = ~ref_value[i];
+        if (set) {
+            assert(iset_contains(set, key_at(i)) == ref_present[i]);
+        } else {
+            assert(imap_get(map, key_at(i), &value) == ref_present[i]);
+            assert(!ref_present[i] || value == ref_value[i]);
+        }
+    }
+
+    list_t keys, values = empty;
+    if (set) {
+        assert(iset_size(set) == ref_size);
+        keys = iset_to_list(set);
+    } else {
+        assert(imap_size(map) == ref_size);
+        imap_to_lists(map, &keys, &values);
+    }
+
+    check_against_ref(keys, set ? NULL : values);
+    uncons_all(keys);
+    uncons_all(values);
+}
+
+// Adds and removes random keys in `set` (or, if `set` is NULL, `map`),
+// in phases that mostly add, then mostly remove (leaving deleted
+// slots), then mostly add again, checking against the reference as it
+// goes. The tables grow from their minimum size past KEY_COUNT.
+static void churn_table(int_set_t set, int_map_t map)
+{
+    static const int add_percent[] = { 90, 60, 10, 50, 95 };
+
+    memset(ref_present, 0, sizeof ref_present);
+    ref_size = 0;
+
+    for (size_t phase = 0; phase < 5; ++phase) {
+        for (size_t op = 0; op < 3 * KEY_COUNT; ++op) {
+            size_t i = (size_t) rand() % KEY_COUNT;
+            int key = key_at(i);
+
+            if (rand() % 100 < add_percent[phase]) {
+                int value = rand();
+                if (set) {
+                    assert(iset_add(set, key));
+                } else {
+                    assert(imap_put(map, key, value));
+                    ref_value[i] = value;
+                }
+                ref_size += !ref_present[i];
+                ref_present[i] = true;
+            } else {
+                bool removed = set ? iset_remove(set, key)
+                                   : imap_remove(map, key);
+                assert(removed == ref_present[i]);
+                ref_size -= ref_present[i];
+                ref_present[i] = false;
+            }
+
+            if (op % 2000 == 0) check_table(set, map);
+        }
+
+        check_table(set, map);
+    }
+}
+
+// Tests hash sets and maps against the reference, and `imap_from_lists`
+// on repeated keys.
+static void test_hash_tables(void)
+{
+    srand(5);
+
+    int_set_t set = iset_create();
+    assert(set);
+    churn_table(set, NULL);
+    iset_destroy(set);
+
+    int_map_t map = imap_create();
+    assert(map);
+    churn_table(NULL, map);
+
+    // Replacing a value keeps the size.
+    int value;
+    assert(imap_put(map, INT_MIN, 1) && imap_put(map, INT_MIN, 2));
+    assert(imap_get(map, INT_MIN, &value) && value == 2);
+    assert(imap_get(map, INT_MIN, NULL));
+    size_t size = imap_size(map);
+    assert(imap_put(map, INT_MIN, 3) && imap_size(map) == size);
+    imap_destroy(map);
+
+    // The first occurrence of a key counts, and keys past the end of
+    // `values` are ignored.
+    list_t keys = cons(5, cons(7, cons(5, cons(INT_MAX, cons(9, empty)))));
+    list_t values = cons(1, cons(2, cons(3, cons(4, empty))));
+    map = imap_from_lists(keys, values);
+    assert(map && imap_size(map) == 3);
+    assert(imap_get(map, 5, &value) && value == 1);
+    assert(imap_get(map, 7, &value) && value == 2);
+    assert(imap_get(map, INT_MAX, &value) && value == 4);
+    assert(!imap_get(map, 9, &value));
+
+    memset(ref_present, 0, sizeof ref_present);
+    ref_present[key_index(5)] = ref_present[key_index(7)] = true;
+    ref_present[key_index(INT_MAX)] = true;
+    ref_value[key_index(5)] = 1;
+    ref_value[key_index(7)] = 2;
+    ref_value[key_index(INT_MAX)] = 4;
+    ref_size = 3;
+    check_table(NULL, map);
+
+    assert(imap_remove(map, 5) && !imap_remove(map, 5));
+    assert(!imap_get(map, 5, NULL) && imap_size(map) == 2);
+
+    imap_destroy(map);
+    uncons_all(values);
+    uncons_all(keys);
+}
+
 int main(void)
 {
+    // CONS_TRACE=FILE saves a trace of the list operations to FILE.
+    const char* trace_path = getenv("CONS_TRACE");
+    if (trace_path) trace_enable();
+
     print_list(empty);
 
     list_t my_list = cons(2, cons(3, cons(4, cons(5, empty))));
@@ -113,14 +450,81 @@ int main(void)
     for_each(dblp, doubled);
     print_list(doubled);
 
+    list_t refolded = foldr(cons_dbl, empty, my_list);
+    print_list(refolded);
+    uncons_all(refolded);
+
     list_t incred = map(add1, rest(doubled));
 
     uncons_all(doubled);
     uncons_all(my_list);
 
     print_list(incred);
+
+    // Compacting keeps the elements, and the cells can still be freed
+    // one at a time.
+    incred = list_compact(incred);
+    print_list(incred);
+    incred = uncons_one(incred);
+    print_list(incred);
+
+    // Packing keeps the elements too.
+    packed_list_t packed = pl_from_list(incred);
+    assert(packed && pl_length(packed) == 2 && pl_sum(packed) == 38);
+    uncons_all(incred);
+    incred = pl_to_list(packed);
+    print_list(incred);
+    pl_destroy(packed);
+
+    // So do sets, though in no particular order.
+    int_set_t set = iset_from_list(incred);
+    assert(set && iset_size(set) == 2);
+    assert(iset_contains(set, 17) && !iset_contains(set, 13));
+    list_t elements = iset_to_list(set);
+    assert(list_len(elements) == 2);
+    uncons_all(elements);
+    iset_destroy(set);
     uncons_all(incred);
 
+    // Small lists hold the first few elements inline and spill the rest
+    // into a list_t.
+    // Up to SMALL_LIST_INLINE elements, nothing is allocated; each
+    // element after that spills one cell.
+    small_list_t small = sl_empty;
+    for (int i = 10; i > 2; --i) small = sl_cons(i, small);
+    assert(small.count == SMALL_LIST_INLINE && is_empty(small.spill));
+    small = sl_cons(2, small);
+    assert(small.count == SMALL_LIST_INLINE && list_len(small.spill) == 1);
+    small = sl_cons(1, small);
+    assert(small.count == SMALL_LIST_INLINE && list_len(small.spill) == 2);
+    assert(sl_length(small) == 10);
+
+    // The elements come out in order, across the inline/spill boundary.
+    int expected = 1;
+    for (small_list_t p = small; sl_is_cons(p); p = sl_rest(p))
+        assert(sl_first(p) == expected++);
+    assert(expected == 11);
+
+    small_list_t small_doubled = sl_map(dbl, small);
+    sl_for_each(dblp, &small_doubled);
+    list_t unsmall = sl_to_list(small_doubled);
+    print_list(unsmall);
+    expected = 4;
+    for (list_t p = unsmall; is_cons(p); p = rest(p), expected += 4)
+        assert(first(p) == expected);
+    assert(expected == 44);
+    uncons_all(unsmall);
+    sl_free(small_doubled);
+    sl_free(small);
+
+    if (trace_path && !trace_write(trace_path)) return 1;
+
+    test_packed_lists();
+    test_hash_tables();
+
+    // Right folds work on long lists too.
+    try_len(list_len_foldr, (size_t) 1 << 22);
+
     // Tries list_len_bsl_style on lists of exponetially increasing
     // length:
     for (size_t i = 1; i <= SIZE_MAX / 2; i *= 2)
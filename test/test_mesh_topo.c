@@ -0,0 +1,89 @@
+#include "grid_mesh.h"
+#include "../src/mesh_topo.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Grid cells per side of the mesh.
+#define G  4
+
+// Triangles the mesh has, and the degenerate ones added after it:
+// (a, b, a) on the mesh's bottom boundary edge, (a, b, a) alone, and
+// (a, a, a).
+#define MESH_TRIS   (2 * G * G)
+#define ON_MESH     MESH_TRIS
+#define ALONE       (MESH_TRIS + 1)
+#define COLLAPSED   (MESH_TRIS + 2)
+
+// Adds the triangle with vertices (x0, y0), (x1, y1), (x0, y0) to `b`.
+static void push_aba(tri_batch_t b, double x0, double y0, double x1, double y1)
+{
+    double xs[3] = { x0, x1, x0 }, ys[3] = { y0, y1, y0 };
+    tb_push(b, xs, ys);
+}
+
+// Builds the topology of a G by G grid mesh and three degenerate
+// triangles with `threads` threads, and checks the counts, neighbors
+// and components. The degenerate triangles each lie on an edge at most
+// once, so none is its own neighbor or makes an edge non-manifold.
+// (Not with `assert`, so that Release builds check too.)
+static bool check_topology(int threads)
+{
+    static double xs[(G + 1) * (G + 1)], ys[(G + 1) * (G + 1)];
+
+    for (int i = 0; i <= G; ++i)
+        for (int j = 0; j <= G; ++j) {
+            xs[i * (G + 1) + j] = i;
+            ys[i * (G + 1) + j] = j;
+        }
+
+    tri_batch_t mesh = grid_mesh(G, xs, ys);
+    tri_batch_t extra = tb_create(3);
+    mesh_topo_t m = mt_create();
+    if (!mesh || !extra || !m) return false;
+
+    // Triangle 0's edge 0 runs from (0, 0) to (1, 0).
+    push_aba(extra, 0, 0, 1, 0);
+    push_aba(extra, 10, 10, 11, 10);
+    push_aba(extra, 20, 20, 20, 20);
+
+    bool ok = mt_add_batch(m, mesh) && mt_add_batch(m, extra)
+           && mt_build(m, threads);
+
+    // The grid's edges run across, up and along each cell's diagonal;
+    // the degenerate triangles cover one of its 4G boundary edges and
+    // add one more.
+    ok = ok && mt_triangle_count(m) == MESH_TRIS + 3
+            && mt_vertex_count(m) == (G + 1) * (G + 1) + 3
+            && mt_edge_count(m) == 2 * G * (G + 1) + G * G + 1
+            && mt_boundary_edge_count(m) == 4 * G
+            && mt_nonmanifold_edge_count(m) == 0
+            && mt_component_count(m) == 3;
+
+    ok = ok && mt_neighbor(m, 0, 0) == ON_MESH
+            && mt_neighbor(m, ON_MESH, 0) == 0
+            && mt_neighbor(m, ON_MESH, 1) == 0
+            && mt_neighbor(m, ON_MESH, 2) == MT_NONE
+            && mt_component(m, ON_MESH) == mt_component(m, 0);
+
+    for (int e = 0; ok && e < 3; ++e)
+        ok = mt_neighbor(m, ALONE, e) == MT_NONE
+          && mt_neighbor(m, COLLAPSED, e) == MT_NONE;
+
+    ok = ok && mt_component(m, ALONE) != mt_component(m, 0)
+            && mt_component(m, COLLAPSED) != mt_component(m, 0)
+            && mt_component(m, COLLAPSED) != mt_component(m, ALONE);
+
+    mt_destroy(m);
+    tb_destroy(extra);
+    tb_destroy(mesh);
+    return ok;
+}
+
+int main(void)
+{
+    bool ok = check_topology(1) && check_topology(4);
+
+    printf("mesh topology %s\n", ok ? "as expected" : "WRONG");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+#include "grid_mesh.h"
+#include "../src/tri_overlap.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Grid cells per side of the mesh.
+#define G  100
+
+static const char* const kernel_names[] = { "scalar", "AVX2", "AVX-512" };
+
+// Returns a random double in [-0.5, 0.5).
+static double jitter(void)
+{
+    return rand() / ((double) RAND_MAX + 1) - 0.5;
+}
+
+// Counts the pairs of triangles in mesh `b` (made by `grid_mesh(G,
+// ...)`) whose interiors overlap according to `tri_interiors_overlap`.
+// Only cells at most one column apart can touch.
+static size_t mesh_pairs(c_tri_batch_t b)
+{
+    size_t n = tb_count(b), count = 0;
+
+    for (size_t a = 0; a < n; ++a) {
+        double axs[3], ays[3], cxs[3], cys[3];
+        tb_get(b, a, axs, ays);
+
+        for (size_t c = a + 1; c < n && c < a + 4 * G; ++c) {
+            tb_get(b, c, cxs, cys);
+            count += tri_interiors_overlap(axs, ays, cxs, cys);
+        }
+    }
+
+    return count;
+}
+
+// Finds the overlapping pairs among the triangles of the `n` batches
+// with kernel `k` and `threads` threads, keeping them. Returns NULL if
+// the CPU doesn't support `k`, or on allocation error.
+static tri_overlap_t find_pairs(const c_tri_batch_t* batches, size_t n,
+                                enum to_kernel k, int threads)
+{
+    tri_overlap_t o = to_create();
+    bool ok = o && to_use_kernel(o, k);
+
+    for (size_t i = 0; ok && i < n; ++i) ok = to_add_batch(o, batches[i]);
+
+    if (ok && to_find(o, threads, true)) return o;
+
+    to_destroy(o);
+    return NULL;
+}
+
+// Do `a` and `b` hold the same pairs?
+static bool same_pairs(c_tri_overlap_t a, c_tri_overlap_t b)
+{
+    if (to_pair_count(a) != to_pair_count(b)) return false;
+
+    for (size_t i = 0; i < to_pair_count(a); ++i) {
+        uint32_t a0, a1, b0, b1;
+        to_pair(a, i, &a0, &a1);
+        to_pair(b, i, &b0, &b1);
+        if (a0 != b0 || a1 != b1) return false;
+    }
+
+    return true;
+}
+
+// Checks that kernel `k`, with 1 and with 4 threads, finds exactly the
+// `expected` pairs in `mesh`, and exactly the pairs `ref` holds among
+// the triangles of `mesh` and `shifted` together. (Not with `assert`,
+// so that Release builds check too.)
+static bool check_kernel(enum to_kernel k, c_tri_batch_t mesh,
+                         size_t expected, c_tri_batch_t shifted,
+                         c_tri_overlap_t ref)
+{
+    c_tri_batch_t layers[] = { mesh, shifted };
+
+    for (int threads = 1; threads <= 4; threads += 3) {
+        tri_overlap_t o = find_pairs(layers, 1, k, threads);
+        bool ok = o && to_pair_count(o) == expected;
+        to_destroy(o);
+        if (!ok) return false;
+
+        o = find_pairs(layers, 2, k, threads);
+        ok = o && same_pairs(o, ref);
+        to_destroy(o);
+        if (!ok) return false;
+    }
+
+    return true;
+}
+
+// Builds a mesh of G * G jittered cells, two triangles each, whose
+// triangles share only edges and vertices, and a copy of it shifted
+// right by one, which overlaps it a great deal. Then checks every
+// kernel the CPU supports against `tri_interiors_overlap` on the mesh
+// and against the scalar kernel on both together. The results agree
+// only if every kernel rounds the edge tests as the scalar test does.
+int main(void)
+{
+    static double xs[(G + 1) * (G + 1)], ys[(G + 1) * (G + 1)];
+    static double shifted_xs[(G + 1) * (G + 1)];
+
+    srand(1);
+
+    for (size_t i = 0; i <= G; ++i)
+        for (size_t j = 0; j <= G; ++j) {
+            size_t v = i * (G + 1) + j;
+            xs[v] = i + 0.6 * jitter() + 0.1;
+            ys[v] = 1.3 * j + 0.6 * jitter();
+            shifted_xs[v] = xs[v] + 1;
+        }
+
+    tri_batch_t mesh = grid_mesh(G, xs, ys);
+    tri_batch_t shifted = grid_mesh(G, shifted_xs, ys);
+    if (!mesh || !shifted) return 1;
+
+    size_t expected = mesh_pairs(mesh);
+    c_tri_batch_t layers[] = { mesh, shifted };
+    tri_overlap_t ref = find_pairs(layers, 2, TO_KERNEL_SCALAR, 1);
+    bool ok = ref && expected == 0;
+
+    for (int k = TO_KERNEL_SCALAR; ok && k <= TO_KERNEL_AVX512; ++k) {
+        tri_overlap_t probe = to_create();
+        if (!probe) return 1;
+        bool supported = to_use_kernel(probe, k);
+        to_destroy(probe);
+
+        if (!supported) {
+            printf("overlap kernel %s: not supported here\n", kernel_names[k]);
+            continue;
+        }
+
+        ok = check_kernel(k, mesh, expected, shifted, ref);
+        printf("overlap kernel %s %s\n", kernel_names[k],
+               ok ? "agrees" : "DISAGREES");
+    }
+
+    to_destroy(ref);
+    tb_destroy(shifted);
+    tb_destroy(mesh);
+    return ok ? 0 : 1;
+}
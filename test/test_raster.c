@@ -0,0 +1,112 @@
+#include "grid_mesh.h"
+#include "../src/tri_raster.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Mesh cells per side, and raster cells per side.
+#define G  60
+#define W  1200
+
+// Cells per mesh cell, and how far (in cells) mesh vertices wander.
+#define STEP    (W / G)
+#define WANDER  3
+
+static const char* const kernel_names[] = { "scalar", "AVX2", "AVX-512" };
+
+// The window the grid covers. (Not plain `y0` and `y1`, which name the C
+// library's Bessel functions.)
+static const double win_x0 = 0.1, win_y0 = 0.2, win_x1 = 13.7, win_y1 = 9.3;
+
+// Returns the raster column or row for mesh vertex `i`: on the grid
+// for the border, wandering up to WANDER cells off it inside.
+static int place(int i)
+{
+    if (i == 0) return 0;
+    if (i == G) return W - 1;
+    return i * STEP + rand() % (2 * WANDER + 1) - WANDER;
+}
+
+// Renders `mesh` in count mode with kernel `k` and `threads` threads.
+// Returns NULL if the CPU doesn't support `k`, or on allocation error.
+static tri_raster_t render(c_tri_batch_t mesh, enum tr_kernel k, int threads)
+{
+    tri_raster_t r = tr_create(W, W, TR_COUNT);
+    if (!r) return NULL;
+
+    tr_set_window(r, win_x0, win_y0, win_x1, win_y1);
+    if (tr_use_kernel(r, k) && tr_add_batch(r, mesh) && tr_render(r, threads))
+        return r;
+
+    tr_destroy(r);
+    return NULL;
+}
+
+// Checks that kernel `k`, with 1 and with 4 threads, counts every cell
+// of `mesh` just as `ref` does, and every cell away from the border
+// exactly once: not twice, where two triangles share a center, nor
+// never. (Not with `assert`, so that Release builds check too.)
+static bool check_kernel(enum tr_kernel k, c_tri_batch_t mesh,
+                         c_tri_raster_t ref)
+{
+    for (int threads = 1; threads <= 4; threads += 3) {
+        tri_raster_t r = render(mesh, k, threads);
+        bool ok = r && !memcmp(tr_counts(r), tr_counts(ref),
+                               W * W * sizeof *tr_counts(r));
+
+        for (size_t row = STEP; ok && row < W - STEP; ++row)
+            for (size_t col = STEP; ok && col < W - STEP; ++col)
+                ok = tr_counts(r)[row * W + col] == 1;
+
+        tr_destroy(r);
+        if (!ok) return false;
+    }
+
+    return true;
+}
+
+// Builds a mesh whose vertices lie exactly on cell centers (where the
+// edge tests give exactly 0), and checks every kernel the CPU supports
+// against the scalar kernel on it. The counts agree only if every
+// kernel computes the edge functions the same way.
+int main(void)
+{
+    static double xs[(G + 1) * (G + 1)], ys[(G + 1) * (G + 1)];
+    const double cw = (win_x1 - win_x0) / W, ch = (win_y1 - win_y0) / W;
+
+    srand(1);
+
+    for (int i = 0; i <= G; ++i)
+        for (int j = 0; j <= G; ++j) {
+            xs[i * (G + 1) + j] = win_x0 + (place(i) + 0.5) * cw;
+            ys[i * (G + 1) + j] = win_y0 + (place(j) + 0.5) * ch;
+        }
+
+    tri_batch_t mesh = grid_mesh(G, xs, ys);
+    if (!mesh) return 1;
+
+    tri_raster_t ref = render(mesh, TR_KERNEL_SCALAR, 1);
+    bool ok = ref != NULL;
+
+    for (int k = TR_KERNEL_SCALAR; ok && k <= TR_KERNEL_AVX512; ++k) {
+        tri_raster_t probe = tr_create(1, 1, TR_COUNT);
+        if (!probe) return 1;
+        bool supported = tr_use_kernel(probe, k);
+        tr_destroy(probe);
+
+        if (!supported) {
+            printf("raster kernel %s: not supported here\n", kernel_names[k]);
+            continue;
+        }
+
+        ok = check_kernel(k, mesh, ref);
+        printf("raster kernel %s %s\n", kernel_names[k],
+               ok ? "agrees" : "DISAGREES");
+    }
+
+    tr_destroy(ref);
+    tb_destroy(mesh);
+    return ok ? 0 : 1;
+}